@@ -0,0 +1,372 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+
+#include <pcap/pcap.h>
+
+#include "usteer.h"
+#include "capture.h"
+
+#ifndef DLT_LINUX_SLL2
+#define DLT_LINUX_SLL2		276
+#endif
+#ifndef DLT_IPV4
+#define DLT_IPV4		228
+#endif
+#ifndef DLT_IPV6
+#define DLT_IPV6		229
+#endif
+#ifndef ETHERTYPE_QINQ
+#define ETHERTYPE_QINQ		0x88a8
+#endif
+#define ETHERTYPE_QINQ_OLD	0x9100
+#ifndef IPPROTO_FRAGMENT
+#define IPPROTO_FRAGMENT	44
+#endif
+
+/* IP header */
+struct ip_header {
+	uint8_t ip_vhl;		/* version << 4 | header length >> 2 */
+	uint8_t ip_tos;		/* type of service */
+	uint16_t ip_len;		/* total length */
+	uint16_t ip_id;		/* identification */
+	uint16_t ip_off;		/* fragment offset field */
+#define IP_RF 0x8000		/* reserved fragment flag */
+#define IP_DF 0x4000		/* dont fragment flag */
+#define IP_MF 0x2000		/* more fragments flag */
+#define IP_OFFMASK 0x1fff	/* mask for fragmenting bits */
+	uint8_t ip_ttl;		/* time to live */
+	uint8_t ip_p;		/* protocol */
+	uint16_t ip_sum;		/* checksum */
+	struct in_addr ip_src, ip_dst; /* source and dest address */
+};
+#define IP_HL(ip)		(((ip)->ip_vhl) & 0x0f)
+#define IP_V(ip)		(((ip)->ip_vhl) >> 4)
+
+/* IPv6 header */
+struct ip6_header {
+	uint32_t ip6_flow;	/* version, traffic class, flow label */
+	uint16_t ip6_plen;	/* payload length */
+	uint8_t ip6_nxt;	/* next header */
+	uint8_t ip6_hlim;	/* hop limit */
+	struct in6_addr ip6_src, ip6_dst; /* source and dest address */
+};
+
+struct udp_header {
+	uint16_t uh_sport;       /* source port */
+	uint16_t uh_dport;       /* destination port */
+	uint16_t uh_ulen;        /* udp length */
+	uint16_t uh_sum;     /* udp checksum */
+};
+
+#define FRAG_SLOTS		8
+#define FRAG_BUFLEN		(sizeof(struct udp_header) + APMGR_BUFLEN)
+
+/* UDP datagram being reassembled from IP fragments */
+struct frag_slot {
+	struct in6_addr src, dst;
+	uint32_t id;
+	uint32_t age;
+	bool used;
+
+	/* datagram length, -1 until the last fragment has been seen */
+	int total;
+
+	/* one bit per 8 byte fragment block */
+	uint8_t map[FRAG_BUFLEN / 64 + 1];
+	uint8_t data[FRAG_BUFLEN];
+};
+
+static struct frag_slot frags[FRAG_SLOTS];
+
+/* Strip the link layer header, returns the ethertype of the payload or 0 */
+static int
+parse_link(int link_type, const unsigned char **packet, int *len)
+{
+	const unsigned char *p = *packet;
+	int hdrlen, offset;
+	int proto;
+
+	switch (link_type) {
+	case DLT_EN10MB:
+		hdrlen = 14;
+		offset = 12;
+		break;
+	case DLT_LINUX_SLL:
+		hdrlen = 16;
+		offset = 14;
+		break;
+	case DLT_LINUX_SLL2:
+		hdrlen = 20;
+		offset = 0;
+		break;
+	case DLT_RAW:
+	case DLT_IPV4:
+	case DLT_IPV6:
+		if (*len < 1)
+			return 0;
+		return (p[0] >> 4) == 6 ? ETHERTYPE_IPV6 : ETHERTYPE_IP;
+	default:
+		return 0;
+	}
+
+	if (*len < hdrlen)
+		return 0;
+
+	proto = (p[offset] << 8) | p[offset + 1];
+	p += hdrlen;
+	*len -= hdrlen;
+
+	/* 802.1Q and 802.1ad tags */
+	while (proto == ETHERTYPE_VLAN || proto == ETHERTYPE_QINQ ||
+	       proto == ETHERTYPE_QINQ_OLD) {
+		if (*len < 4)
+			return 0;
+
+		proto = (p[2] << 8) | p[3];
+		p += 4;
+		*len -= 4;
+	}
+
+	*packet = p;
+
+	return proto;
+}
+
+static void
+ip4_mapped(struct in6_addr *addr, const struct in_addr *ip4)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->s6_addr[10] = 0xff;
+	addr->s6_addr[11] = 0xff;
+	memcpy(&addr->s6_addr[12], ip4, 4);
+}
+
+static struct frag_slot *
+frag_get(const struct in6_addr *src, const struct in6_addr *dst, uint32_t id)
+{
+	static uint32_t age;
+	struct frag_slot *slot, *oldest = NULL;
+	int i;
+
+	age++;
+	for (i = 0; i < FRAG_SLOTS; i++) {
+		slot = &frags[i];
+		if (slot->used && slot->id == id &&
+		    !memcmp(&slot->src, src, sizeof(*src)) &&
+		    !memcmp(&slot->dst, dst, sizeof(*dst))) {
+			slot->age = age;
+			return slot;
+		}
+
+		if (!oldest || (oldest->used &&
+				(!slot->used || slot->age < oldest->age)))
+			oldest = slot;
+	}
+
+	/* incomplete datagrams are dropped once their slot is needed */
+	slot = oldest;
+	slot->src = *src;
+	slot->dst = *dst;
+	slot->id = id;
+	slot->age = age;
+	slot->used = true;
+	slot->total = -1;
+	memset(slot->map, 0, sizeof(slot->map));
+
+	return slot;
+}
+
+/*
+ * Store one fragment of a UDP datagram. Returns the datagram (starting with
+ * the UDP header) once all fragments have been seen, NULL otherwise. The data
+ * stays valid until the next call.
+ */
+static const unsigned char *
+frag_add(const struct in6_addr *src, const struct in6_addr *dst, uint32_t id,
+	 int offset, bool more, const unsigned char *packet, int *len)
+{
+	struct frag_slot *slot;
+	int end = offset + *len;
+	int i;
+
+	if (!*len || end > FRAG_BUFLEN || (more && (*len % 8)))
+		return NULL;
+
+	slot = frag_get(src, dst, id);
+	if (!more)
+		slot->total = end;
+
+	memcpy(slot->data + offset, packet, *len);
+	for (i = offset / 8; i < (end + 7) / 8; i++)
+		slot->map[i / 8] |= 1 << (i % 8);
+
+	if (slot->total < 0)
+		return NULL;
+
+	for (i = 0; i < (slot->total + 7) / 8; i++)
+		if (!(slot->map[i / 8] & (1 << (i % 8))))
+			return NULL;
+
+	slot->used = false;
+	*len = slot->total;
+
+	return slot->data;
+}
+
+static const unsigned char *
+parse_udp(const unsigned char *packet, int *len)
+{
+	struct udp_header *uh = (void *) packet;
+	int ulen;
+
+	if (*len <= sizeof(*uh) || uh->uh_dport != htons(APMGR_PORT))
+		return NULL;
+
+	/* the frame may be padded behind the datagram */
+	ulen = ntohs(uh->uh_ulen);
+	if (ulen <= sizeof(*uh) || ulen > *len)
+		return NULL;
+
+	*len = ulen - sizeof(*uh);
+
+	return packet + sizeof(*uh);
+}
+
+/*
+ * Returns the payload of a UDP packet to APMGR_PORT, NULL for anything else.
+ * Fragments are reassembled, *len is set to 0 while a datagram is incomplete.
+ */
+static const unsigned char *
+parse_ip(const unsigned char *packet, int *len, int proto, struct in6_addr *src)
+{
+	struct ip6_header *ip6;
+	struct ip_header *ip;
+	struct in6_addr dst;
+	int hdrlen, next, total;
+	int offset = 0;
+	bool more = false;
+	uint32_t id = 0;
+	uint16_t val;
+
+	switch (proto) {
+	case ETHERTYPE_IP:
+		ip = (void *) packet;
+		if (*len < sizeof(*ip))
+			return NULL;
+
+		hdrlen = IP_HL(ip) * 4;
+		total = ntohs(ip->ip_len);
+		if (IP_V(ip) != 4 || hdrlen < 20 || hdrlen >= total ||
+		    total > *len || ip->ip_p != IPPROTO_UDP)
+			return NULL;
+
+		*len = total;
+		val = ntohs(ip->ip_off);
+		offset = (val & IP_OFFMASK) * 8;
+		more = !!(val & IP_MF);
+		id = ntohs(ip->ip_id);
+
+		ip4_mapped(src, &ip->ip_src);
+		ip4_mapped(&dst, &ip->ip_dst);
+		break;
+	case ETHERTYPE_IPV6:
+		ip6 = (void *) packet;
+		if (*len < sizeof(*ip6))
+			return NULL;
+
+		hdrlen = sizeof(*ip6);
+		total = hdrlen + ntohs(ip6->ip6_plen);
+		if (total > *len)
+			return NULL;
+
+		*len = total;
+		next = ip6->ip6_nxt;
+		while (next == IPPROTO_HOPOPTS || next == IPPROTO_ROUTING ||
+		       next == IPPROTO_DSTOPTS || next == IPPROTO_FRAGMENT) {
+			if (*len < hdrlen + 8)
+				return NULL;
+
+			if (next != IPPROTO_FRAGMENT) {
+				next = packet[hdrlen];
+				hdrlen += (packet[hdrlen + 1] + 1) * 8;
+				continue;
+			}
+
+			memcpy(&val, &packet[hdrlen + 2], sizeof(val));
+			val = ntohs(val);
+			offset = val & ~7;
+			more = !!(val & 1);
+			memcpy(&id, &packet[hdrlen + 4], sizeof(id));
+			id = ntohl(id);
+
+			next = packet[hdrlen];
+			hdrlen += 8;
+		}
+
+		if (next != IPPROTO_UDP || hdrlen >= *len)
+			return NULL;
+
+		memcpy(src, &ip6->ip6_src, sizeof(*src));
+		memcpy(&dst, &ip6->ip6_dst, sizeof(dst));
+		break;
+	default:
+		return NULL;
+	}
+
+	packet += hdrlen;
+	*len -= hdrlen;
+
+	if (offset || more) {
+		packet = frag_add(src, &dst, id, offset, more, packet, len);
+		if (!packet) {
+			*len = 0;
+			return NULL;
+		}
+	}
+
+	return parse_udp(packet, len);
+}
+
+bool capture_link_supported(int link_type)
+{
+	switch (link_type) {
+	case DLT_EN10MB:
+	case DLT_LINUX_SLL:
+	case DLT_LINUX_SLL2:
+	case DLT_RAW:
+	case DLT_IPV4:
+	case DLT_IPV6:
+		return true;
+	default:
+		return false;
+	}
+}
+
+const void *capture_payload(int link_type, const unsigned char *packet,
+			    int *len, struct in6_addr *src)
+{
+	int proto;
+
+	proto = parse_link(link_type, &packet, len);
+
+	return parse_ip(packet, len, proto, src);
+}
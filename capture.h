@@ -0,0 +1,40 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+#ifndef __USTEER_CAPTURE_H
+#define __USTEER_CAPTURE_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+
+bool capture_link_supported(int link_type);
+
+/*
+ * Locate the payload of a captured UDP packet sent to APMGR_PORT. On success
+ * *len is updated to the payload length and src is set to the sender (IPv4
+ * addresses are stored v4-mapped). Returns NULL for any other traffic.
+ *
+ * Fragmented datagrams are reassembled: NULL is returned with *len set to 0
+ * until the last missing fragment arrives. The returned data is only valid
+ * until the next call.
+ */
+const void *capture_payload(int link_type, const unsigned char *packet,
+			    int *len, struct in6_addr *src);
+
+#endif
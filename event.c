@@ -18,6 +18,7 @@
  */
 #include "usteer.h"
 #include "event.h"
+#include "evring.h"
 
 #define UEV_LOG_MAXLEN	256
 
@@ -51,6 +52,55 @@ static const char * const uev_select_reason[] = {
 	[UEV_SELECT_REASON_LOAD] = "load",
 };
 
+/*
+ * Per event type limits, set with event_limits.
+ * Of every <sample> events only one is considered, those are then passed
+ * through a token bucket refilled with <rate> events per second, holding
+ * at most <burst> events.
+ */
+static struct uev_limit {
+	uint32_t rate;
+	uint32_t burst;
+	uint32_t sample;
+
+	uint32_t sample_count;
+	uint64_t tokens;	/* in 1/1000 events */
+	uint64_t last;
+
+	uint32_t suppressed;
+} uev_limits[ARRAY_SIZE(uev_name)];
+
+static bool
+usteer_event_limit(struct uevent *ev)
+{
+	struct uev_limit *l = &uev_limits[ev->type];
+
+	if (l->sample > 1 && l->sample_count++ % l->sample)
+		goto suppress;
+
+	if (l->rate) {
+		uint64_t max = (uint64_t) l->burst * 1000;
+
+		l->tokens += (current_time - l->last) * l->rate;
+		l->last = current_time;
+		if (l->tokens > max)
+			l->tokens = max;
+
+		if (l->tokens < 1000)
+			goto suppress;
+
+		l->tokens -= 1000;
+	}
+
+	ev->suppressed = l->suppressed;
+	l->suppressed = 0;
+	return false;
+
+suppress:
+	l->suppressed++;
+	return true;
+}
+
 static void
 usteer_event_add_node_status(struct usteer_node *node)
 {
@@ -118,6 +168,9 @@ usteer_event_send_ubus(struct uevent *ev)
 	if (ev->count)
 		blobmsg_add_u32(&b, "count", ev->count);
 
+	if (ev->suppressed)
+		blobmsg_add_u32(&b, "suppressed", ev->suppressed);
+
 	ubus_notify(ubus_ctx, &usteer_obj, uev_name[ev->type], b.head, -1);
 }
 
@@ -182,6 +235,8 @@ usteer_event_log(struct uevent *ev)
 					ev->si_other->signal);
 		cur += usteer_event_log_node(cur, end - cur, "remote_", ev->node_other);
 	}
+	if (ev->suppressed)
+		cur += snprintf(cur, end - cur, " suppressed=%d", ev->suppressed);
 
 	log_msg(str);
 }
@@ -207,10 +262,70 @@ void usteer_event(struct uevent *ev)
 	if (ev->si_other && ev->node_cur && !ev->node_other)
 		ev->node_other = ev->si_other->node;
 
+	if (ev->node_local)
+		ev->node_local->event_count[ev->type][ev->reason]++;
+
+	/* the ring is cheap to write, so it gets every event */
+	usteer_evring_add(ev);
+
+	if (usteer_event_limit(ev))
+		return;
+
 	usteer_event_send_ubus(ev);
 	usteer_event_log(ev);
 }
 
+/* Name tables for the event ring, so readers do not depend on this build */
+void usteer_event_get_names(struct usteer_evring_names *names)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(uev_name) && i < USTEER_EVRING_TYPES; i++)
+		if (uev_name[i])
+			snprintf(names->types[i], sizeof(names->types[i]), "%s", uev_name[i]);
+
+	for (i = 0; i < ARRAY_SIZE(uev_reason) && i < USTEER_EVRING_REASONS; i++)
+		if (uev_reason[i])
+			snprintf(names->reasons[i], sizeof(names->reasons[i]), "%s", uev_reason[i]);
+
+	for (i = 0; i < ARRAY_SIZE(uev_select_reason) && i < USTEER_EVRING_SELECT; i++)
+		if (uev_select_reason[i])
+			snprintf(names->select[i], sizeof(names->select[i]), "%s", uev_select_reason[i]);
+}
+
+const char *usteer_event_name(enum uevent_type type)
+{
+	return uev_name[type];
+}
+
+const char *usteer_event_reason_name(enum uevent_reason reason)
+{
+	return uev_reason[reason];
+}
+
+void usteer_event_dump_counters(struct blob_buf *buf, struct usteer_node *node)
+{
+	void *c, *t = NULL;
+	int i, j;
+
+	c = blobmsg_open_table(buf, "events");
+	for (i = 0; i < __UEV_TYPE_MAX; i++) {
+		for (j = 0; j < __UEV_REASON_MAX; j++) {
+			if (!node->event_count[i][j])
+				continue;
+
+			if (!t)
+				t = blobmsg_open_table(buf, uev_name[i]);
+			blobmsg_add_u32(buf, uev_reason[j], node->event_count[i][j]);
+		}
+
+		if (t)
+			blobmsg_close_table(buf, t);
+		t = NULL;
+	}
+	blobmsg_close_table(buf, c);
+}
+
 void config_set_event_log_types(struct blob_attr *attr)
 {
 	struct blob_attr *cur;
@@ -280,3 +395,108 @@ void config_get_event_log_types(struct blob_buf *buf)
 	}
 	blobmsg_close_array(buf, c);
 }
+
+static int
+usteer_event_type_lookup(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(uev_name); i++)
+		if (uev_name[i] && !strcmp(uev_name[i], name))
+			return i;
+
+	return -1;
+}
+
+/*
+ * Each entry is "<event type> [rate=<n>] [burst=<n>] [sample=<n>]"
+ */
+static bool
+usteer_event_parse_limit(char *str, struct uev_limit *l)
+{
+	char *cur, *sep;
+	uint32_t val;
+	int type;
+
+	cur = strtok_r(str, " ", &sep);
+	if (!cur)
+		return false;
+
+	type = usteer_event_type_lookup(cur);
+	if (type < 0)
+		return false;
+
+	memset(l, 0, sizeof(*l));
+	while ((cur = strtok_r(NULL, " ", &sep)) != NULL) {
+		char *val_str = strchr(cur, '=');
+
+		if (!val_str)
+			return false;
+
+		*(val_str++) = 0;
+		val = strtoul(val_str, NULL, 0);
+		if (!strcmp(cur, "rate"))
+			l->rate = val;
+		else if (!strcmp(cur, "burst"))
+			l->burst = val;
+		else if (!strcmp(cur, "sample"))
+			l->sample = val;
+		else
+			return false;
+	}
+
+	if (!l->burst)
+		l->burst = l->rate;
+	if (l->burst < 1)
+		l->burst = 1;
+
+	l->tokens = (uint64_t) l->burst * 1000;
+	l->last = current_time;
+	uev_limits[type] = *l;
+
+	return true;
+}
+
+void config_set_event_limits(struct blob_attr *attr)
+{
+	struct uev_limit l;
+	struct blob_attr *cur;
+	int rem;
+
+	memset(uev_limits, 0, sizeof(uev_limits));
+	if (!attr || blobmsg_check_array(attr, BLOBMSG_TYPE_STRING) < 0)
+		return;
+
+	blobmsg_for_each_attr(cur, attr, rem) {
+		char *str = strdup(blobmsg_get_string(cur));
+
+		if (!usteer_event_parse_limit(str, &l))
+			MSG(INFO, "Invalid event limit '%s'\n", blobmsg_get_string(cur));
+
+		free(str);
+	}
+}
+
+void config_get_event_limits(struct blob_buf *buf)
+{
+	struct uev_limit *l;
+	char str[128], *cur, *end = str + sizeof(str);
+	void *c;
+	int i;
+
+	c = blobmsg_open_array(buf, "event_limits");
+	for (i = 0; i < ARRAY_SIZE(uev_limits); i++) {
+		l = &uev_limits[i];
+		if (!l->rate && l->sample <= 1)
+			continue;
+
+		cur = str;
+		cur += snprintf(cur, end - cur, "%s", uev_name[i]);
+		if (l->rate)
+			cur += snprintf(cur, end - cur, " rate=%u burst=%u", l->rate, l->burst);
+		if (l->sample > 1)
+			cur += snprintf(cur, end - cur, " sample=%u", l->sample);
+		blobmsg_add_string(buf, NULL, str);
+	}
+	blobmsg_close_array(buf, c);
+}
@@ -14,6 +14,7 @@ enum uevent_type {
 	UEV_LOAD_KICK_NO_CLIENT,
 	UEV_LOAD_KICK_CLIENT,
 	UEV_SIGNAL_KICK,
+	__UEV_TYPE_MAX
 };
 
 enum uevent_reason {
@@ -22,6 +23,7 @@ enum uevent_reason {
 	UEV_REASON_LOW_SIGNAL,
 	UEV_REASON_CONNECT_DELAY,
 	UEV_REASON_BETTER_CANDIDATE,
+	__UEV_REASON_MAX
 };
 
 enum uevent_select_reason {
@@ -48,14 +50,26 @@ struct uevent {
 
 	unsigned int count;
 
+	/* events of this type dropped by event_limits since the last one */
+	unsigned int suppressed;
+
 	struct {
 		int cur;
 		int ref;
 	} threshold;
 };
 
+struct usteer_evring_names;
+
 void usteer_event(struct uevent *ev);
+void usteer_event_get_names(struct usteer_evring_names *names);
+void usteer_event_dump_counters(struct blob_buf *buf, struct usteer_node *node);
+const char *usteer_event_name(enum uevent_type type);
+const char *usteer_event_reason_name(enum uevent_reason reason);
+void usteer_evring_add(struct uevent *ev);
 void config_set_event_log_types(struct blob_attr *attr);
 void config_get_event_log_types(struct blob_buf *buf);
+void config_set_event_limits(struct blob_attr *attr);
+void config_get_event_limits(struct blob_buf *buf);
 
 #endif
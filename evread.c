@@ -0,0 +1,314 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "evring.h"
+
+static struct {
+	void *map;
+	size_t len;
+	ino_t ino;
+
+	const struct usteer_evring_header *hdr;
+	const struct usteer_evring_names *names;
+	const char (*nodes)[USTEER_EVRING_NODE_LEN];
+	const struct usteer_evring_rec *ring;
+} ring;
+
+static uint64_t lost;
+
+static void ring_close(void)
+{
+	if (!ring.map)
+		return;
+
+	munmap(ring.map, ring.len);
+	ring.map = NULL;
+	ring.hdr = NULL;
+}
+
+static bool ring_open(const char *path, bool quiet)
+{
+	const struct usteer_evring_header *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (!quiet)
+			perror("open");
+		return false;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(*hdr)) {
+		if (!quiet)
+			fprintf(stderr, "%s: not an event ring\n", path);
+		close(fd);
+		return false;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		if (!quiet)
+			perror("mmap");
+		return false;
+	}
+
+	hdr = map;
+	if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != USTEER_EVRING_MAGIC ||
+	    hdr->version != USTEER_EVRING_VERSION ||
+	    hdr->rec_size != sizeof(struct usteer_evring_rec) ||
+	    !hdr->n_records || (hdr->n_records & (hdr->n_records - 1)) ||
+	    hdr->records + (uint64_t) hdr->n_records * hdr->rec_size > st.st_size) {
+		if (!quiet)
+			fprintf(stderr, "%s: unsupported event ring format\n", path);
+		munmap(map, st.st_size);
+		return false;
+	}
+
+	ring.map = map;
+	ring.len = st.st_size;
+	ring.ino = st.st_ino;
+	ring.hdr = hdr;
+	ring.names = map + hdr->names;
+	ring.nodes = map + hdr->nodes;
+	ring.ring = map + hdr->records;
+
+	return true;
+}
+
+static bool ring_replaced(const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) < 0)
+		return false;
+
+	return st.st_ino != ring.ino;
+}
+
+static const char *
+name(const char *table, int size, int idx)
+{
+	static char buf[16];
+
+	if (idx < size && table[idx * USTEER_EVRING_NAME_LEN])
+		return &table[idx * USTEER_EVRING_NAME_LEN];
+
+	snprintf(buf, sizeof(buf), "%d", idx);
+	return buf;
+}
+
+static const char *
+node_name(unsigned int id)
+{
+	if (!id || id > __atomic_load_n(&ring.hdr->n_nodes, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return ring.nodes[id - 1];
+}
+
+static void print_node(const char *key, unsigned int id)
+{
+	const char *name = node_name(id);
+
+	if (name)
+		printf(" %s=%.*s", key, USTEER_EVRING_NODE_LEN, name);
+}
+
+static void print_rec(const struct usteer_evring_rec *rec)
+{
+	const struct usteer_evring_names *n = ring.names;
+	int64_t ms = (int64_t) rec->time + ring.hdr->time_offset;
+	time_t sec = ms / 1000;
+	char tbuf[32];
+	int i;
+
+	strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime(&sec));
+	printf("%s.%03d event=%s", tbuf, (int) (ms % 1000),
+	       name(&n->types[0][0], USTEER_EVRING_TYPES, rec->type));
+
+	print_node("node", rec->node_local);
+
+	if (rec->reason)
+		printf(" reason=%s", name(&n->reasons[0][0], USTEER_EVRING_REASONS, rec->reason));
+
+	if (rec->select_reasons) {
+		printf(" select_reason");
+		for (i = 0; i < USTEER_EVRING_SELECT; i++) {
+			if (!(rec->select_reasons & (1 << i)))
+				continue;
+
+			printf("%c%s", i ? ',' : '=', name(&n->select[0][0], USTEER_EVRING_SELECT, i));
+		}
+	}
+
+	if (rec->flags & USTEER_EVRING_F_THRESHOLD)
+		printf(" threshold=%d/%d", rec->thr_cur, rec->thr_ref);
+
+	if (rec->count)
+		printf(" count=%u", rec->count);
+
+	if (rec->suppressed)
+		printf(" suppressed=%u", rec->suppressed);
+
+	if (rec->flags & USTEER_EVRING_F_STA)
+		printf(" sta=%02x:%02x:%02x:%02x:%02x:%02x",
+		       rec->sta[0], rec->sta[1], rec->sta[2],
+		       rec->sta[3], rec->sta[4], rec->sta[5]);
+
+	if (rec->flags & USTEER_EVRING_F_SIGNAL)
+		printf(" signal=%d", rec->signal);
+
+	if (node_name(rec->node_cur)) {
+		print_node("remote", rec->node_cur);
+		printf(" assoc=%d load=%d", rec->assoc_cur, rec->load_cur);
+	}
+
+	if (node_name(rec->node_other)) {
+		print_node("select", rec->node_other);
+		printf(" select_assoc=%d select_load=%d", rec->assoc_other, rec->load_other);
+		if (rec->flags & USTEER_EVRING_F_SIGNAL_OTHER)
+			printf(" select_signal=%d", rec->signal_other);
+	}
+
+	putchar('\n');
+}
+
+/* Copy the record at pos, returns false if it was overwritten meanwhile */
+static bool read_rec(uint64_t pos, struct usteer_evring_rec *rec)
+{
+	const struct usteer_evring_rec *src;
+
+	src = &ring.ring[pos & (ring.hdr->n_records - 1)];
+	if (__atomic_load_n(&src->seq, __ATOMIC_ACQUIRE) != pos + 1)
+		return false;
+
+	memcpy(rec, src, sizeof(*rec));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return __atomic_load_n(&src->seq, __ATOMIC_RELAXED) == pos + 1;
+}
+
+static uint64_t read_ring(uint64_t pos)
+{
+	struct usteer_evring_rec rec;
+	uint64_t head;
+
+	head = __atomic_load_n(&ring.hdr->head, __ATOMIC_ACQUIRE);
+	if (head - pos > ring.hdr->n_records) {
+		lost += head - pos - ring.hdr->n_records;
+		pos = head - ring.hdr->n_records;
+	}
+
+	for (; pos < head; pos++) {
+		if (!read_rec(pos, &rec)) {
+			lost++;
+			continue;
+		}
+
+		print_rec(&rec);
+	}
+
+	return pos;
+}
+
+static int usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <file>\n"
+		"Options:\n"
+		" -f:           Keep waiting for new events\n"
+		" -n:           Only print events written after startup\n"
+		" -i <msec>:    Poll interval in follow mode (default: 100)\n"
+		"\n", prog);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	bool follow = false, skip = false;
+	int interval = 100;
+	const char *path;
+	uint64_t pos;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "fi:n")) != -1) {
+		switch (ch) {
+		case 'f':
+			follow = true;
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			if (interval <= 0)
+				return usage(argv[0]);
+			break;
+		case 'n':
+			skip = true;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (optind + 1 != argc)
+		return usage(argv[0]);
+
+	path = argv[optind];
+	if (!ring_open(path, false))
+		return 1;
+
+	/* start with the oldest record still in the ring */
+	pos = __atomic_load_n(&ring.hdr->head, __ATOMIC_ACQUIRE);
+	if (!skip)
+		pos -= pos < ring.hdr->n_records ? pos : ring.hdr->n_records;
+
+	pos = read_ring(pos);
+	while (follow) {
+		fflush(stdout);
+		usleep(interval * 1000);
+
+		/* usteerd creates a new file when the ring is reconfigured */
+		if (ring_replaced(path)) {
+			ring_close();
+			while (!ring_open(path, true))
+				usleep(interval * 1000);
+			pos = 0;
+		}
+
+		pos = read_ring(pos);
+	}
+
+	if (lost)
+		fprintf(stderr, "%llu events lost\n", (unsigned long long) lost);
+
+	ring_close();
+
+	return 0;
+}
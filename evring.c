@@ -0,0 +1,280 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <libubox/avl-cmp.h>
+
+#include "usteer.h"
+#include "event.h"
+#include "evring.h"
+
+static struct {
+	char *path;
+	uint32_t size;
+
+	void *map;
+	size_t map_len;
+	struct usteer_evring_header *hdr;
+	char (*nodes)[USTEER_EVRING_NODE_LEN];
+	struct usteer_evring_rec *ring;
+
+	/* node name -> table index + 1, keys point into the mapped table */
+	struct avl_tree node_ids;
+} evring;
+
+struct evring_node {
+	struct avl_node avl;
+	int id;
+};
+
+static void
+usteer_evring_close(void)
+{
+	struct evring_node *n, *tmp;
+
+	if (!evring.map)
+		return;
+
+	avl_remove_all_elements(&evring.node_ids, n, avl, tmp)
+		free(n);
+
+	munmap(evring.map, evring.map_len);
+	evring.map = NULL;
+	evring.hdr = NULL;
+}
+
+static void
+usteer_evring_open(void)
+{
+	struct usteer_evring_header *hdr;
+	struct timeval tv;
+	uint32_t n = 1;
+	size_t len;
+	void *map;
+	int fd;
+
+	while (n < evring.size)
+		n <<= 1;
+
+	len = sizeof(*hdr) + sizeof(struct usteer_evring_names) +
+	      USTEER_EVRING_NODES * USTEER_EVRING_NODE_LEN +
+	      (size_t) n * sizeof(struct usteer_evring_rec);
+
+	/* readers may still have the old file mapped, start from a new one */
+	unlink(evring.path);
+	fd = open(evring.path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0 || ftruncate(fd, len) < 0) {
+		MSG(FATAL, "Failed to create event ring %s: %s\n",
+		    evring.path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		MSG(FATAL, "Failed to map event ring %s: %s\n",
+		    evring.path, strerror(errno));
+		return;
+	}
+
+	evring.map = map;
+	evring.map_len = len;
+
+	hdr = map;
+	hdr->rec_size = sizeof(struct usteer_evring_rec);
+	hdr->n_records = n;
+	hdr->names = sizeof(*hdr);
+	hdr->nodes = hdr->names + sizeof(struct usteer_evring_names);
+	hdr->records = hdr->nodes + USTEER_EVRING_NODES * USTEER_EVRING_NODE_LEN;
+
+	usteer_update_time();
+	gettimeofday(&tv, NULL);
+	hdr->time_offset = (int64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000 -
+			   (int64_t) current_time;
+
+	usteer_event_get_names(map + hdr->names);
+	evring.nodes = map + hdr->nodes;
+	evring.ring = map + hdr->records;
+	avl_init(&evring.node_ids, avl_strcmp, false, NULL);
+
+	hdr->version = USTEER_EVRING_VERSION;
+	__atomic_store_n(&hdr->magic, USTEER_EVRING_MAGIC, __ATOMIC_RELEASE);
+	evring.hdr = hdr;
+
+	MSG(INFO, "Writing events to %s (%u records)\n", evring.path, n);
+}
+
+static uint16_t
+usteer_evring_node_id(struct usteer_node *node)
+{
+	const char *name;
+	struct evring_node *n;
+	uint32_t id;
+
+	if (!node)
+		return 0;
+
+	name = usteer_node_name(node);
+	n = avl_find_element(&evring.node_ids, name, n, avl);
+	if (n)
+		return n->id;
+
+	id = evring.hdr->n_nodes;
+	if (id == USTEER_EVRING_NODES)
+		return 0;
+
+	snprintf(evring.nodes[id], USTEER_EVRING_NODE_LEN, "%s", name);
+
+	n = calloc(1, sizeof(*n));
+	n->id = id + 1;
+	n->avl.key = evring.nodes[id];
+	avl_insert(&evring.node_ids, &n->avl);
+
+	/* publish the name before any record refers to it */
+	__atomic_store_n(&evring.hdr->n_nodes, id + 1, __ATOMIC_RELEASE);
+
+	return n->id;
+}
+
+void usteer_evring_add(struct uevent *ev)
+{
+	struct usteer_evring_header *hdr = evring.hdr;
+	struct usteer_evring_rec *rec;
+	uint64_t pos;
+
+	if (!hdr)
+		return;
+
+	pos = hdr->head;
+	rec = &evring.ring[pos & (hdr->n_records - 1)];
+
+	__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	rec->time = current_time;
+	rec->type = ev->type;
+	rec->reason = ev->reason;
+	rec->select_reasons = ev->select_reasons;
+	rec->node_local = usteer_evring_node_id(ev->node_local);
+	rec->node_cur = usteer_evring_node_id(ev->node_cur);
+	rec->node_other = usteer_evring_node_id(ev->node_other);
+	rec->thr_cur = ev->threshold.cur;
+	rec->thr_ref = ev->threshold.ref;
+	rec->count = ev->count;
+	rec->suppressed = ev->suppressed;
+	rec->flags = 0;
+
+	if (ev->sta) {
+		memcpy(rec->sta, ev->sta->addr, sizeof(rec->sta));
+		rec->flags |= USTEER_EVRING_F_STA;
+	}
+
+	if (ev->si_cur) {
+		rec->signal = ev->si_cur->signal;
+		rec->flags |= USTEER_EVRING_F_SIGNAL;
+	}
+
+	if (ev->si_other) {
+		rec->signal_other = ev->si_other->signal;
+		rec->flags |= USTEER_EVRING_F_SIGNAL_OTHER;
+	}
+
+	if (ev->threshold.ref)
+		rec->flags |= USTEER_EVRING_F_THRESHOLD;
+
+	if (ev->node_cur) {
+		rec->assoc_cur = ev->node_cur->n_assoc;
+		rec->load_cur = ev->node_cur->load;
+	}
+
+	if (ev->node_other) {
+		rec->assoc_other = ev->node_other->n_assoc;
+		rec->load_other = ev->node_other->load;
+	}
+
+	__atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&hdr->head, pos + 1, __ATOMIC_RELEASE);
+}
+
+static uint32_t
+usteer_evring_config_size(void)
+{
+	if (!config.event_ring_size) {
+		MSG(INFO, "Ignoring event_ring_size 0\n");
+		config.event_ring_size = evring.size ? evring.size :
+					 USTEER_EVRING_DEFAULT_SIZE;
+	} else if (config.event_ring_size > USTEER_EVRING_MAX_SIZE) {
+		MSG(INFO, "Limiting event_ring_size to %u\n",
+		    USTEER_EVRING_MAX_SIZE);
+		config.event_ring_size = USTEER_EVRING_MAX_SIZE;
+	}
+
+	return config.event_ring_size;
+}
+
+void usteer_evring_update_config(void)
+{
+	uint32_t size = usteer_evring_config_size();
+
+	if (!evring.path || evring.size == size)
+		return;
+
+	usteer_evring_close();
+	evring.size = size;
+	usteer_evring_open();
+}
+
+void config_set_event_ring(struct blob_attr *data)
+{
+	uint32_t size = usteer_evring_config_size();
+	const char *val;
+
+	if (!data)
+		return;
+
+	val = blobmsg_get_string(data);
+	if (evring.path && !strcmp(val, evring.path) && evring.size == size)
+		return;
+
+	usteer_evring_close();
+	free(evring.path);
+	evring.path = NULL;
+
+	if (!strlen(val))
+		return;
+
+	evring.path = strdup(val);
+	evring.size = size;
+	usteer_evring_open();
+}
+
+void config_get_event_ring(struct blob_buf *buf)
+{
+	if (!evring.path)
+		return;
+
+	blobmsg_add_string(buf, "event_ring", evring.path);
+}
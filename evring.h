@@ -0,0 +1,113 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+#ifndef __USTEER_EVRING_H
+#define __USTEER_EVRING_H
+
+#include <stdint.h>
+
+/*
+ * Policy events in a shared memory file, written by usteerd and read by
+ * usteer-evread without any locking.
+ *
+ * The file starts with a header, followed by the event type, reason and
+ * node name tables and a ring of fixed size records. Integers are in host
+ * byte order, readers are expected to run on the same machine.
+ *
+ * The writer clears a record's seq, fills it in, then sets seq to its
+ * position + 1 and advances head. A reader copies a record and checks
+ * that seq still matches the position it expects, otherwise the record was
+ * overwritten while it was being read.
+ */
+
+#define USTEER_EVRING_MAGIC	0x75657672 /* "uevr" */
+#define USTEER_EVRING_VERSION	1
+
+#define USTEER_EVRING_NAME_LEN	32
+#define USTEER_EVRING_NODE_LEN	64
+#define USTEER_EVRING_TYPES	32
+#define USTEER_EVRING_REASONS	16
+#define USTEER_EVRING_SELECT	16
+#define USTEER_EVRING_NODES	512
+
+/* limits for the event_ring_size option */
+#define USTEER_EVRING_DEFAULT_SIZE	4096
+#define USTEER_EVRING_MAX_SIZE		(1 << 20)
+
+enum {
+	USTEER_EVRING_F_STA		= (1 << 0),
+	USTEER_EVRING_F_SIGNAL		= (1 << 1),
+	USTEER_EVRING_F_SIGNAL_OTHER	= (1 << 2),
+	USTEER_EVRING_F_THRESHOLD	= (1 << 3),
+};
+
+struct usteer_evring_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t rec_size;
+	uint32_t n_records;	/* power of two */
+	uint32_t n_nodes;	/* node names in use */
+
+	uint32_t names;		/* offset of the name tables */
+	uint32_t nodes;		/* offset of the node name table */
+	uint32_t records;	/* offset of the ring */
+	uint32_t reserved;
+
+	/* add to the record time to get the wall clock time in ms */
+	int64_t time_offset;
+
+	/* records written so far */
+	uint64_t head;
+};
+
+struct usteer_evring_names {
+	char types[USTEER_EVRING_TYPES][USTEER_EVRING_NAME_LEN];
+	char reasons[USTEER_EVRING_REASONS][USTEER_EVRING_NAME_LEN];
+	char select[USTEER_EVRING_SELECT][USTEER_EVRING_NAME_LEN];
+};
+
+struct usteer_evring_rec {
+	uint64_t seq;
+	uint64_t time;
+
+	uint8_t type;
+	uint8_t reason;
+	uint8_t sta[6];
+
+	/* index + 1 into the node name table, 0 if not set */
+	uint16_t node_local;
+	uint16_t node_cur;
+	uint16_t node_other;
+	uint16_t select_reasons;
+
+	int16_t signal;
+	int16_t signal_other;
+	uint16_t assoc_cur;
+	uint16_t load_cur;
+	uint16_t assoc_other;
+	uint16_t load_other;
+
+	int32_t thr_cur;
+	int32_t thr_ref;
+	uint32_t count;
+	uint32_t flags;
+	uint32_t suppressed;	/* always 0, event_limits do not apply to the ring */
+};
+
+#endif
@@ -12,24 +12,60 @@
  *   along with this program; if not, write to the Free Software
  *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
  *
- *   Copyright (C) 2020 embedd.ch 
- *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
- *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ *   Copyright (C) 2020 embedd.ch
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name>
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org>
  */
 
 #include <libubox/blobmsg.h>
+#include <libubox/avl.h>
 #include <libubus.h>
+#include <net/ethernet.h>
+#include <netinet/ether.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <getopt.h>
 #include "utils.h"
 #include "timeout.h"
+#include "trace.h"
+#include "rand.h"
+
+#define MAX_BSS			64
+#define NO_SIGNAL		0xff
+#define PACE_INTERVAL		10
+#define RECONNECT_DELAY		100
+#define NOTIFY_TIMEOUT		100
+
+enum mobility {
+	MOBILITY_STATIC,
+	MOBILITY_WALK,
+	MOBILITY_LINE,
+};
+
+enum fake_event {
+	FE_PROBE,
+	FE_AUTH,
+	FE_ASSOC,
+	FE_BEACON_REPORT,
+	FE_BSS_TM_RESPONSE,
+	__FE_MAX
+};
+
+static const char * const fake_event_names[__FE_MAX] = {
+	[FE_PROBE] = "probe",
+	[FE_AUTH] = "auth",
+	[FE_ASSOC] = "assoc",
+	[FE_BEACON_REPORT] = "beacon-report",
+	[FE_BSS_TM_RESPONSE] = "bss-transition-response",
+};
 
 static struct blob_buf b;
 static LIST_HEAD(stations);
 static struct usteer_timeout_queue tq;
-static FILE *r_fd;
-static struct ubus_object bss_obj;
 static struct ubus_context *ubus_ctx;
+static uint64_t rand_state = 1;
 static int freq = 2412;
 static int verbose;
 
@@ -39,26 +75,94 @@ struct var {
 	int max;
 };
 
+struct bss {
+	struct ubus_object obj;
+	struct list_head clients;
+	struct blob_attr *nr_list;
+	char name[64];
+	uint8_t bssid[6];
+	int freq;
+	int idx;
+};
+
 struct sta_data {
 	struct list_head list;
+	struct list_head assoc_list;
+	struct avl_node avl;
 	struct usteer_timeout probe_t;
 	struct var probe;
 	struct var signal;
+
+	enum mobility mobility;
+	int mobility_arg;
+	int pos;
+	int dir;
+	uint64_t last_move;
+
+	int bss_signal[MAX_BSS];
+	struct bss *assoc;
+	struct bss *avoid;
 	uint8_t addr[6];
+
+	/*
+	 * Reactions to usteer requests. usteerd waits for the method reply
+	 * before it handles notifications, so they are sent afterwards.
+	 */
+	struct list_head deferred_list;
+	struct bss *transition;
+	struct bss *report;
+	bool btm_response;
 };
 
-static void gen_val(struct var *val)
+static struct bss *bss_list[MAX_BSS];
+static int n_bss;
+
+static LIST_HEAD(deferred);
+static struct uloop_timeout deferred_timeout;
+
+static struct {
+	uint32_t rate;
+	uint64_t last;
+	int64_t credit;
+	struct list_head *cur;
+	struct uloop_timeout timeout;
+} pace;
+
+struct fake_stats {
+	uint32_t events[__FE_MAX];
+	uint32_t denied[__FE_MAX];
+	uint32_t kicks;
+	uint32_t transitions;
+	uint32_t beacon_requests;
+	uint32_t lost;
+	uint32_t replayed;
+	uint32_t replay_denied;
+	uint64_t notify_time;
+};
+
+static struct fake_stats stats;
+static struct uloop_timeout stats_timeout;
+static int stats_interval = 10;
+static uint64_t stats_last;
+
+static int avl_macaddr_cmp(const void *k1, const void *k2, void *ptr)
 {
-	int delta = val->max - val->min;
-	uint8_t v;
+	return memcmp(k1, k2, 6);
+}
 
-	val->cur = val->min;
-	if (!delta)
-		return;
+static AVL_TREE(sta_tree, avl_macaddr_cmp, false, NULL);
 
-	if (fread(&v, sizeof(v), 1, r_fd) != sizeof(v))
-		fprintf(stderr, "short read\n");
-	val->cur += (((unsigned int) v) * delta) / 0xff;
+static uint64_t time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void gen_val(struct var *val)
+{
+	val->cur = rand_range(&rand_state, val->min, val->max);
 }
 
 static void
@@ -69,26 +173,191 @@ blobmsg_add_macaddr(struct blob_buf *buf, const char *name, const uint8_t *addr)
 	blobmsg_add_string_buffer(buf);
 }
 
-static void sta_send_probe(struct sta_data *sta)
+static int freq_to_channel(int freq)
+{
+	if (freq == 2484)
+		return 14;
+	if (freq < 2484)
+		return (freq - 2407) / 5;
+
+	return (freq - 5000) / 5;
+}
+
+static int freq_to_op_class(int freq)
+{
+	return freq < 4000 ? 81 : 128;
+}
+
+static int signal_to_rcpi(int signal)
+{
+	return (signal + 110) * 2;
+}
+
+static int __bss_notify(struct bss *bss, const char *method, struct blob_attr *msg)
+{
+	uint64_t start = time_us();
+	int ret;
+
+	ret = ubus_notify(ubus_ctx, &bss->obj, method, msg, NOTIFY_TIMEOUT);
+	stats.notify_time += time_us() - start;
+
+	return ret;
+}
+
+static int bss_notify(struct bss *bss, enum fake_event type)
+{
+	int ret;
+
+	ret = __bss_notify(bss, fake_event_names[type], b.head);
+	stats.events[type]++;
+	if (ret)
+		stats.denied[type]++;
+
+	return ret;
+}
+
+static int sta_send_event(struct sta_data *sta, struct bss *bss,
+			  enum fake_event type, int sig)
 {
-	const char *type = "probe";
 	int ret;
-	int sig = -95 + sta->signal.cur;
 
 	blob_buf_init(&b, 0);
 	blobmsg_add_macaddr(&b, "address", sta->addr);
-	blobmsg_add_u32(&b, "freq", freq);
+	blobmsg_add_u32(&b, "freq", bss->freq);
 	blobmsg_add_u32(&b, "signal", sig);
-	ret = ubus_notify(ubus_ctx, &bss_obj, type, b.head, 100);
+	ret = bss_notify(bss, type);
 	if (verbose)
-		fprintf(stderr, "STA "MAC_ADDR_FMT" probe: %d (%d ms, signal: %d)\n",
-			MAC_ADDR_DATA(sta->addr), ret, sta->probe.cur, sig);
+		fprintf(stderr, "STA "MAC_ADDR_FMT" %s %s: %d (signal: %d)\n",
+			MAC_ADDR_DATA(sta->addr), bss->name, fake_event_names[type],
+			ret, sig);
+
+	return ret;
+}
+
+static void sta_update_line(struct sta_data *sta, uint64_t now)
+{
+	int max_pos = (n_bss - 1) * 1000;
+	int i;
+
+	if (sta->last_move && max_pos > 0) {
+		sta->pos += sta->dir * (int) ((now - sta->last_move) * 1000 / sta->mobility_arg);
+		while (sta->pos < 0 || sta->pos > max_pos) {
+			sta->dir = -sta->dir;
+			sta->pos = sta->pos < 0 ? -sta->pos : 2 * max_pos - sta->pos;
+		}
+	}
+
+	for (i = 0; i < n_bss; i++) {
+		int dist = abs(sta->pos - i * 1000);
+
+		if (dist > 1000) {
+			sta->bss_signal[i] = NO_SIGNAL;
+			continue;
+		}
+
+		sta->bss_signal[i] = sta->signal.max -
+			(sta->signal.max - sta->signal.min) * dist / 1000;
+	}
+}
+
+static void sta_move(struct sta_data *sta)
+{
+	uint64_t now = time_us() / 1000;
+	int i;
+
+	switch (sta->mobility) {
+	case MOBILITY_STATIC:
+		break;
+	case MOBILITY_WALK:
+		for (i = 0; i < n_bss; i++) {
+			int sig = sta->bss_signal[i];
+
+			sig += rand_range(&rand_state, -sta->mobility_arg, sta->mobility_arg);
+			if (sig < sta->signal.min)
+				sig = sta->signal.min;
+			if (sig > sta->signal.max)
+				sig = sta->signal.max;
+			sta->bss_signal[i] = sig;
+		}
+		break;
+	case MOBILITY_LINE:
+		sta_update_line(sta, now);
+		break;
+	}
+
+	sta->last_move = now;
+}
+
+static void sta_disconnect(struct sta_data *sta)
+{
+	if (!sta->assoc)
+		return;
+
+	list_del(&sta->assoc_list);
+	sta->assoc = NULL;
+}
+
+static int sta_connect(struct sta_data *sta, struct bss *bss, int sig)
+{
+	if (sta_send_event(sta, bss, FE_AUTH, sig))
+		return 1;
+
+	if (sta_send_event(sta, bss, FE_ASSOC, sig))
+		return 2;
+
+	sta->assoc = bss;
+	sta->avoid = NULL;
+	list_add_tail(&sta->assoc_list, &bss->clients);
+
+	return 2;
+}
+
+/* one round of station activity, returns the number of events sent */
+static int sta_step(struct sta_data *sta)
+{
+	struct bss *best = NULL;
+	int best_sig = 0;
+	int sent = 0;
+	int i;
+
+	sta_move(sta);
+
+	if (sta->assoc && sta->bss_signal[sta->assoc->idx] == NO_SIGNAL) {
+		stats.lost++;
+		sta_disconnect(sta);
+	}
+
+	for (i = 0; i < n_bss; i++) {
+		struct bss *bss = bss_list[i];
+		int sig = sta->bss_signal[i];
+
+		if (sig == NO_SIGNAL)
+			continue;
+
+		sent++;
+
+		/* a denied probe request gets no response */
+		if (sta_send_event(sta, bss, FE_PROBE, sig))
+			continue;
+
+		if (bss == sta->avoid)
+			continue;
+
+		if (!best || sig > best_sig) {
+			best = bss;
+			best_sig = sig;
+		}
+	}
+
+	if (!sta->assoc && best)
+		sent += sta_connect(sta, best, best_sig);
+
+	return sent;
 }
 
 static void sta_schedule_probe(struct sta_data *sta)
 {
 	gen_val(&sta->probe);
-	gen_val(&sta->signal);
 	usteer_timeout_set(&tq, &sta->probe_t, sta->probe.cur);
 }
 
@@ -96,31 +365,202 @@ static void sta_probe(struct usteer_timeout_queue *q, struct usteer_timeout *t)
 {
 	struct sta_data *sta = container_of(t, struct sta_data, probe_t);
 
-	sta_send_probe(sta);
+	sta_step(sta);
 	sta_schedule_probe(sta);
 }
 
-static void init_station(struct sta_data *sta)
+/* make a station that was dropped by the AP look for a new BSS soon */
+static void sta_reconnect(struct sta_data *sta)
 {
-	list_add_tail(&sta->list, &stations);
-	if (fread(&sta->addr, sizeof(sta->addr), 1, r_fd) != sizeof(sta->addr))
-		fprintf(stderr, "short read\n");
-	sta->addr[0] &= ~1;
+	sta_disconnect(sta);
+	if (!pace.rate)
+		usteer_timeout_set(&tq, &sta->probe_t, RECONNECT_DELAY);
+}
 
-	sta_schedule_probe(sta);
+static void sta_send_beacon_reports(struct sta_data *sta, struct bss *bss)
+{
+	int i;
+
+	for (i = 0; i < n_bss; i++) {
+		int sig = sta->bss_signal[i];
+
+		if (sig == NO_SIGNAL)
+			continue;
+
+		blob_buf_init(&b, 0);
+		blobmsg_add_macaddr(&b, "address", sta->addr);
+		blobmsg_add_macaddr(&b, "bssid", bss_list[i]->bssid);
+		blobmsg_add_u16(&b, "op-class", freq_to_op_class(bss_list[i]->freq));
+		blobmsg_add_u16(&b, "channel", freq_to_channel(bss_list[i]->freq));
+		blobmsg_add_u16(&b, "rcpi", signal_to_rcpi(sig));
+		blobmsg_add_u16(&b, "rsni", 0);
+		bss_notify(bss, FE_BEACON_REPORT);
+	}
 }
 
-static void create_stations(struct sta_data *ref, int n)
+/* the station accepts and leaves for the best other BSS */
+static void sta_transition(struct sta_data *sta, struct bss *bss)
+{
+	if (sta->btm_response) {
+		blob_buf_init(&b, 0);
+		blobmsg_add_macaddr(&b, "address", sta->addr);
+		blobmsg_add_u8(&b, "dialog-token", 1);
+		blobmsg_add_u8(&b, "status-code", 0);
+		bss_notify(bss, FE_BSS_TM_RESPONSE);
+	}
+
+	sta->avoid = bss;
+	sta_reconnect(sta);
+}
+
+static void deferred_cb(struct uloop_timeout *t)
+{
+	struct sta_data *sta;
+	struct bss *bss;
+
+	while (!list_empty(&deferred)) {
+		sta = list_first_entry(&deferred, struct sta_data, deferred_list);
+		list_del_init(&sta->deferred_list);
+
+		if (sta->report) {
+			bss = sta->report;
+			sta->report = NULL;
+			sta_send_beacon_reports(sta, bss);
+		}
+
+		if (sta->transition) {
+			bss = sta->transition;
+			sta->transition = NULL;
+			sta_transition(sta, bss);
+		}
+	}
+}
+
+static void sta_defer(struct sta_data *sta)
+{
+	if (list_empty(&sta->deferred_list))
+		list_add_tail(&sta->deferred_list, &deferred);
+
+	deferred_timeout.cb = deferred_cb;
+	uloop_timeout_set(&deferred_timeout, 0);
+}
+
+static void pace_cb(struct uloop_timeout *t)
+{
+	uint64_t now = time_us();
+	int64_t max_credit = (int64_t) pace.rate * 1000000;
+
+	pace.credit += (now - pace.last) * pace.rate;
+	if (pace.credit > max_credit)
+		pace.credit = max_credit;
+	pace.last = now;
+
+	while (pace.credit >= 1000000 && !list_empty(&stations)) {
+		struct sta_data *sta;
+		int sent;
+
+		if (!pace.cur || pace.cur->next == &stations)
+			pace.cur = stations.next;
+		else
+			pace.cur = pace.cur->next;
+
+		sta = container_of(pace.cur, struct sta_data, list);
+		sent = sta_step(sta);
+		pace.credit -= (int64_t) (sent ? sent : 1) * 1000000;
+
+		/* don't starve the ubus method handlers */
+		if (time_us() - now > PACE_INTERVAL * 1000)
+			break;
+	}
+
+	uloop_timeout_set(t, PACE_INTERVAL);
+}
+
+static void stats_cb(struct uloop_timeout *t)
+{
+	uint64_t now = time_us();
+	double elapsed = (now - stats_last) / 1000000.0;
+	uint32_t total = 0;
+	int clients = 0;
+	int i;
+
+	for (i = 0; i < __FE_MAX; i++)
+		total += stats.events[i];
+	total += stats.replayed;
+
+	for (i = 0; i < n_bss; i++) {
+		struct list_head *l;
+
+		list_for_each(l, &bss_list[i]->clients)
+			clients++;
+	}
+
+	fprintf(stderr, "events: %.0f/s", total / elapsed);
+	if (pace.rate)
+		fprintf(stderr, " (target %u/s)", pace.rate);
+	for (i = 0; i < __FE_MAX; i++) {
+		if (!stats.events[i])
+			continue;
+
+		fprintf(stderr, ", %s %u", fake_event_names[i], stats.events[i]);
+		if (stats.denied[i])
+			fprintf(stderr, " (%u denied)", stats.denied[i]);
+	}
+	if (stats.replayed)
+		fprintf(stderr, ", replayed %u (%u denied)", stats.replayed,
+			stats.replay_denied);
+	fprintf(stderr, ", kicks %u, transitions %u, beacon requests %u, lost %u",
+		stats.kicks, stats.transitions, stats.beacon_requests, stats.lost);
+	fprintf(stderr, ", clients %d, notify avg %llu us\n", clients,
+		total ? (unsigned long long) (stats.notify_time / total) : 0);
+
+	memset(&stats, 0, sizeof(stats));
+	stats_last = now;
+	uloop_timeout_set(t, stats_interval * 1000);
+}
+
+static struct sta_data *sta_find(struct blob_attr *attr)
 {
 	struct sta_data *sta;
+	uint8_t *addr;
+
+	if (!attr)
+		return NULL;
+
+	addr = (uint8_t *) ether_aton(blobmsg_get_string(attr));
+	if (!addr)
+		return NULL;
+
+	return avl_find_element(&sta_tree, addr, sta, avl);
+}
+
+static void init_station(struct sta_data *sta)
+{
 	int i;
 
-	tq.cb = sta_probe;
-	sta = calloc(n, sizeof(*sta));
-	for (i = 0; i < n; i++) {
-		memcpy(sta, ref, sizeof(*sta));
-		init_station(sta);
-		sta++;
+	list_add_tail(&sta->list, &stations);
+	INIT_LIST_HEAD(&sta->assoc_list);
+	INIT_LIST_HEAD(&sta->deferred_list);
+	sta->transition = NULL;
+	sta->report = NULL;
+
+	do {
+		rand_bytes(&rand_state, sta->addr, sizeof(sta->addr));
+		sta->addr[0] &= ~1;
+		sta->avl.key = sta->addr;
+	} while (avl_insert(&sta_tree, &sta->avl) != 0);
+
+	switch (sta->mobility) {
+	case MOBILITY_LINE:
+		sta->pos = rand_range(&rand_state, 0, (n_bss - 1) * 1000);
+		sta->dir = rand_u32(&rand_state) & 1 ? 1 : -1;
+		break;
+	default:
+		for (i = 0; i < MAX_BSS; i++) {
+			gen_val(&sta->signal);
+			sta->bss_signal[i] = sta->signal.cur;
+		}
+		break;
 	}
 }
 
@@ -128,11 +568,23 @@ static int usage(const char *prog)
 {
 	fprintf(stderr, "Usage: %s <options>\n"
 		"Options:\n"
-		"	-p <msec>[-<msec>]:             probing interval (fixed or min-max)\n"
-		"	-s <rssi>[-<rssi>]:             rssi (signal strength) (fixed or min-max)\n"
+		"	-p <msec>[:<msec>]:             probing interval (fixed or min:max)\n"
+		"	-s <dBm>[:<dBm>]:               signal strength (fixed or min:max)\n"
+		"	-m <model>[:<arg>]:             mobility model:\n"
+		"	                                static: fixed signal per BSS\n"
+		"	                                walk[:<dB>]: random walk per probe\n"
+		"	                                line[:<msec>]: move along the BSSes,\n"
+		"	                                <msec> per BSS distance\n"
 		"	-n <n>:                         create <n> stations\n"
+		"	                                uses parameters set before this option\n"
 		"	-f <freq>:			set operating frequency\n"
+		"	-b <n>:				create <n> BSSes\n"
 		"	                                uses parameters set before this option\n"
+		"	-S <seed>:			random seed, set before -b and -n\n"
+		"	-r <events/s>:			target event rate, replaces probing interval\n"
+		"	-i <sec>:			statistics interval (0: disabled)\n"
+		"	-R <file>:			replay an event trace recorded by usteerd\n"
+		"	-x <factor>:			replay speed (default: 1, 0: as fast as possible)\n"
 		"	-v:				verbose\n"
 		"\n", prog);
 	return 1;
@@ -142,7 +594,7 @@ static bool parse_var(struct var *var, const char *str)
 {
 	char *err;
 
-	var->min = strtoul(str, &err, 0);
+	var->min = strtol(str, &err, 0);
 	var->max = var->min;
 	if (!*err)
 		return true;
@@ -150,56 +602,508 @@ static bool parse_var(struct var *var, const char *str)
 	if (*err != ':')
 		return false;
 
-	var->max = strtoul(err + 1, &err, 0);
+	var->max = strtol(err + 1, &err, 0);
 	if (!*err)
 		return true;
 
 	return false;
 }
 
+static bool parse_mobility(struct sta_data *sta, const char *str)
+{
+	const char *arg = strchr(str, ':');
+	int len = arg ? arg - str : strlen(str);
+
+	if (!strncmp(str, "static", len)) {
+		sta->mobility = MOBILITY_STATIC;
+		sta->mobility_arg = 0;
+	} else if (!strncmp(str, "walk", len)) {
+		sta->mobility = MOBILITY_WALK;
+		sta->mobility_arg = 3;
+	} else if (!strncmp(str, "line", len)) {
+		sta->mobility = MOBILITY_LINE;
+		sta->mobility_arg = 60 * 1000;
+	} else {
+		return false;
+	}
+
+	if (arg)
+		sta->mobility_arg = atoi(arg + 1);
+
+	return sta->mobility_arg >= 0 &&
+	       (sta->mobility != MOBILITY_LINE || sta->mobility_arg > 0);
+}
+
 static int
 hostapd_bss_get_clients(struct ubus_context *ctx, struct ubus_object *obj,
 			struct ubus_request_data *req, const char *method,
 			struct blob_attr *msg)
 {
+	struct bss *bss = container_of(obj, struct bss, obj);
+	struct sta_data *sta;
+	char addr[20];
+	void *c, *s, *r;
+	int i;
+
 	blob_buf_init(&b, 0);
+	blobmsg_add_u32(&b, "freq", bss->freq);
+	c = blobmsg_open_table(&b, "clients");
+	list_for_each_entry(sta, &bss->clients, assoc_list) {
+		sprintf(addr, MAC_ADDR_FMT, MAC_ADDR_DATA(sta->addr));
+		s = blobmsg_open_table(&b, addr);
+		blobmsg_add_u8(&b, "auth", 1);
+		blobmsg_add_u8(&b, "assoc", 1);
+		blobmsg_add_u8(&b, "authorized", 1);
+		blobmsg_add_u32(&b, "signal", sta->bss_signal[bss->idx]);
+
+		/* passive and active beacon measurement */
+		r = blobmsg_open_array(&b, "rrm");
+		blobmsg_add_u32(&b, NULL, (1 << 4) | (1 << 5));
+		for (i = 1; i < 5; i++)
+			blobmsg_add_u32(&b, NULL, 0);
+		blobmsg_close_array(&b, r);
+
+		blobmsg_close_table(&b, s);
+	}
+	blobmsg_close_table(&b, c);
 	ubus_send_reply(ctx, req, b.head);
 	return 0;
 }
 
+static int
+hostapd_bss_get_status(struct ubus_context *ctx, struct ubus_object *obj,
+		       struct ubus_request_data *req, const char *method,
+		       struct blob_attr *msg)
+{
+	struct bss *bss = container_of(obj, struct bss, obj);
+
+	blob_buf_init(&b, 0);
+	blobmsg_add_string(&b, "status", "ENABLED");
+	blobmsg_add_macaddr(&b, "bssid", bss->bssid);
+	blobmsg_add_string(&b, "ssid", "fakeap");
+	blobmsg_add_u32(&b, "freq", bss->freq);
+	blobmsg_add_u32(&b, "channel", freq_to_channel(bss->freq));
+	blobmsg_add_u32(&b, "op_class", freq_to_op_class(bss->freq));
+	ubus_send_reply(ctx, req, b.head);
+	return 0;
+}
+
+static int
+hostapd_bss_rrm_nr_get_own(struct ubus_context *ctx, struct ubus_object *obj,
+			   struct ubus_request_data *req, const char *method,
+			   struct blob_attr *msg)
+{
+	struct bss *bss = container_of(obj, struct bss, obj);
+	char *s;
+	void *c;
+
+	blob_buf_init(&b, 0);
+	c = blobmsg_open_array(&b, "value");
+	blobmsg_add_macaddr(&b, NULL, bss->bssid);
+	blobmsg_add_string(&b, NULL, "fakeap");
+	s = blobmsg_alloc_string_buffer(&b, NULL, 32);
+	sprintf(s, "%02x%02x%02x%02x%02x%02x" "af110000" "%02x%02x" "07",
+		MAC_ADDR_DATA(bss->bssid), freq_to_op_class(bss->freq),
+		freq_to_channel(bss->freq));
+	blobmsg_add_string_buffer(&b);
+	blobmsg_close_array(&b, c);
+	ubus_send_reply(ctx, req, b.head);
+	return 0;
+}
+
+static int
+hostapd_bss_rrm_nr_set(struct ubus_context *ctx, struct ubus_object *obj,
+		       struct ubus_request_data *req, const char *method,
+		       struct blob_attr *msg)
+{
+	static const struct blobmsg_policy policy = { "list", BLOBMSG_TYPE_ARRAY };
+	struct bss *bss = container_of(obj, struct bss, obj);
+	struct blob_attr *tb;
+
+	blobmsg_parse(&policy, 1, &tb, blob_data(msg), blob_len(msg));
+	if (!tb)
+		return UBUS_STATUS_INVALID_ARGUMENT;
+
+	free(bss->nr_list);
+	bss->nr_list = blob_memdup(tb);
+	return 0;
+}
+
+static int
+hostapd_bss_rrm_nr_list(struct ubus_context *ctx, struct ubus_object *obj,
+			struct ubus_request_data *req, const char *method,
+			struct blob_attr *msg)
+{
+	struct bss *bss = container_of(obj, struct bss, obj);
+	void *c;
+
+	blob_buf_init(&b, 0);
+	if (bss->nr_list) {
+		blobmsg_add_blob(&b, bss->nr_list);
+	} else {
+		c = blobmsg_open_array(&b, "list");
+		blobmsg_close_array(&b, c);
+	}
+	ubus_send_reply(ctx, req, b.head);
+	return 0;
+}
+
+enum {
+	CLIENT_ADDR,
+	__CLIENT_MAX
+};
+
+static const struct blobmsg_policy client_policy[__CLIENT_MAX] = {
+	[CLIENT_ADDR] = { "addr", BLOBMSG_TYPE_STRING },
+};
+
+static struct sta_data *
+hostapd_bss_get_sta(struct bss *bss, struct blob_attr *msg)
+{
+	struct blob_attr *tb[__CLIENT_MAX];
+	struct sta_data *sta;
+
+	blobmsg_parse(client_policy, __CLIENT_MAX, tb, blob_data(msg), blob_len(msg));
+	sta = sta_find(tb[CLIENT_ADDR]);
+	if (!sta || sta->assoc != bss)
+		return NULL;
+
+	return sta;
+}
+
+static int
+hostapd_bss_del_client(struct ubus_context *ctx, struct ubus_object *obj,
+		       struct ubus_request_data *req, const char *method,
+		       struct blob_attr *msg)
+{
+	struct bss *bss = container_of(obj, struct bss, obj);
+	struct sta_data *sta = hostapd_bss_get_sta(bss, msg);
+
+	if (!sta)
+		return UBUS_STATUS_NOT_FOUND;
+
+	stats.kicks++;
+	sta_reconnect(sta);
+	return 0;
+}
+
+static int
+hostapd_bss_transition(struct ubus_context *ctx, struct ubus_object *obj,
+		       struct ubus_request_data *req, const char *method,
+		       struct blob_attr *msg)
+{
+	struct bss *bss = container_of(obj, struct bss, obj);
+	struct sta_data *sta = hostapd_bss_get_sta(bss, msg);
+
+	if (!sta)
+		return UBUS_STATUS_NOT_FOUND;
+
+	stats.transitions++;
+	sta->transition = bss;
+	sta->btm_response = !strcmp(method, "bss_transition_request");
+	sta_defer(sta);
+	return 0;
+}
+
+static int
+hostapd_bss_rrm_beacon_req(struct ubus_context *ctx, struct ubus_object *obj,
+			   struct ubus_request_data *req, const char *method,
+			   struct blob_attr *msg)
+{
+	struct bss *bss = container_of(obj, struct bss, obj);
+	struct sta_data *sta = hostapd_bss_get_sta(bss, msg);
+
+	if (!sta)
+		return UBUS_STATUS_NOT_FOUND;
+
+	stats.beacon_requests++;
+	sta->report = bss;
+	sta_defer(sta);
+
+	return 0;
+}
+
+static int
+hostapd_bss_noop(struct ubus_context *ctx, struct ubus_object *obj,
+		 struct ubus_request_data *req, const char *method,
+		 struct blob_attr *msg)
+{
+	return 0;
+}
+
 static const struct ubus_method bss_methods[] = {
 	UBUS_METHOD_NOARG("get_clients", hostapd_bss_get_clients),
+	UBUS_METHOD_NOARG("get_status", hostapd_bss_get_status),
+	UBUS_METHOD_NOARG("rrm_nr_get_own", hostapd_bss_rrm_nr_get_own),
+	UBUS_METHOD_NOARG("rrm_nr_set", hostapd_bss_rrm_nr_set),
+	UBUS_METHOD_NOARG("rrm_nr_list", hostapd_bss_rrm_nr_list),
+	UBUS_METHOD_NOARG("del_client", hostapd_bss_del_client),
+	UBUS_METHOD_NOARG("wnm_disassoc_imminent", hostapd_bss_transition),
+	UBUS_METHOD_NOARG("bss_transition_request", hostapd_bss_transition),
+	UBUS_METHOD_NOARG("rrm_beacon_req", hostapd_bss_rrm_beacon_req),
+	UBUS_METHOD_NOARG("notify_response", hostapd_bss_noop),
+	UBUS_METHOD_NOARG("bss_mgmt_enable", hostapd_bss_noop),
 };
 
 static struct ubus_object_type bss_object_type =
 	UBUS_OBJECT_TYPE("hostapd_bss", bss_methods);
 
-static struct ubus_object bss_obj = {
-	.name = "hostapd.wlan0",
-	.type = &bss_object_type,
-	.methods = bss_methods,
-	.n_methods = ARRAY_SIZE(bss_methods),
-};
+static struct bss *bss_add(const char *name)
+{
+	struct bss *bss;
+
+	if (n_bss == MAX_BSS)
+		return NULL;
+
+	bss = calloc(1, sizeof(*bss));
+	bss->idx = n_bss;
+	bss->freq = freq;
+	INIT_LIST_HEAD(&bss->clients);
+	rand_bytes(&rand_state, bss->bssid, sizeof(bss->bssid));
+	bss->bssid[0] = 0x02;
+	snprintf(bss->name, sizeof(bss->name), "%s", name);
+
+	bss->obj.name = bss->name;
+	bss->obj.type = &bss_object_type;
+	bss->obj.methods = bss_methods;
+	bss->obj.n_methods = ARRAY_SIZE(bss_methods);
+
+	bss_list[n_bss++] = bss;
+
+	return bss;
+}
+
+static void create_bss(int n)
+{
+	char name[32];
+	int i;
+
+	for (i = 0; i < n && n_bss < MAX_BSS; i++) {
+		snprintf(name, sizeof(name), "hostapd.wlan%d", n_bss);
+		bss_add(name);
+	}
+}
+
+static struct {
+	char *buf;
+	size_t len;
+	size_t pos;
+	double speed;
+	bool started;
+	uint32_t base;
+	uint64_t start;
+	uint32_t events;
+	uint32_t denied;
+	struct bss *nodes[USTEER_TRACE_MAX_ID];
+	char *methods[USTEER_TRACE_MAX_ID];
+	struct uloop_timeout timeout;
+} replay;
+
+static uint32_t replay_msg[UINT16_MAX / 4 + 1];
+
+static void replay_done(void)
+{
+	double elapsed = (time_us() - replay.start) / 1000000.0;
+
+	fprintf(stderr, "Replayed %u events (%u denied) in %.3f s, %.0f events/s\n",
+		replay.events, replay.denied, elapsed,
+		elapsed > 0 ? replay.events / elapsed : 0);
+	uloop_end();
+}
+
+static void replay_cb(struct uloop_timeout *t)
+{
+	uint64_t now = time_us();
+
+	while (replay.pos < replay.len) {
+		struct usteer_trace_rec *rec = (void *) (replay.buf + replay.pos);
+		uint32_t time = be32_to_cpu(rec->time);
+		size_t len = be16_to_cpu(rec->len);
+		struct bss *bss;
+		const char *method;
+		int ret;
+
+		if (rec->type != USTEER_TRACE_EVENT) {
+			replay.pos += sizeof(*rec) + len;
+			continue;
+		}
+
+		if (!replay.started) {
+			replay.started = true;
+			replay.base = time;
+			replay.start = now;
+		}
+
+		if (replay.speed > 0) {
+			uint64_t due = replay.start +
+				       (uint64_t) (time - replay.base) * 1000 / replay.speed;
+
+			if (due > now) {
+				uloop_timeout_set(t, (due - now + 999) / 1000);
+				return;
+			}
+		}
+
+		/* don't starve the ubus method handlers */
+		if (time_us() - now > PACE_INTERVAL * 1000) {
+			uloop_timeout_set(t, 1);
+			return;
+		}
+
+		replay.pos += sizeof(*rec) + len;
+		bss = replay.nodes[rec->id];
+		method = replay.methods[rec->method];
+		if (!bss || !method)
+			continue;
+
+		/* the message is not aligned within the trace */
+		memcpy(replay_msg, rec + 1, len);
+		ret = __bss_notify(bss, method, (struct blob_attr *) replay_msg);
+		replay.events++;
+		stats.replayed++;
+		if (ret) {
+			replay.denied++;
+			stats.replay_denied++;
+		}
+
+		if (verbose)
+			fprintf(stderr, "%s %s: %d\n", bss->name, method, ret);
+	}
+
+	replay_done();
+}
+
+static void replay_wait_cb(struct uloop_timeout *t)
+{
+	int i;
+
+	for (i = 0; i < n_bss; i++) {
+		if (bss_list[i]->obj.has_subscribers)
+			continue;
+
+		uloop_timeout_set(t, 100);
+		return;
+	}
+
+	fprintf(stderr, "Starting replay\n");
+	t->cb = replay_cb;
+	uloop_timeout_set(t, 1);
+}
+
+static bool replay_load(const char *file)
+{
+	struct usteer_trace_header *hdr;
+	char name[64];
+	FILE *f;
+	long len;
+
+	f = fopen(file, "r");
+	if (!f) {
+		perror(file);
+		return false;
+	}
+
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (len < (long) sizeof(*hdr)) {
+		fclose(f);
+		goto invalid;
+	}
+
+	replay.buf = malloc(len);
+	replay.len = fread(replay.buf, 1, len, f);
+	fclose(f);
+
+	hdr = (struct usteer_trace_header *) replay.buf;
+	if (replay.len != len ||
+	    be32_to_cpu(hdr->magic) != USTEER_TRACE_MAGIC ||
+	    be16_to_cpu(hdr->version) != USTEER_TRACE_VERSION)
+		goto invalid;
+
+	/* register all traced nodes before the replay starts */
+	replay.pos = sizeof(*hdr);
+	while (replay.pos < replay.len) {
+		struct usteer_trace_rec *rec = (void *) (replay.buf + replay.pos);
+		size_t rec_len;
+
+		if (replay.len - replay.pos < sizeof(*rec))
+			goto invalid;
+
+		rec_len = be16_to_cpu(rec->len);
+		if (replay.len - replay.pos - sizeof(*rec) < rec_len)
+			goto invalid;
+
+		if (rec->type == USTEER_TRACE_NODE ||
+		    rec->type == USTEER_TRACE_METHOD) {
+			if (rec_len >= sizeof(name))
+				goto invalid;
+
+			memcpy(name, rec + 1, rec_len);
+			name[rec_len] = 0;
+		}
+
+		switch (rec->type) {
+		case USTEER_TRACE_NODE:
+			replay.nodes[rec->id] = bss_add(name);
+			break;
+		case USTEER_TRACE_METHOD:
+			replay.methods[rec->id] = strdup(name);
+			break;
+		case USTEER_TRACE_EVENT:
+			if (rec_len < sizeof(struct blob_attr) ||
+			    blob_raw_len((struct blob_attr *) (rec + 1)) != rec_len)
+				goto invalid;
+			break;
+		}
+
+		replay.pos += sizeof(*rec) + rec_len;
+	}
+
+	replay.pos = sizeof(*hdr);
+	replay.timeout.cb = replay_wait_cb;
+
+	return true;
+
+invalid:
+	fprintf(stderr, "%s: invalid trace file\n", file);
+	return false;
+}
+
+static void create_stations(struct sta_data *ref, int n)
+{
+	struct sta_data *sta;
+	int i;
+
+	if (!n_bss)
+		create_bss(1);
+
+	tq.cb = sta_probe;
+	sta = calloc(n, sizeof(*sta));
+	for (i = 0; i < n; i++) {
+		memcpy(sta, ref, sizeof(*sta));
+		init_station(sta);
+		sta++;
+	}
+}
 
 int main(int argc, char **argv)
 {
 	struct sta_data sdata = {
-		.signal = { 0, -30, -30 },
+		.signal = { 0, -80, -40 },
 		.probe = { 0, 1000, 30000 },
+		.mobility = MOBILITY_STATIC,
 	};
-	int ch;
+	struct sta_data *sta;
+	const char *trace_file = NULL;
+	int ch, i;
 
+	replay.speed = 1;
 	uloop_init();
 
-	r_fd = fopen("/dev/urandom", "r");
-	if (!r_fd) {
-		perror("fopen");
-		return 1;
-	}
-
 	usteer_timeout_init(&tq);
 
-	while ((ch = getopt(argc, argv, "p:s:f:n:v")) != -1) {
+	while ((ch = getopt(argc, argv, "b:f:i:m:n:p:r:R:s:S:vx:")) != -1) {
 		switch(ch) {
 		case 'p':
 			if (!parse_var(&sdata.probe, optarg))
@@ -209,12 +1113,34 @@ int main(int argc, char **argv)
 			if (!parse_var(&sdata.signal, optarg))
 				goto usage;
 			break;
+		case 'm':
+			if (!parse_mobility(&sdata, optarg))
+				goto usage;
+			break;
 		case 'f':
 			freq = atoi(optarg);
 			break;
+		case 'b':
+			create_bss(atoi(optarg));
+			break;
 		case 'n':
 			create_stations(&sdata, atoi(optarg));
 			break;
+		case 'S':
+			rand_state = strtoull(optarg, NULL, 0) ?: 1;
+			break;
+		case 'r':
+			pace.rate = atoi(optarg);
+			break;
+		case 'i':
+			stats_interval = atoi(optarg);
+			break;
+		case 'R':
+			trace_file = optarg;
+			break;
+		case 'x':
+			replay.speed = atof(optarg);
+			break;
 		case 'v':
 			verbose++;
 			break;
@@ -223,6 +1149,13 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (trace_file) {
+		if (!replay_load(trace_file))
+			return 1;
+	} else if (!n_bss) {
+		create_bss(1);
+	}
+
 	ubus_ctx = ubus_connect(NULL);
 	if (!ubus_ctx) {
 		fprintf(stderr, "Failed to connect to ubus\n");
@@ -231,10 +1164,34 @@ int main(int argc, char **argv)
 
 	ubus_add_uloop(ubus_ctx);
 
-	if (ubus_add_object(ubus_ctx, &bss_obj)) {
-		fprintf(stderr, "Failed to register AP ubus object\n");
-		return 1;
+	for (i = 0; i < n_bss; i++) {
+		if (ubus_add_object(ubus_ctx, &bss_list[i]->obj)) {
+			fprintf(stderr, "Failed to register AP ubus object %s\n",
+				bss_list[i]->name);
+			return 1;
+		}
+	}
+
+	if (pace.rate) {
+		pace.last = time_us();
+		pace.timeout.cb = pace_cb;
+		uloop_timeout_set(&pace.timeout, PACE_INTERVAL);
+	} else {
+		list_for_each_entry(sta, &stations, list)
+			sta_schedule_probe(sta);
 	}
+
+	if (trace_file) {
+		fprintf(stderr, "Waiting for usteer to subscribe to %d BSSes\n", n_bss);
+		uloop_timeout_set(&replay.timeout, 1);
+	}
+
+	if (stats_interval > 0) {
+		stats_last = time_us();
+		stats_timeout.cb = stats_cb;
+		uloop_timeout_set(&stats_timeout, stats_interval * 1000);
+	}
+
 	uloop_run();
 
 	uloop_done();
@@ -0,0 +1,287 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "usteer.h"
+#include "ingest.h"
+
+/*
+ * Single producer, single consumer ring between the ingest thread and the
+ * main loop. Records are variable sized and contiguous. The producer
+ * always reserves room for a full datagram and receives straight into
+ * the ring. When the end of the buffer is too small, a wrap marker sends
+ * both sides back to the start.
+ */
+#define INGEST_RING_SIZE	(512 * 1024)
+#define INGEST_RECORD_MAX	(sizeof(struct usteer_ingest_msg) + APMGR_BUFLEN)
+#define INGEST_ALIGN(len)	(((len) + 7) & ~7)
+#define INGEST_WRAP		((uint32_t) -1)
+
+/* Records handled per main loop iteration, to keep hostapd events responsive */
+#define INGEST_BATCH		32
+
+static struct {
+	const struct usteer_ingest_ops *ops;
+	pthread_t thread;
+	bool running;
+	int sock_fd;
+	int stop_fd;
+
+	struct uloop_fd notify_fd;
+	struct uloop_timeout drain_timer;
+
+	char *ring;
+	char *scratch;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t dropped;
+} ingest;
+
+static struct usteer_ingest_msg *
+ingest_reserve(uint32_t *skip)
+{
+	uint32_t head = ingest.head;
+	uint32_t tail = __atomic_load_n(&ingest.tail, __ATOMIC_ACQUIRE);
+	uint32_t avail = INGEST_RING_SIZE - (head - tail);
+	uint32_t pos = head & (INGEST_RING_SIZE - 1);
+	uint32_t to_end = INGEST_RING_SIZE - pos;
+	struct usteer_ingest_msg *msg;
+
+	*skip = 0;
+	if (to_end >= INGEST_RECORD_MAX) {
+		if (avail < INGEST_RECORD_MAX)
+			return NULL;
+
+		return (void *) (ingest.ring + pos);
+	}
+
+	if (avail < to_end + INGEST_RECORD_MAX)
+		return NULL;
+
+	if (to_end >= sizeof(*msg)) {
+		msg = (void *) (ingest.ring + pos);
+		msg->len = INGEST_WRAP;
+	}
+
+	*skip = to_end;
+
+	return (void *) ingest.ring;
+}
+
+static void
+ingest_commit(struct usteer_ingest_msg *msg, uint32_t skip)
+{
+	uint32_t head = ingest.head + skip;
+	uint64_t val = 1;
+
+	head += INGEST_ALIGN(sizeof(*msg) + msg->len);
+	__atomic_store_n(&ingest.head, head, __ATOMIC_RELEASE);
+
+	/* Fails only if the counter is saturated, the main loop is awake then */
+	if (write(ingest.notify_fd.fd, &val, sizeof(val)) < 0)
+		return;
+}
+
+static int
+ingest_recv(void)
+{
+	struct usteer_ingest_msg *msg;
+	uint32_t skip;
+	int len;
+
+	while (1) {
+		msg = ingest_reserve(&skip);
+		if (!msg)
+			msg = (void *) ingest.scratch;
+
+		len = ingest.ops->recv(ingest.sock_fd, msg, APMGR_BUFLEN);
+		if (len < 0) {
+			switch (errno) {
+			case EAGAIN:
+				return 0;
+			case EINTR:
+				continue;
+			default:
+				return -1;
+			}
+		}
+
+		if (!len)
+			continue;
+
+		if (msg == (void *) ingest.scratch) {
+			__atomic_add_fetch(&ingest.dropped, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		msg->len = len;
+		ingest_commit(msg, skip);
+	}
+}
+
+static void *
+ingest_thread(void *arg)
+{
+	struct pollfd pfd[] = {
+		{ .fd = ingest.sock_fd, .events = POLLIN },
+		{ .fd = ingest.stop_fd, .events = POLLIN },
+	};
+
+	while (1) {
+		if (poll(pfd, ARRAY_SIZE(pfd), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (pfd[1].revents)
+			break;
+
+		if (ingest_recv() < 0)
+			break;
+	}
+
+	return NULL;
+}
+
+static void
+ingest_drain(int limit)
+{
+	uint32_t head = __atomic_load_n(&ingest.head, __ATOMIC_ACQUIRE);
+	uint32_t tail = ingest.tail;
+	struct usteer_ingest_msg *msg;
+	uint32_t dropped;
+	uint32_t pos, to_end;
+	int n = 0;
+
+	while (tail != head && n < limit) {
+		pos = tail & (INGEST_RING_SIZE - 1);
+		to_end = INGEST_RING_SIZE - pos;
+		msg = (void *) (ingest.ring + pos);
+		if (to_end < sizeof(*msg) || msg->len == INGEST_WRAP) {
+			tail += to_end;
+			continue;
+		}
+
+		ingest.ops->handle(msg);
+		tail += INGEST_ALIGN(sizeof(*msg) + msg->len);
+		__atomic_store_n(&ingest.tail, tail, __ATOMIC_RELEASE);
+		n++;
+	}
+
+	__atomic_store_n(&ingest.tail, tail, __ATOMIC_RELEASE);
+
+	dropped = __atomic_exchange_n(&ingest.dropped, 0, __ATOMIC_RELAXED);
+	if (dropped)
+		MSG(INFO, "Ingest queue full, dropped %u remote messages\n", dropped);
+
+	if (tail != head)
+		uloop_timeout_set(&ingest.drain_timer, 0);
+}
+
+static void
+ingest_notify_cb(struct uloop_fd *u, unsigned int events)
+{
+	uint64_t val;
+
+	while (read(u->fd, &val, sizeof(val)) > 0);
+
+	ingest_drain(INGEST_BATCH);
+}
+
+static void
+ingest_drain_timer(struct uloop_timeout *t)
+{
+	ingest_drain(INGEST_BATCH);
+}
+
+bool usteer_ingest_running(void)
+{
+	return ingest.running;
+}
+
+int usteer_ingest_start(int fd, const struct usteer_ingest_ops *ops)
+{
+	if (ingest.running)
+		return -1;
+
+	ingest.ring = malloc(INGEST_RING_SIZE);
+	ingest.scratch = malloc(INGEST_RECORD_MAX);
+	ingest.notify_fd.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ingest.stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (!ingest.ring || !ingest.scratch ||
+	    ingest.notify_fd.fd < 0 || ingest.stop_fd < 0)
+		goto error;
+
+	ingest.ops = ops;
+	ingest.sock_fd = fd;
+	ingest.head = ingest.tail = 0;
+	ingest.dropped = 0;
+	ingest.drain_timer.cb = ingest_drain_timer;
+	ingest.notify_fd.cb = ingest_notify_cb;
+
+	if (pthread_create(&ingest.thread, NULL, ingest_thread, NULL))
+		goto error;
+
+	uloop_fd_add(&ingest.notify_fd, ULOOP_READ);
+	ingest.running = true;
+
+	return 0;
+
+error:
+	if (ingest.notify_fd.fd >= 0)
+		close(ingest.notify_fd.fd);
+	if (ingest.stop_fd >= 0)
+		close(ingest.stop_fd);
+	free(ingest.scratch);
+	free(ingest.ring);
+	ingest.ring = ingest.scratch = NULL;
+
+	return -1;
+}
+
+void usteer_ingest_stop(void)
+{
+	uint64_t val = 1;
+
+	if (!ingest.running)
+		return;
+
+	if (write(ingest.stop_fd, &val, sizeof(val)) < 0)
+		perror("write");
+	pthread_join(ingest.thread, NULL);
+	ingest.running = false;
+
+	/* Apply everything the thread queued before it was stopped */
+	ingest_drain(INT_MAX);
+
+	uloop_timeout_cancel(&ingest.drain_timer);
+	uloop_fd_delete(&ingest.notify_fd);
+	close(ingest.notify_fd.fd);
+	close(ingest.stop_fd);
+	free(ingest.scratch);
+	free(ingest.ring);
+	ingest.ring = ingest.scratch = NULL;
+}
@@ -0,0 +1,49 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+#ifndef __USTEER_INGEST_H
+#define __USTEER_INGEST_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct usteer_ingest_msg {
+	uint32_t len;
+	int ifindex;
+	char addr[INET6_ADDRSTRLEN];
+	char data[] __attribute__((aligned(4)));
+};
+
+struct usteer_ingest_ops {
+	/*
+	 * Called on the ingest thread to receive one datagram into msg.
+	 * Returns the payload length, 0 to drop it, or -1 with errno set.
+	 */
+	int (*recv)(int fd, struct usteer_ingest_msg *msg, int buf_len);
+
+	/* Called on the main loop for every queued message */
+	void (*handle)(struct usteer_ingest_msg *msg);
+};
+
+int usteer_ingest_start(int fd, const struct usteer_ingest_ops *ops);
+void usteer_ingest_stop(void);
+bool usteer_ingest_running(void);
+
+#endif
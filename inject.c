@@ -0,0 +1,635 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pcap/pcap.h>
+
+#include <libubox/usock.h>
+#include <libubus.h>
+
+#include "usteer.h"
+#include "remote.h"
+#include "capture.h"
+#include "rand.h"
+
+/*
+ * Feeds peer messages to a running usteerd, either synthesized for <n>
+ * virtual hosts with <m> stations each, or replayed from a capture. Every
+ * virtual host uses its own APMSG_ID, so the daemon tracks it as a separate
+ * remote host. The per-host update counters exported through the usteer
+ * remote_hosts ubus method tell how much of the offered load was ingested.
+ */
+
+#define PACE_INTERVAL		10
+
+struct inject_msg {
+	struct blob_attr *data;
+	uint32_t *id;
+	uint32_t *seq;
+	int nodes;
+	int stations;
+	int host;
+};
+
+static struct inject_msg *msgs;
+static int n_msgs;
+static int n_copies = 1;
+static int n_hosts;
+static uint32_t base_id;
+static int sock_fd = -1;
+
+static struct blob_buf b;
+static struct ubus_context *ctx;
+static uint32_t usteer_id;
+static uint64_t rand_state = 1;
+
+static struct {
+	uint32_t rate;
+	uint64_t last;
+	int64_t credit;
+	int msg;
+	int copy;
+	struct uloop_timeout timeout;
+} pace;
+
+static struct {
+	uint64_t msgs;
+	uint64_t nodes;
+	uint64_t stations;
+	uint64_t bytes;
+	uint64_t errors;
+} sent;
+
+static struct {
+	struct uloop_timeout timeout;
+	int interval;
+	uint64_t start;
+	uint64_t last;
+	uint64_t last_msgs;
+	uint64_t last_nodes;
+
+	/* node updates processed by the daemon, from remote_hosts */
+	uint64_t base;
+	uint64_t applied;
+	uint64_t last_applied;
+	int hosts_seen;
+	bool valid;
+
+	double max_rate;
+} stats;
+
+static struct uloop_timeout stop_timeout;
+static int duration = 10;
+
+static uint64_t time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct blob_attr *
+msg_find_attr(struct blob_attr *data, int id)
+{
+	struct blob_attr *cur;
+	int rem;
+
+	blob_for_each_attr(cur, data, rem)
+		if (blob_id(cur) == id && blob_len(cur) == sizeof(uint32_t))
+			return cur;
+
+	return NULL;
+}
+
+/* Validate a message with the daemon's own decoder and index it */
+static bool
+msg_add(struct blob_attr *data, int host)
+{
+	struct inject_msg *m;
+	struct apmsg msg;
+	struct apmsg_node node;
+	struct blob_attr *cur, *sta;
+	int rem, rem2;
+
+	if (!parse_apmsg(&msg, data))
+		return false;
+
+	msgs = realloc(msgs, (n_msgs + 1) * sizeof(*msgs));
+	m = &msgs[n_msgs++];
+	memset(m, 0, sizeof(*m));
+	m->data = blob_memdup(data);
+	m->id = blob_data(msg_find_attr(m->data, APMSG_ID));
+	m->seq = blob_data(msg_find_attr(m->data, APMSG_SEQ));
+	m->host = host;
+
+	blob_for_each_attr(cur, msg.nodes, rem) {
+		if (!parse_apmsg_node(&node, cur))
+			continue;
+
+		m->nodes++;
+		blob_for_each_attr(sta, node.stations, rem2)
+			m->stations++;
+	}
+
+	return true;
+}
+
+static void
+put_sta_addr(struct blob_buf *buf, int idx)
+{
+	uint8_t addr[6] = { 0x02, 0x1e };
+
+	addr[2] = idx >> 24;
+	addr[3] = idx >> 16;
+	addr[4] = idx >> 8;
+	addr[5] = idx;
+	blob_put(buf, APMSG_STA_ADDR, addr, sizeof(addr));
+}
+
+static bool
+synth_host(int host, int n_nodes, int n_sta, int pool)
+{
+	static const int freqs[] = { 2412, 5180, 5955 };
+	void *c, *n, *s, *st;
+	uint8_t bssid[6];
+	char name[16];
+	int i, k;
+
+	blob_buf_init(&b, 0);
+	blob_put_int32(&b, APMSG_ID, base_id + host);
+	blob_put_int32(&b, APMSG_SEQ, 0);
+
+	c = blob_nest_start(&b, APMSG_NODES);
+	for (i = 0; i < n_nodes; i++) {
+		n = blob_nest_start(&b, 0);
+		snprintf(name, sizeof(name), "wlan%d", i);
+		blob_put_string(&b, APMSG_NODE_NAME, name);
+		blob_put_string(&b, APMSG_NODE_SSID, "usteer-inject");
+		blob_put_int32(&b, APMSG_NODE_FREQ, freqs[i % ARRAY_SIZE(freqs)]);
+		blob_put_int32(&b, APMSG_NODE_NOISE, -95);
+		blob_put_int32(&b, APMSG_NODE_LOAD, rand_range(&rand_state, 0, 50));
+		blob_put_int32(&b, APMSG_NODE_N_ASSOC, (n_sta + n_nodes - 1 - i) / n_nodes);
+		blob_put_int32(&b, APMSG_NODE_MAX_ASSOC, 0);
+
+		bssid[0] = 0x02;
+		bssid[1] = 0xbe;
+		bssid[2] = host >> 16;
+		bssid[3] = host >> 8;
+		bssid[4] = host;
+		bssid[5] = i;
+		blob_put(&b, APMSG_NODE_BSSID, bssid, sizeof(bssid));
+
+		/* every station is seen by all nodes of the host */
+		s = blob_nest_start(&b, APMSG_NODE_STATIONS);
+		for (k = 0; k < n_sta; k++) {
+			st = blob_nest_start(&b, 0);
+			put_sta_addr(&b, ((uint64_t) host * n_sta + k) % pool);
+			blob_put_int8(&b, APMSG_STA_CONNECTED, k % n_nodes == i);
+			blob_put_int32(&b, APMSG_STA_SIGNAL, rand_range(&rand_state, -90, -40));
+			blob_put_int32(&b, APMSG_STA_SEEN, rand_range(&rand_state, 0, 1000));
+			blob_put_int32(&b, APMSG_STA_LAST_CONNECTED, 0);
+			blob_put_int32(&b, APMSG_STA_TIMEOUT, 120000);
+			blob_nest_end(&b, st);
+		}
+		blob_nest_end(&b, s);
+		blob_nest_end(&b, n);
+	}
+	blob_nest_end(&b, c);
+
+	if (blob_pad_len(b.head) > APMSG_MAX_DATAGRAM) {
+		fprintf(stderr, "Message for %d nodes with %d stations exceeds %d bytes\n",
+			n_nodes, n_sta, APMSG_MAX_DATAGRAM);
+		return false;
+	}
+
+	return msg_add(b.head, host);
+}
+
+static bool
+replay_load(const char *file)
+{
+	static char errbuf[PCAP_ERRBUF_SIZE];
+	static uint32_t buf[APMGR_BUFLEN / 4];
+	struct blob_attr *data = (void *) buf;
+	const unsigned char *packet;
+	struct pcap_pkthdr *hdr;
+	uint32_t *ids = NULL;
+	int link_type;
+	int skipped = 0;
+	struct apmsg msg;
+	pcap_t *pcap;
+	int len, i;
+
+	pcap = pcap_open_offline(file, errbuf);
+	if (!pcap) {
+		fprintf(stderr, "Failed to open file %s: %s\n", file, errbuf);
+		return false;
+	}
+
+	link_type = pcap_datalink(pcap);
+	if (!capture_link_supported(link_type)) {
+		fprintf(stderr, "Unsupported link type %d\n", link_type);
+		pcap_close(pcap);
+		return false;
+	}
+
+	while (pcap_next_ex(pcap, &hdr, &packet) == 1) {
+		struct in6_addr src;
+
+		len = hdr->caplen;
+		packet = capture_payload(link_type, packet, &len, &src);
+		if (!packet || len < sizeof(*data) || len > sizeof(buf))
+			continue;
+
+		memcpy(buf, packet, len);
+		if (blob_pad_len(data) != len || !parse_apmsg(&msg, data)) {
+			skipped++;
+			continue;
+		}
+
+		/* map the original sender ids to consecutive host indexes */
+		for (i = 0; i < n_hosts; i++)
+			if (ids[i] == msg.id)
+				break;
+
+		if (i == n_hosts) {
+			ids = realloc(ids, (n_hosts + 1) * sizeof(*ids));
+			ids[n_hosts++] = msg.id;
+		}
+
+		msg_add(data, i);
+	}
+
+	pcap_close(pcap);
+	free(ids);
+
+	if (!n_msgs) {
+		fprintf(stderr, "No usable peer messages in %s\n", file);
+		return false;
+	}
+
+	fprintf(stderr, "Loaded %d messages from %d hosts (%d invalid)\n",
+		n_msgs, n_hosts, skipped);
+
+	return true;
+}
+
+static void
+inject_send(struct inject_msg *m, int copy)
+{
+	uint32_t id = base_id + m->host * n_copies + copy;
+	int len = blob_pad_len(m->data);
+
+	*m->id = cpu_to_be32(id);
+	*m->seq = cpu_to_be32(be32_to_cpu(*m->seq) + 1);
+
+	if (send(sock_fd, m->data, len, 0) < 0) {
+		sent.errors++;
+		return;
+	}
+
+	sent.msgs++;
+	sent.bytes += len;
+	sent.nodes += m->nodes;
+	sent.stations += m->stations;
+}
+
+static void pace_cb(struct uloop_timeout *t)
+{
+	uint64_t now = time_us();
+	int64_t max_credit = (int64_t) pace.rate * 1000000;
+
+	pace.credit += (now - pace.last) * pace.rate;
+	if (pace.credit > max_credit)
+		pace.credit = max_credit;
+	pace.last = now;
+
+	while (pace.credit >= 1000000) {
+		inject_send(&msgs[pace.msg], pace.copy);
+		pace.credit -= 1000000;
+
+		/* each copy of a message goes out before moving to the next one */
+		if (++pace.copy < n_copies)
+			continue;
+
+		pace.copy = 0;
+		if (++pace.msg == n_msgs)
+			pace.msg = 0;
+
+		if (time_us() - now > PACE_INTERVAL * 1000)
+			break;
+	}
+
+	uloop_timeout_set(t, PACE_INTERVAL);
+}
+
+enum {
+	HOST_ID,
+	HOST_UPDATES,
+	__HOST_MAX
+};
+
+static const struct blobmsg_policy host_policy[__HOST_MAX] = {
+	[HOST_ID] = { "id", BLOBMSG_TYPE_INT32 },
+	[HOST_UPDATES] = { "updates", BLOBMSG_TYPE_TABLE },
+};
+
+enum {
+	UPDATES_APPLIED,
+	UPDATES_SKIPPED,
+	__UPDATES_MAX
+};
+
+static const struct blobmsg_policy updates_policy[__UPDATES_MAX] = {
+	[UPDATES_APPLIED] = { "applied", BLOBMSG_TYPE_INT32 },
+	[UPDATES_SKIPPED] = { "skipped", BLOBMSG_TYPE_INT32 },
+};
+
+static void
+remote_hosts_cb(struct ubus_request *req, int type, struct blob_attr *msg)
+{
+	struct blob_attr *tb[__HOST_MAX], *tb_u[__UPDATES_MAX];
+	struct blob_attr *cur;
+	uint64_t applied = 0;
+	int hosts = 0;
+	int rem;
+
+	blobmsg_for_each_attr(cur, msg, rem) {
+		uint32_t id;
+
+		blobmsg_parse(host_policy, __HOST_MAX, tb, blobmsg_data(cur),
+			      blobmsg_data_len(cur));
+		if (!tb[HOST_ID] || !tb[HOST_UPDATES])
+			continue;
+
+		id = blobmsg_get_u32(tb[HOST_ID]);
+		if (id - base_id >= n_hosts * n_copies)
+			continue;
+
+		blobmsg_parse(updates_policy, __UPDATES_MAX, tb_u,
+			      blobmsg_data(tb[HOST_UPDATES]),
+			      blobmsg_data_len(tb[HOST_UPDATES]));
+		if (tb_u[UPDATES_APPLIED])
+			applied += blobmsg_get_u32(tb_u[UPDATES_APPLIED]);
+		if (tb_u[UPDATES_SKIPPED])
+			applied += blobmsg_get_u32(tb_u[UPDATES_SKIPPED]);
+		hosts++;
+	}
+
+	stats.applied = applied;
+	stats.hosts_seen = hosts;
+	stats.valid = true;
+}
+
+static bool
+stats_query(void)
+{
+	stats.valid = false;
+	if (!ctx)
+		return false;
+
+	blob_buf_init(&b, 0);
+	ubus_invoke(ctx, usteer_id, "remote_hosts", b.head,
+		    remote_hosts_cb, NULL, 1000);
+
+	return stats.valid;
+}
+
+static void stats_print(void)
+{
+	uint64_t now = time_us();
+	double elapsed = (now - stats.last) / 1000000.0;
+	double sent_rate = (sent.msgs - stats.last_msgs) / elapsed;
+	double nodes_rate = (sent.nodes - stats.last_nodes) / elapsed;
+	double rate;
+
+	fprintf(stderr, "sent: %.0f msg/s (%.0f node updates/s, %llu errors)",
+		sent_rate, nodes_rate, (unsigned long long) sent.errors);
+
+	if (stats_query()) {
+		rate = (stats.applied - stats.last_applied) / elapsed;
+		if (rate > stats.max_rate)
+			stats.max_rate = rate;
+
+		fprintf(stderr, ", processed: %.0f node updates/s, hosts: %d/%d",
+			rate, stats.hosts_seen, n_hosts * n_copies);
+		stats.last_applied = stats.applied;
+	}
+	fprintf(stderr, "\n");
+
+	stats.last = now;
+	stats.last_msgs = sent.msgs;
+	stats.last_nodes = sent.nodes;
+}
+
+static void stats_cb(struct uloop_timeout *t)
+{
+	stats_print();
+	uloop_timeout_set(t, stats.interval * 1000);
+}
+
+static void stop_cb(struct uloop_timeout *t)
+{
+	/* stop sending and give the daemon a second to drain its queue */
+	if (pace.timeout.pending) {
+		uloop_timeout_cancel(&pace.timeout);
+		uloop_timeout_set(t, 1000);
+		return;
+	}
+
+	uloop_end();
+}
+
+static void summary_print(void)
+{
+	double elapsed = (time_us() - stats.start) / 1000000.0;
+	double nodes_per_msg = sent.msgs ? (double) sent.nodes / sent.msgs : 0;
+	uint64_t processed;
+
+	fprintf(stderr, "Sent %llu messages (%.1f MB, %llu node updates, %llu stations) in %.1f s, %llu errors\n",
+		(unsigned long long) sent.msgs, sent.bytes / 1000000.0,
+		(unsigned long long) sent.nodes, (unsigned long long) sent.stations,
+		elapsed, (unsigned long long) sent.errors);
+
+	if (!stats_query() || !sent.nodes)
+		return;
+
+	processed = stats.applied - stats.base;
+	if (!stats.max_rate)
+		stats.max_rate = processed / elapsed;
+
+	fprintf(stderr, "Processed %llu of %llu node updates (%.1f%% lost), %d/%d hosts known\n",
+		(unsigned long long) processed, (unsigned long long) sent.nodes,
+		processed < sent.nodes ? 100.0 * (sent.nodes - processed) / sent.nodes : 0,
+		stats.hosts_seen, n_hosts * n_copies);
+
+	if (processed + sent.nodes / 100 >= sent.nodes)
+		fprintf(stderr, "The daemon kept up with the offered load, raise -r to find its limit\n");
+	else if (nodes_per_msg > 0)
+		fprintf(stderr, "Ingest capacity: %.0f msg/s (%.0f node updates/s, %.0f stations/s)\n",
+			stats.max_rate / nodes_per_msg, stats.max_rate,
+			stats.max_rate * sent.stations / sent.nodes);
+}
+
+static int usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"Options:\n"
+		" -a <addr>:    Address of the usteerd instance (default: 127.0.0.1)\n"
+		"               The daemon only accepts messages from configured\n"
+		"               peers and network interfaces\n"
+		" -n <n>:       Number of virtual hosts (default: 10)\n"
+		" -m <n>:       Stations per virtual host (default: 20)\n"
+		" -N <n>:       Nodes per virtual host (default: 2)\n"
+		" -p <n>:       Size of the station address pool shared by all\n"
+		"               hosts (default: hosts * stations, no overlap)\n"
+		" -R <file>:    Replay the peer messages from a pcap capture file,\n"
+		"               each captured host is cloned <n> times\n"
+		" -r <msg/s>:   Message rate (default: one message per host and second)\n"
+		" -t <sec>:     Duration (default: 10, 0: until interrupted)\n"
+		" -i <sec>:     Statistics interval (default: 1, 0: disabled)\n"
+		" -S <seed>:    Random seed\n"
+		"\n", prog);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	const char *addr = "127.0.0.1";
+	const char *file = NULL;
+	int n_nodes = 2, n_sta = 20, pool = 0;
+	int ch, i;
+
+	n_hosts = 10;
+	stats.interval = 1;
+
+	while ((ch = getopt(argc, argv, "a:i:m:n:N:p:r:R:S:t:")) != -1) {
+		switch (ch) {
+		case 'a':
+			addr = optarg;
+			break;
+		case 'i':
+			stats.interval = atoi(optarg);
+			break;
+		case 'm':
+			n_sta = atoi(optarg);
+			break;
+		case 'n':
+			n_hosts = atoi(optarg);
+			break;
+		case 'N':
+			n_nodes = atoi(optarg);
+			break;
+		case 'p':
+			pool = atoi(optarg);
+			break;
+		case 'r':
+			pace.rate = atoi(optarg);
+			break;
+		case 'R':
+			file = optarg;
+			break;
+		case 'S':
+			rand_state = strtoull(optarg, NULL, 0) ?: 1;
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (n_hosts <= 0 || n_nodes <= 0 || n_sta < 0)
+		return usage(argv[0]);
+
+	base_id = rand_u32(&rand_state);
+
+	if (file) {
+		n_copies = n_hosts;
+		n_hosts = 0;
+		if (!replay_load(file))
+			return 1;
+	} else {
+		if (!pool)
+			pool = n_hosts * n_sta ?: 1;
+
+		for (i = 0; i < n_hosts; i++)
+			if (!synth_host(i, n_nodes, n_sta, pool))
+				return 1;
+	}
+
+	if (!pace.rate)
+		pace.rate = n_hosts * n_copies;
+
+	sock_fd = usock(USOCK_UDP | USOCK_NUMERIC, addr, APMGR_PORT_STR);
+	if (sock_fd < 0) {
+		fprintf(stderr, "Failed to create socket for %s: %s\n",
+			addr, strerror(errno));
+		return 1;
+	}
+
+	uloop_init();
+
+	ctx = ubus_connect(NULL);
+	if (!ctx || ubus_lookup_id(ctx, "usteer", &usteer_id)) {
+		fprintf(stderr, "usteer ubus object not found, only reporting the send rate\n");
+		if (ctx)
+			ubus_free(ctx);
+		ctx = NULL;
+	}
+
+	/* the daemon may still know our hosts from a run with the same seed */
+	if (stats_query())
+		stats.base = stats.last_applied = stats.applied;
+
+	fprintf(stderr, "Sending %d msg/s from %d hosts to %s\n",
+		pace.rate, n_hosts * n_copies, addr);
+
+	stats.start = stats.last = pace.last = time_us();
+	pace.timeout.cb = pace_cb;
+	uloop_timeout_set(&pace.timeout, PACE_INTERVAL);
+
+	if (stats.interval > 0) {
+		stats.timeout.cb = stats_cb;
+		uloop_timeout_set(&stats.timeout, stats.interval * 1000);
+	}
+
+	if (duration > 0) {
+		stop_timeout.cb = stop_cb;
+		uloop_timeout_set(&stop_timeout, duration * 1000);
+	}
+
+	uloop_run();
+
+	summary_print();
+
+	if (ctx)
+		ubus_free(ctx);
+	uloop_done();
+	close(sock_fd);
+
+	return 0;
+}
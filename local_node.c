@@ -23,17 +23,26 @@
 #ifdef linux
 #include <netinet/ether.h>
 #endif
+#include <sys/wait.h>
 #include <net/if.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <libubox/avl-cmp.h>
 #include <libubox/blobmsg_json.h>
 #include "usteer.h"
 #include "node.h"
 
+/* Limits for running node_up_script */
+#define NODE_SCRIPT_MAX_RUNNING		2
+#define NODE_SCRIPT_TIMEOUT		(30 * 1000)
+
 AVL_TREE(local_nodes, avl_strcmp, false, NULL);
 static struct blob_buf b;
 static char *node_up_script;
+static LIST_HEAD(node_script_queue);
+static int node_scripts_running;
 
 static void
 usteer_local_node_state_reset(struct usteer_local_node *ln)
@@ -57,6 +66,144 @@ usteer_local_node_pending_bss_tm_free(struct usteer_local_node *ln)
 	}
 }
 
+static void usteer_node_script_next(void);
+
+static void
+usteer_node_script_cb(struct uloop_process *p, int ret)
+{
+	struct usteer_local_node *ln = container_of(p, struct usteer_local_node, script.proc);
+
+	usteer_update_time();
+	uloop_timeout_cancel(&ln->script.timeout);
+	node_scripts_running--;
+
+	ln->script.status = ret;
+	ln->script.end = current_time;
+	if (!WIFEXITED(ret) || WEXITSTATUS(ret))
+		MSG(INFO, "node_up_script for %s failed (status %d)\n",
+		    usteer_node_name(&ln->node), ret);
+
+	if (ln->script.rerun) {
+		ln->script.rerun = false;
+		list_add_tail(&ln->script.list, &node_script_queue);
+	}
+
+	usteer_node_script_next();
+}
+
+static void
+usteer_node_script_timeout(struct uloop_timeout *t)
+{
+	struct usteer_local_node *ln = container_of(t, struct usteer_local_node, script.timeout);
+
+	MSG(INFO, "node_up_script for %s timed out\n", usteer_node_name(&ln->node));
+	ln->script.timed_out = true;
+	kill(-ln->script.proc.pid, SIGKILL);
+}
+
+static void
+usteer_node_script_start(struct usteer_local_node *ln)
+{
+	char *val;
+	pid_t pid;
+
+	if (!node_up_script)
+		return;
+
+	val = alloca(strlen(node_up_script) + strlen(ln->iface) + 8);
+	sprintf(val, "%s '%s'", node_up_script, ln->iface);
+
+	pid = fork();
+	if (pid < 0) {
+		MSG(INFO, "failed to execute %s\n", val);
+		return;
+	}
+
+	/* Own process group, so that a kill also reaches the script's children */
+	if (!pid) {
+		setpgid(0, 0);
+		execl("/bin/sh", "sh", "-c", val, NULL);
+		_exit(127);
+	}
+
+	setpgid(pid, pid);
+
+	usteer_update_time();
+	ln->script.proc.pid = pid;
+	ln->script.proc.cb = usteer_node_script_cb;
+	uloop_process_add(&ln->script.proc);
+	node_scripts_running++;
+
+	ln->script.start = current_time;
+	ln->script.end = 0;
+	ln->script.timed_out = false;
+	ln->script.timeout.cb = usteer_node_script_timeout;
+	uloop_timeout_set(&ln->script.timeout, NODE_SCRIPT_TIMEOUT);
+}
+
+static void
+usteer_node_script_next(void)
+{
+	struct usteer_local_node *ln;
+
+	while (node_scripts_running < NODE_SCRIPT_MAX_RUNNING &&
+	       !list_empty(&node_script_queue)) {
+		ln = list_first_entry(&node_script_queue, struct usteer_local_node, script.list);
+		list_del_init(&ln->script.list);
+		usteer_node_script_start(ln);
+	}
+}
+
+static void
+usteer_node_run_update_script(struct usteer_node *node)
+{
+	struct usteer_local_node *ln = container_of(node, struct usteer_local_node, node);
+
+	if (!node_up_script)
+		return;
+
+	/* Run again once the current invocation has finished */
+	if (ln->script.proc.pending) {
+		ln->script.rerun = true;
+		return;
+	}
+
+	if (!list_empty(&ln->script.list))
+		return;
+
+	list_add_tail(&ln->script.list, &node_script_queue);
+	usteer_node_script_next();
+}
+
+static void
+usteer_node_script_cancel(struct usteer_local_node *ln)
+{
+	list_del_init(&ln->script.list);
+	if (!ln->script.proc.pending)
+		return;
+
+	/* The exited process is reaped by uloop even after it was deleted */
+	kill(-ln->script.proc.pid, SIGKILL);
+	uloop_process_delete(&ln->script.proc);
+	uloop_timeout_cancel(&ln->script.timeout);
+	node_scripts_running--;
+	usteer_node_script_next();
+}
+
+static void
+usteer_local_node_setup_abort(struct usteer_local_node *ln)
+{
+	int i;
+
+	for (i = 0; i < __SETUP_MAX; i++) {
+		if (ln->setup.pending & (1 << i))
+			ubus_abort_request(ubus_ctx, &ln->setup.req[i]);
+	}
+
+	ln->setup.pending = 0;
+	uloop_timeout_cancel(&ln->setup.timeout);
+}
+
 static void
 usteer_free_node(struct ubus_context *ctx, struct usteer_local_node *ln)
 {
@@ -69,6 +216,8 @@ usteer_free_node(struct ubus_context *ctx, struct usteer_local_node *ln)
 	}
 
 	usteer_local_node_pending_bss_tm_free(ln);
+	usteer_local_node_setup_abort(ln);
+	usteer_node_script_cancel(ln);
 	usteer_local_node_state_reset(ln);
 	usteer_sta_node_cleanup(&ln->node);
 	usteer_measurement_report_node_cleanup(&ln->node);
@@ -266,6 +415,7 @@ usteer_handle_event(struct ubus_context *ctx, struct ubus_object *obj,
 	usteer_update_time();
 
 	ln = container_of(obj, struct usteer_local_node, ev.obj);
+	usteer_trace_event(ln, method, msg);
 
 	if(!strcmp(method, "bss-transition-query")) {
 		return usteer_handle_bss_tm_query(ln, msg);
@@ -339,6 +489,7 @@ usteer_local_node_assoc_update(struct sta_info *si, struct blob_attr *data)
 					 */
 				}
 			}
+			usteer_send_update_soon();
 		}
 		si->connected = STA_CONNECTED;
 	}
@@ -419,6 +570,7 @@ usteer_local_node_set_assoc(struct usteer_local_node *ln, struct blob_attr *cl)
 			continue;
 
 		usteer_sta_disconnected(si);
+		usteer_send_update_soon();
 		MSG(VERBOSE, "station "MAC_ADDR_FMT" disconnected from node %s\n",
 			MAC_ADDR_DATA(si->sta->addr), usteer_node_name(node));
 	}
@@ -678,22 +830,11 @@ usteer_get_node(struct ubus_context *ctx, const char *name)
 
 	ln->bss_tm_queries_timeout.cb = usteer_local_node_process_bss_tm_queries;
 	INIT_LIST_HEAD(&ln->bss_tm_queries);
-	return ln;
-}
+	INIT_LIST_HEAD(&ln->script.list);
 
-static void
-usteer_node_run_update_script(struct usteer_node *node)
-{
-	struct usteer_local_node *ln = container_of(node, struct usteer_local_node, node);
-	char *val;
-
-	if (!node_up_script)
-		return;
+	usteer_snapshot_node_added(node);
 
-	val = alloca(strlen(node_up_script) + strlen(ln->iface) + 8);
-	sprintf(val, "%s '%s'", node_up_script, ln->iface);
-	if (system(val))
-		MSG(INFO, "failed to execute %s\n", val);
+	return ln;
 }
 
 static void
@@ -703,6 +844,9 @@ usteer_check_node_enabled(struct usteer_local_node *ln)
 	struct blob_attr *cur;
 	int rem;
 
+	if (!ln->setup.ready)
+		return;
+
 	blobmsg_for_each_attr(cur, config.ssid_list, rem) {
 		if (strcmp(blobmsg_get_string(cur), ln->node.ssid) != 0)
 			continue;
@@ -732,12 +876,72 @@ usteer_check_node_enabled(struct usteer_local_node *ln)
 	usteer_node_run_update_script(&ln->node);
 }
 
+/* All configuration requests completed or timed out, start using the node */
+static void
+usteer_local_node_setup_done(struct usteer_local_node *ln)
+{
+	struct usteer_node_handler *h;
+
+	usteer_local_node_setup_abort(ln);
+	ln->setup.ready = true;
+
+	list_for_each_entry(h, &node_handlers, list) {
+		if (!h->init_node)
+			continue;
+
+		h->init_node(&ln->node);
+	}
+
+	usteer_check_node_enabled(ln);
+}
+
+static void
+usteer_local_node_setup_cb(struct ubus_request *req, int ret)
+{
+	struct usteer_local_node *ln = req->priv;
+	int i = req - ln->setup.req;
+
+	if (ret)
+		MSG(INFO, "Failed to configure local node %s: %s\n",
+		    usteer_node_name(&ln->node), ubus_strerror(ret));
+
+	ln->setup.pending &= ~(1 << i);
+	if (!ln->setup.pending)
+		usteer_local_node_setup_done(ln);
+}
+
+static void
+usteer_local_node_setup_timeout(struct uloop_timeout *t)
+{
+	struct usteer_local_node *ln = container_of(t, struct usteer_local_node, setup.timeout);
+
+	MSG(INFO, "Timeout configuring local node %s\n", usteer_node_name(&ln->node));
+	usteer_local_node_setup_done(ln);
+}
+
+static void
+usteer_local_node_setup_invoke(struct usteer_local_node *ln,
+			       enum local_setup_req type, const char *method)
+{
+	struct ubus_request *req = &ln->setup.req[type];
+
+	if (ubus_invoke_async(ubus_ctx, ln->obj_id, method, b.head, req)) {
+		MSG(INFO, "Failed to call %s on local node %s\n",
+		    method, usteer_node_name(&ln->node));
+		return;
+	}
+
+	req->priv = ln;
+	req->complete_cb = usteer_local_node_setup_cb;
+	ln->setup.pending |= 1 << type;
+	ubus_complete_request_async(ubus_ctx, req);
+}
+
 /* A new ubus object appeared. Figure out if we want to subscribe to it. */
 static void
 usteer_register_node(struct ubus_context *ctx, const char *name, uint32_t id)
 {
 	struct usteer_local_node *ln;
-	struct usteer_node_handler *h;
 	const char *iface;
 	int offset = sizeof("hostapd.") - 1;
 
@@ -751,26 +955,33 @@ usteer_register_node(struct ubus_context *ctx, const char *name, uint32_t id)
 	ln->iface = usteer_node_name(&ln->node) + offset;
 	ln->ifindex = if_nametoindex(ln->iface);
 
+	/*
+	 * The node stays disabled until hostapd acknowledged the requests
+	 * below. They are issued asynchronously, so that all nodes found at
+	 * startup are configured in parallel.
+	 */
+	usteer_local_node_setup_abort(ln);
+	ln->setup.ready = false;
+	ln->node.disabled = true;
+
 	blob_buf_init(&b, 0);
 	blobmsg_add_u32(&b, "notify_response", 1);
-	ubus_invoke(ctx, id, "notify_response", b.head, NULL, NULL, 1000);
+	usteer_local_node_setup_invoke(ln, SETUP_NOTIFY_RESPONSE, "notify_response");
 
 	/* Enable 802.11k support */
 	blob_buf_init(&b, 0);
 	blobmsg_add_u8(&b, "neighbor_report", 1);
 	blobmsg_add_u8(&b, "beacon_report", 1);
 	blobmsg_add_u8(&b, "bss_transition", 1);
-	ubus_invoke(ctx, id, "bss_mgmt_enable", b.head, NULL, NULL, 1000);
+	usteer_local_node_setup_invoke(ln, SETUP_BSS_MGMT_ENABLE, "bss_mgmt_enable");
 
-	list_for_each_entry(h, &node_handlers, list) {
-		if (!h->init_node)
-			continue;
-
-		h->init_node(&ln->node);
+	if (!ln->setup.pending) {
+		usteer_local_node_setup_done(ln);
+		return;
 	}
 
-	ln->node.disabled = true;
-	usteer_check_node_enabled(ln);
+	ln->setup.timeout.cb = usteer_local_node_setup_timeout;
+	uloop_timeout_set(&ln->setup.timeout, 1000);
 }
 
 /* This callback that gets called whenever a new instance appears on ubus */
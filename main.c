@@ -26,6 +26,7 @@
 #include "usteer.h"
 #include "event.h"
 #include "node.h"
+#include "evring.h"
 
 struct ubus_context *ubus_ctx;
 struct usteer_config config = {};
@@ -40,6 +41,15 @@ const char * const event_types[__EVENT_TYPE_MAX] = {
 	[EVENT_TYPE_ASSOC] = "assoc",
 };
 
+const char * const roam_trigger_states[__ROAM_TRIGGER_MAX] = {
+	[ROAM_TRIGGER_IDLE] = "idle",
+	[ROAM_TRIGGER_SCAN] = "scan",
+	[ROAM_TRIGGER_SCAN_DONE] = "scan_done",
+	[ROAM_TRIGGER_WAIT_KICK] = "wait_kick",
+	[ROAM_TRIGGER_NOTIFY_KICK] = "notify_kick",
+	[ROAM_TRIGGER_KICK] = "kick",
+};
+
 void log_msg(char *msg)
 {
 	if (config.syslog)
@@ -86,6 +96,7 @@ void usteer_init_defaults(void)
 	config.sta_block_timeout = 30 * 1000;
 	config.local_sta_timeout = 120 * 1000;
 	config.measurement_report_timeout = 120 * 1000;
+	config.measurement_report_limit = 256;
 	config.local_sta_update = 1 * 1000;
 	config.max_retry_band = 5;
 	config.max_neighbor_reports = 8;
@@ -93,8 +104,14 @@ void usteer_init_defaults(void)
 	config.band_steering_threshold = 5;
 	config.load_balancing_threshold = 5;
 	config.remote_update_interval = 1000;
+	config.remote_update_interval_min = 0;
+	config.remote_update_interval_max = 0;
 	config.initial_connect_delay = 0;
 	config.remote_node_timeout = 10;
+	config.remote_sta_filter = REMOTE_STA_FILTER_NONE;
+	config.snapshot_interval = 0;
+	config.event_ring_size = USTEER_EVRING_DEFAULT_SIZE;
+	config.metrics_port = 0;
 
 	config.roam_kick_delay = 100;
 	config.roam_process_timeout = 5 * 1000;
@@ -102,6 +119,10 @@ void usteer_init_defaults(void)
 	config.roam_scan_timeout = 0;
 	config.roam_scan_interval = 10 * 1000;
 	config.roam_trigger_interval = 60 * 1000;
+	config.roam_predict_time = 0;
+
+	config.beacon_req_max_active = 2;
+	config.beacon_req_airtime = 300;
 
 	config.min_snr_kick_delay = 5 * 1000;
 
@@ -114,6 +135,8 @@ void usteer_init_defaults(void)
 	config.debug_level = MSG_FATAL;
 }
 
+/* usteer-sim provides its own clock and entry point */
+#ifndef USTEER_SIM
 void usteer_update_time(void)
 {
 	struct timespec ts;
@@ -164,6 +187,7 @@ int main(int argc, char **argv)
 	openlog("usteer", 0, LOG_USER);
 
 	config_set_event_log_types(NULL);
+	config_set_event_limits(NULL);
 	usteer_update_time();
 	uloop_init();
 
@@ -178,6 +202,10 @@ int main(int argc, char **argv)
 	usteer_local_nodes_init(ubus_ctx);
 	uloop_run();
 
+	if (config.snapshot_interval)
+		usteer_snapshot_write();
+
 	uloop_done();
 	return 0;
 }
+#endif
@@ -17,9 +17,63 @@
 
 #include "usteer.h"
 
-LIST_HEAD(measurements);
+/*
+ * Reports are indexed by (sta, node) in a chained hash table, so a lookup
+ * no longer scans the station's list. Each node keeps its reports ordered
+ * by last update, the least recently updated one is evicted when the node
+ * reaches config.measurement_report_limit.
+ */
+#define MR_HASH_MIN_SIZE	64
+
+static struct {
+	struct list_head *buckets;
+	unsigned int size;
+	unsigned int count;
+} mr_hash;
+
 static struct usteer_timeout_queue tq;
 
+static unsigned int
+mr_hash_key(struct sta *sta, struct usteer_node *node)
+{
+	uint64_t key = (uintptr_t) sta ^ ((uint64_t) (uintptr_t) node << 17);
+
+	key *= 0x9e3779b97f4a7c15ULL;
+
+	return key >> 32;
+}
+
+static struct list_head *
+mr_hash_bucket(struct sta *sta, struct usteer_node *node)
+{
+	return &mr_hash.buckets[mr_hash_key(sta, node) & (mr_hash.size - 1)];
+}
+
+static void
+mr_hash_resize(unsigned int size)
+{
+	struct list_head *old = mr_hash.buckets;
+	unsigned int old_size = mr_hash.size;
+	struct usteer_measurement_report *mr, *tmp;
+	unsigned int i;
+
+	mr_hash.buckets = malloc(size * sizeof(*mr_hash.buckets));
+	if (!mr_hash.buckets) {
+		mr_hash.buckets = old;
+		return;
+	}
+
+	mr_hash.size = size;
+	for (i = 0; i < size; i++)
+		INIT_LIST_HEAD(&mr_hash.buckets[i]);
+
+	for (i = 0; i < old_size; i++)
+		list_for_each_entry_safe(mr, tmp, &old[i], hash_list)
+			list_add(&mr->hash_list, mr_hash_bucket(mr->sta, mr->node));
+
+	free(old);
+}
+
 void
 usteer_measurement_report_node_cleanup(struct usteer_node *node)
 {
@@ -43,14 +97,22 @@ usteer_measurement_report_get(struct sta *sta, struct usteer_node *node, bool cr
 {
 	struct usteer_measurement_report *mr;
 
-	list_for_each_entry(mr, &sta->measurements, sta_list) {
-		if (mr->node == node)
+	list_for_each_entry(mr, mr_hash_bucket(sta, node), hash_list) {
+		if (mr->sta == sta && mr->node == node)
 			return mr;
 	}
 
 	if (!create)
 		return NULL;
 
+	/* Make room by dropping the least recently updated report */
+	while (config.measurement_report_limit &&
+	       node->n_measurements >= config.measurement_report_limit) {
+		mr = list_last_entry(&node->measurements,
+				     struct usteer_measurement_report, node_list);
+		usteer_measurement_report_del(mr);
+	}
+
 	mr = calloc(1, sizeof(*mr));
 	if (!mr)
 		return NULL;
@@ -58,13 +120,16 @@ usteer_measurement_report_get(struct sta *sta, struct usteer_node *node, bool cr
 	/* Set node & add to nodes list */
 	mr->node = node;
 	list_add(&mr->node_list, &node->measurements);
+	node->n_measurements++;
 
 	/* Set sta & add to STAs list */
 	mr->sta = sta;
 	list_add(&mr->sta_list, &sta->measurements);
 
-	/* Add to Measurement list */
-	list_add(&mr->list, &measurements);
+	/* Add to the index */
+	if (++mr_hash.count > 2 * mr_hash.size)
+		mr_hash_resize(2 * mr_hash.size);
+	list_add(&mr->hash_list, mr_hash_bucket(sta, node));
 
 	/* Set measurement expiration */
 	usteer_timeout_set(&tq, &mr->timeout, config.measurement_report_timeout);
@@ -77,6 +142,8 @@ usteer_measurement_report_add_beacon_report(struct sta *sta, struct usteer_node
 					    struct usteer_beacon_report *br, uint64_t timestamp)
 {
 	struct usteer_measurement_report *mr = usteer_measurement_report_get(sta, node, true);
+	struct sta_info *si;
+	uint64_t age;
 
 	if (!mr)
 		return NULL;
@@ -84,6 +151,18 @@ usteer_measurement_report_add_beacon_report(struct sta *sta, struct usteer_node
 	mr->timestamp = timestamp;
 	memcpy(&mr->beacon_report, br, sizeof(*br));
 
+	si = usteer_sta_info_get(sta, node, NULL);
+	if (si)
+		usteer_sta_info_update_estimate(si, usteer_rcpi_to_signal(br->rcpi), timestamp);
+
+	/* Most recently updated first */
+	list_move(&mr->node_list, &node->measurements);
+
+	/* Expire relative to the report time, which may be restored from a snapshot */
+	age = timestamp < current_time ? current_time - timestamp : 0;
+	if (age < config.measurement_report_timeout)
+		usteer_timeout_set(&tq, &mr->timeout, config.measurement_report_timeout - age);
+
 	return mr;
 }
 
@@ -93,7 +172,9 @@ usteer_measurement_report_del(struct usteer_measurement_report *mr)
 	usteer_timeout_cancel(&tq, &mr->timeout);
 	list_del(&mr->node_list);
 	list_del(&mr->sta_list);
-	list_del(&mr->list);
+	list_del(&mr->hash_list);
+	mr->node->n_measurements--;
+	mr_hash.count--;
 	free(mr);
 }
 
@@ -109,4 +190,6 @@ static void __usteer_init usteer_measurement_init(void)
 {
 	usteer_timeout_init(&tq);
 	tq.cb = usteer_measurement_timeout;
+	tq.name = "measurement";
+	mr_hash_resize(MR_HASH_MIN_SIZE);
 }
@@ -0,0 +1,512 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/socket.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libubox/usock.h>
+#include <libubox/ustream.h>
+
+#include "usteer.h"
+#include "node.h"
+#include "event.h"
+
+#define METRICS_MAX_CONNS	8
+#define METRICS_MAX_REQUEST	4096
+
+/* Unix socket clients get the plain text, TCP clients are HTTP scrapers */
+struct metrics_conn {
+	struct list_head list;
+	struct ustream_fd stream;
+	bool http;
+	bool done;
+};
+
+static struct {
+	char *path;
+	uint32_t port;
+
+	struct uloop_fd unix_fd;
+	struct uloop_fd tcp_fd;
+
+	struct list_head conns;
+	int n_conns;
+} metrics = {
+	.unix_fd.fd = -1,
+	.tcp_fd.fd = -1,
+	.conns = LIST_HEAD_INIT(metrics.conns),
+};
+
+/* Upper bounds of the decision latency histogram buckets in usec */
+static const uint32_t latency_buckets[] = {
+	10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000,
+};
+
+static struct {
+	uint64_t count[ARRAY_SIZE(latency_buckets) + 1];
+	uint64_t total;
+	uint64_t sum_ns;
+} decision_latency[__EVENT_TYPE_MAX];
+
+static bool usteer_metrics_enabled(void)
+{
+	return metrics.unix_fd.fd >= 0 || metrics.tcp_fd.fd >= 0;
+}
+
+uint64_t usteer_metrics_time(void)
+{
+	struct timespec ts;
+
+	if (!usteer_metrics_enabled())
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void usteer_metrics_decision(enum usteer_event_type type, uint64_t start)
+{
+	uint64_t ns, now = usteer_metrics_time();
+	int i;
+
+	if (!start || !now)
+		return;
+
+	ns = now - start;
+	for (i = 0; i < ARRAY_SIZE(latency_buckets); i++)
+		if (ns <= latency_buckets[i] * 1000ULL)
+			break;
+
+	decision_latency[type].count[i]++;
+	decision_latency[type].total++;
+	decision_latency[type].sum_ns += ns;
+}
+
+/* remote node names are chosen by the peer, escape them as the format requires */
+static void
+metrics_write_label(FILE *f, const char *name, const char *val)
+{
+	fprintf(f, "%s=\"", name);
+	for (; *val; val++) {
+		switch (*val) {
+		case '\\':
+			fputs("\\\\", f);
+			break;
+		case '"':
+			fputs("\\\"", f);
+			break;
+		case '\n':
+			fputs("\\n", f);
+			break;
+		default:
+			fputc(*val, f);
+			break;
+		}
+	}
+	fputc('"', f);
+}
+
+/* Start a sample of a per node metric, the caller closes the label set */
+static void
+metrics_node_sample(FILE *f, const char *metric, struct usteer_node *node)
+{
+	fprintf(f, "%s{", metric);
+	metrics_write_label(f, "node", usteer_node_name(node));
+	fprintf(f, ",type=\"%s\"",
+		node->type == NODE_TYPE_LOCAL ? "local" : "remote");
+}
+
+static int
+metrics_write_node(FILE *f, struct usteer_node *node)
+{
+	struct sta_info *si;
+	int n_sta = 0;
+
+	list_for_each_entry(si, &node->sta_info, node_list)
+		n_sta++;
+
+	metrics_node_sample(f, "usteer_node_sta_infos", node);
+	fprintf(f, "} %d\n", n_sta);
+	metrics_node_sample(f, "usteer_node_assoc", node);
+	fprintf(f, "} %d\n", node->n_assoc);
+	metrics_node_sample(f, "usteer_node_load", node);
+	fprintf(f, "} %d\n", node->load);
+	metrics_node_sample(f, "usteer_node_measurements", node);
+	fprintf(f, "} %d\n", node->n_measurements);
+
+	return n_sta;
+}
+
+static void
+metrics_write_node_events(FILE *f, struct usteer_node *node)
+{
+	int i, j;
+
+	for (i = 0; i < __UEV_TYPE_MAX; i++) {
+		for (j = 0; j < __UEV_REASON_MAX; j++) {
+			if (!node->event_count[i][j])
+				continue;
+
+			metrics_node_sample(f, "usteer_events_total", node);
+			fprintf(f, ",event=\"%s\",reason=\"%s\"} %u\n",
+				usteer_event_name(i), usteer_event_reason_name(j),
+				node->event_count[i][j]);
+		}
+	}
+
+	for (i = 0; i < __ROAM_TRIGGER_MAX; i++) {
+		if (!node->roam_sm_count[i])
+			continue;
+
+		metrics_node_sample(f, "usteer_roam_transitions_total", node);
+		fprintf(f, ",state=\"%s\"} %u\n",
+			roam_trigger_states[i], node->roam_sm_count[i]);
+	}
+}
+
+static void
+metrics_write_latency(FILE *f)
+{
+	uint64_t count;
+	int i, j;
+
+	fprintf(f, "# TYPE usteer_decision_duration_seconds histogram\n");
+	for (i = 0; i < __EVENT_TYPE_MAX; i++) {
+		count = 0;
+		for (j = 0; j < ARRAY_SIZE(latency_buckets); j++) {
+			count += decision_latency[i].count[j];
+			fprintf(f, "usteer_decision_duration_seconds_bucket{request=\"%s\",le=\"%g\"} %llu\n",
+				event_types[i], latency_buckets[j] / 1000000.0,
+				(unsigned long long) count);
+		}
+
+		fprintf(f, "usteer_decision_duration_seconds_bucket{request=\"%s\",le=\"+Inf\"} %llu\n",
+			event_types[i], (unsigned long long) decision_latency[i].total);
+		fprintf(f, "usteer_decision_duration_seconds_sum{request=\"%s\"} %.9f\n",
+			event_types[i], decision_latency[i].sum_ns / 1000000000.0);
+		fprintf(f, "usteer_decision_duration_seconds_count{request=\"%s\"} %llu\n",
+			event_types[i], (unsigned long long) decision_latency[i].total);
+	}
+}
+
+static char *
+metrics_format(size_t *len)
+{
+	struct usteer_timeout_queue *q;
+	struct usteer_remote_node *rn;
+	struct usteer_node *node;
+	char *buf = NULL;
+	int n_sta_info = 0;
+	int n_local = 0, n_remote = 0;
+	int n_measurements = 0;
+	FILE *f;
+
+	f = open_memstream(&buf, len);
+	if (!f)
+		return NULL;
+
+	fprintf(f, "# TYPE usteer_node_sta_infos gauge\n");
+	fprintf(f, "# TYPE usteer_node_assoc gauge\n");
+	fprintf(f, "# TYPE usteer_node_load gauge\n");
+	fprintf(f, "# TYPE usteer_node_measurements gauge\n");
+	for_each_local_node(node) {
+		n_sta_info += metrics_write_node(f, node);
+		n_measurements += node->n_measurements;
+		n_local++;
+	}
+
+	for_each_remote_node(rn) {
+		n_sta_info += metrics_write_node(f, &rn->node);
+		n_measurements += rn->node.n_measurements;
+		n_remote++;
+	}
+
+	fprintf(f, "# TYPE usteer_events_total counter\n");
+	fprintf(f, "# TYPE usteer_roam_transitions_total counter\n");
+	/* counters are only kept for local nodes */
+	for_each_local_node(node)
+		metrics_write_node_events(f, node);
+
+	fprintf(f, "# TYPE usteer_local_nodes gauge\n"
+		   "usteer_local_nodes %d\n", n_local);
+	fprintf(f, "# TYPE usteer_remote_nodes gauge\n"
+		   "usteer_remote_nodes %d\n", n_remote);
+	fprintf(f, "# TYPE usteer_remote_hosts gauge\n"
+		   "usteer_remote_hosts %d\n", remote_hosts.count);
+	fprintf(f, "# TYPE usteer_stations gauge\n"
+		   "usteer_stations %d\n", stations.count);
+	fprintf(f, "# TYPE usteer_measurements gauge\n"
+		   "usteer_measurements %d\n", n_measurements);
+
+	fprintf(f, "# TYPE usteer_remote_messages_received_total counter\n"
+		   "usteer_remote_messages_received_total %llu\n",
+		(unsigned long long) remote_stats.rx);
+	fprintf(f, "# TYPE usteer_remote_messages_invalid_total counter\n"
+		   "usteer_remote_messages_invalid_total %llu\n",
+		(unsigned long long) remote_stats.rx_invalid);
+	fprintf(f, "# TYPE usteer_remote_messages_sent_total counter\n"
+		   "usteer_remote_messages_sent_total %llu\n",
+		(unsigned long long) remote_stats.tx);
+	fprintf(f, "# TYPE usteer_remote_node_updates_total counter\n"
+		   "usteer_remote_node_updates_total{result=\"applied\"} %llu\n"
+		   "usteer_remote_node_updates_total{result=\"skipped\"} %llu\n",
+		(unsigned long long) remote_stats.updates_applied,
+		(unsigned long long) remote_stats.updates_skipped);
+
+	fprintf(f, "# TYPE usteer_timer_queue_entries gauge\n");
+	list_for_each_entry(q, &usteer_timeout_queues, list)
+		if (q->name)
+			fprintf(f, "usteer_timer_queue_entries{queue=\"%s\"} %d\n",
+				q->name, q->tree.count);
+
+	/* allocated objects, usteer has no pools of its own */
+	fprintf(f, "# TYPE usteer_object_bytes gauge\n");
+	fprintf(f, "usteer_object_bytes{object=\"sta\"} %zu\n",
+		stations.count * sizeof(struct sta));
+	fprintf(f, "usteer_object_bytes{object=\"sta_info\"} %zu\n",
+		(size_t) n_sta_info * sizeof(struct sta_info));
+	fprintf(f, "usteer_object_bytes{object=\"measurement_report\"} %zu\n",
+		(size_t) n_measurements * sizeof(struct usteer_measurement_report));
+	fprintf(f, "usteer_object_bytes{object=\"remote_node\"} %zu\n",
+		(size_t) n_remote * sizeof(struct usteer_remote_node));
+	fprintf(f, "usteer_object_bytes{object=\"remote_host\"} %zu\n",
+		remote_hosts.count * sizeof(struct usteer_remote_host));
+
+	metrics_write_latency(f);
+
+	if (fclose(f)) {
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+static void
+metrics_conn_free(struct metrics_conn *conn)
+{
+	list_del(&conn->list);
+	ustream_free(&conn->stream.stream);
+	close(conn->stream.fd.fd);
+	metrics.n_conns--;
+	free(conn);
+}
+
+/* only the state callback may free the connection */
+static void
+metrics_conn_close(struct metrics_conn *conn)
+{
+	struct ustream *s = &conn->stream.stream;
+
+	s->eof = true;
+	ustream_state_change(s);
+}
+
+static void
+metrics_conn_reply(struct metrics_conn *conn)
+{
+	struct ustream *s = &conn->stream.stream;
+	size_t len;
+	char *buf;
+
+	conn->done = true;
+	buf = metrics_format(&len);
+	if (!buf) {
+		metrics_conn_close(conn);
+		return;
+	}
+
+	if (conn->http)
+		ustream_printf(s, "HTTP/1.0 200 OK\r\n"
+			       "Content-Type: text/plain; version=0.0.4\r\n"
+			       "Content-Length: %zu\r\n"
+			       "Connection: close\r\n\r\n", len);
+	ustream_write(s, buf, len, false);
+	free(buf);
+
+	if (!ustream_pending_data(s, true))
+		metrics_conn_close(conn);
+}
+
+static void
+metrics_conn_read_cb(struct ustream *s, int bytes)
+{
+	struct metrics_conn *conn = container_of(s, struct metrics_conn, stream.stream);
+	char *data;
+	int len;
+
+	if (conn->done || s->eof) {
+		ustream_consume(s, bytes);
+		return;
+	}
+
+	/* any request gets the metrics once its header is complete */
+	data = ustream_get_read_buf(s, &len);
+	if (!data)
+		return;
+
+	if (memmem(data, len, "\r\n\r\n", 4) || memmem(data, len, "\n\n", 2)) {
+		ustream_consume(s, len);
+		metrics_conn_reply(conn);
+		return;
+	}
+
+	if (len > METRICS_MAX_REQUEST)
+		metrics_conn_close(conn);
+}
+
+static void
+metrics_conn_write_cb(struct ustream *s, int bytes)
+{
+	struct metrics_conn *conn = container_of(s, struct metrics_conn, stream.stream);
+
+	if (conn->done && !ustream_pending_data(s, true))
+		metrics_conn_close(conn);
+}
+
+static void
+metrics_conn_state_cb(struct ustream *s)
+{
+	struct metrics_conn *conn = container_of(s, struct metrics_conn, stream.stream);
+
+	if (!s->eof && !s->write_error)
+		return;
+
+	metrics_conn_free(conn);
+}
+
+static void
+metrics_accept(struct uloop_fd *u, unsigned int events)
+{
+	struct metrics_conn *conn;
+	int fd;
+
+	while (1) {
+		fd = accept4(u->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return;
+		}
+
+		if (metrics.n_conns >= METRICS_MAX_CONNS) {
+			close(fd);
+			continue;
+		}
+
+		conn = calloc(1, sizeof(*conn));
+		if (!conn) {
+			close(fd);
+			continue;
+		}
+
+		conn->http = u == &metrics.tcp_fd;
+		conn->stream.stream.notify_read = metrics_conn_read_cb;
+		conn->stream.stream.notify_write = metrics_conn_write_cb;
+		conn->stream.stream.notify_state = metrics_conn_state_cb;
+		ustream_fd_init(&conn->stream, fd);
+		list_add_tail(&conn->list, &metrics.conns);
+		metrics.n_conns++;
+
+		if (!conn->http)
+			metrics_conn_reply(conn);
+	}
+}
+
+static void
+metrics_close(struct uloop_fd *u)
+{
+	if (u->fd < 0)
+		return;
+
+	uloop_fd_delete(u);
+	close(u->fd);
+	u->fd = -1;
+}
+
+static void
+metrics_listen(struct uloop_fd *u, int type, const char *host, const char *service)
+{
+	u->fd = usock(type | USOCK_SERVER | USOCK_NONBLOCK, host, service);
+	if (u->fd < 0) {
+		MSG(FATAL, "Failed to open metrics socket %s%s%s: %s\n", host,
+		    service ? ":" : "", service ? service : "", strerror(errno));
+		return;
+	}
+
+	u->cb = metrics_accept;
+	uloop_fd_add(u, ULOOP_READ);
+}
+
+void usteer_metrics_update_config(void)
+{
+	char port[8];
+
+	if (metrics.port != config.metrics_port) {
+		metrics_close(&metrics.tcp_fd);
+		metrics.port = config.metrics_port;
+		if (metrics.port) {
+			snprintf(port, sizeof(port), "%u", metrics.port);
+			metrics_listen(&metrics.tcp_fd, USOCK_TCP | USOCK_NUMERIC | USOCK_IPV4ONLY,
+				       "127.0.0.1", port);
+		}
+	}
+
+	if (metrics.path && metrics.unix_fd.fd < 0) {
+		unlink(metrics.path);
+		metrics_listen(&metrics.unix_fd, USOCK_UNIX, metrics.path, NULL);
+	}
+}
+
+void config_set_metrics_socket(struct blob_attr *data)
+{
+	const char *val;
+
+	if (!data)
+		return;
+
+	val = blobmsg_get_string(data);
+	if (metrics.path && !strcmp(val, metrics.path))
+		return;
+
+	if (metrics.unix_fd.fd >= 0) {
+		metrics_close(&metrics.unix_fd);
+		unlink(metrics.path);
+	}
+
+	free(metrics.path);
+	metrics.path = NULL;
+	if (strlen(val))
+		metrics.path = strdup(val);
+}
+
+void config_get_metrics_socket(struct blob_buf *buf)
+{
+	if (!metrics.path)
+		return;
+
+	blobmsg_add_string(buf, "metrics_socket", metrics.path);
+}
@@ -17,9 +17,11 @@
  *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
  */
 
-#include <netinet/udp.h>
 #include <arpa/inet.h>
+#include <signal.h>
 #include <stdio.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <pcap/pcap.h>
 
@@ -27,36 +29,63 @@
 
 #include "usteer.h"
 #include "remote.h"
+#include "capture.h"
 
 static pcap_t *pcap;
-static int pkt_offset;
-
-/* IP header */
-struct ip_header {
-	uint8_t ip_vhl;		/* version << 4 | header length >> 2 */
-	uint8_t ip_tos;		/* type of service */
-	uint16_t ip_len;		/* total length */
-	uint16_t ip_id;		/* identification */
-	uint16_t ip_off;		/* fragment offset field */
-#define IP_RF 0x8000		/* reserved fragment flag */
-#define IP_DF 0x4000		/* dont fragment flag */
-#define IP_MF 0x2000		/* more fragments flag */
-#define IP_OFFMASK 0x1fff	/* mask for fragmenting bits */
-	uint8_t ip_ttl;		/* time to live */
-	uint8_t ip_p;		/* protocol */
-	uint16_t ip_sum;		/* checksum */
-	struct in_addr ip_src, ip_dst; /* source and dest address */
+static int link_type;
+
+static struct {
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t msgs;
+	uint64_t fragments;
+	uint64_t skipped;
+} capture;
+
+static struct blob_attr **bench_msgs;
+static int bench_n_msgs;
+static int bench_rounds;
+
+struct stats_counters {
+	uint64_t msgs;
+	uint64_t bytes;
+	uint64_t nodes;
+	uint64_t stations;
+	uint32_t max_nodes;
+	uint32_t max_stations;
+	uint32_t max_size;
+	uint32_t seq_gaps;
+	uint32_t seq_lost;
+	uint32_t seq_dup;
+	uint32_t seq_reorder;
+	uint32_t invalid;
 };
-#define IP_HL(ip)		(((ip)->ip_vhl) & 0x0f)
-#define IP_V(ip)		(((ip)->ip_vhl) >> 4)
-
-struct udp_header {
-	uint16_t uh_sport;       /* source port */
-	uint16_t uh_dport;       /* destination port */
-	uint16_t uh_ulen;        /* udp length */
-	uint16_t uh_sum;     /* udp checksum */
+
+struct stats_host {
+	struct avl_node avl;
+	struct in6_addr src;
+	char addr[INET6_ADDRSTRLEN];
+
+	uint32_t id;
+	uint32_t seq;
+	bool seq_valid;
+
+	struct stats_counters cur;
+	struct stats_counters total;
 };
 
+static int
+stats_host_cmp(const void *k1, const void *k2, void *ptr)
+{
+	return memcmp(k1, k2, sizeof(struct in6_addr));
+}
+
+static AVL_TREE(stats_hosts, stats_host_cmp, false, NULL);
+static struct stats_host *stats_host_last;
+static struct blob_buf stats_buf;
+static int stats_interval;
+static bool stats_json;
+static uint64_t stats_first, stats_last, stats_now;
 
 static void
 decode_sta(struct blob_attr *data)
@@ -82,6 +111,8 @@ decode_node(struct blob_attr *data)
 
 	fprintf(stderr, "\tNode %s, freq=%d, n_assoc=%d, noise=%d load=%d max_assoc=%d\n",
 		msg.name, msg.freq, msg.n_assoc, msg.noise, msg.load, msg.max_assoc);
+	if (msg.origin)
+		fprintf(stderr, "\t\tOrigin: %08x\n", msg.origin);
 	if (msg.rrm_nr) {
 		fprintf(stderr, "\t\tRRM:");
 		blobmsg_for_each_attr(cur, msg.rrm_nr, rem) {
@@ -116,54 +147,367 @@ decode_packet(struct blob_attr *data)
 		return;
 	}
 
-	fprintf(stderr, "id=%08x, seq=%d\n", msg.id, msg.seq);
+	fprintf(stderr, "id=%08x, seq=%d%s\n", msg.id, msg.seq,
+		msg.summary ? " (summary)" : "");
 	if (msg.host_info) {
 		char *data = blobmsg_format_json(msg.host_info, true);
 		fprintf(stderr, "\tHost info: %s\n", data);
 		free(data);
 	}
 
+	if (msg.interest) {
+		int n_interest = 0;
+
+		blob_for_each_attr(cur, msg.interest, rem)
+			n_interest++;
+
+		fprintf(stderr, "\tInterest: %d stations\n", n_interest);
+	}
+
 	blob_for_each_attr(cur, msg.nodes, rem)
 		decode_node(cur);
 }
 
+static void
+bench_add_packet(struct blob_attr *data, int len)
+{
+	if (!(bench_n_msgs % 256))
+		bench_msgs = realloc(bench_msgs, (bench_n_msgs + 256) * sizeof(*bench_msgs));
+
+	bench_msgs[bench_n_msgs] = malloc(len);
+	memcpy(bench_msgs[bench_n_msgs], data, len);
+	bench_n_msgs++;
+}
+
+/* Same decoding steps as the daemon receive path, without output */
+static void
+bench_decode(struct blob_attr *data, int *n_nodes, int *n_sta)
+{
+	struct apmsg_node node;
+	struct apmsg_sta sta;
+	struct apmsg msg;
+	struct blob_attr *cur, *scur;
+	int rem, srem;
+
+	if (!parse_apmsg(&msg, data))
+		return;
+
+	blob_for_each_attr(cur, msg.nodes, rem) {
+		if (!parse_apmsg_node(&node, cur))
+			continue;
+
+		(*n_nodes)++;
+		blob_for_each_attr(scur, node.stations, srem)
+			if (parse_apmsg_sta(&sta, scur))
+				(*n_sta)++;
+	}
+}
+
+static uint64_t
+bench_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+bench_run(void)
+{
+	uint64_t start, elapsed;
+	int n_nodes = 0, n_sta = 0;
+	int i, j;
+
+	if (!bench_n_msgs) {
+		fprintf(stderr, "No messages captured\n");
+		return;
+	}
+
+	start = bench_time_ns();
+	for (i = 0; i < bench_rounds; i++)
+		for (j = 0; j < bench_n_msgs; j++)
+			bench_decode(bench_msgs[j], &n_nodes, &n_sta);
+	elapsed = bench_time_ns() - start;
+	if (!elapsed)
+		elapsed = 1;
+
+	fprintf(stderr, "Decoded %d messages x %d rounds in %.3f ms\n",
+		bench_n_msgs, bench_rounds, elapsed / 1000000.0);
+	fprintf(stderr, "%.1f ns/message, %.0f messages/s, %.0f nodes/s, %.0f stations/s\n",
+		(double) elapsed / bench_n_msgs / bench_rounds,
+		(double) bench_n_msgs * bench_rounds * 1000000000.0 / elapsed,
+		(double) n_nodes * 1000000000.0 / elapsed,
+		(double) n_sta * 1000000000.0 / elapsed);
+}
+
+static uint64_t
+stats_time_ms(const struct timeval *tv)
+{
+	return (uint64_t) tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+static void
+format_addr(const struct in6_addr *src, char *buf)
+{
+	if (IN6_IS_ADDR_V4MAPPED(src))
+		inet_ntop(AF_INET, &src->s6_addr[12], buf, INET6_ADDRSTRLEN);
+	else
+		inet_ntop(AF_INET6, src, buf, INET6_ADDRSTRLEN);
+}
+
+static struct stats_host *
+stats_host_get(const struct in6_addr *src)
+{
+	struct stats_host *host = stats_host_last;
+
+	/* consecutive messages mostly come from the same host */
+	if (host && !memcmp(&host->src, src, sizeof(*src)))
+		return host;
+
+	host = avl_find_element(&stats_hosts, src, host, avl);
+	if (!host) {
+		host = calloc(1, sizeof(*host));
+		host->src = *src;
+		format_addr(src, host->addr);
+		host->avl.key = &host->src;
+		avl_insert(&stats_hosts, &host->avl);
+	}
+
+	stats_host_last = host;
+
+	return host;
+}
+
+static void
+stats_count(struct stats_counters *c, int len, int n_nodes, int n_sta)
+{
+	c->msgs++;
+	c->bytes += len;
+	c->nodes += n_nodes;
+	c->stations += n_sta;
+	if (n_nodes > c->max_nodes)
+		c->max_nodes = n_nodes;
+	if (n_sta > c->max_stations)
+		c->max_stations = n_sta;
+	if (len > c->max_size)
+		c->max_size = len;
+}
+
+static void
+stats_seq(struct stats_host *host, struct apmsg *msg)
+{
+	int32_t delta = msg->seq - host->seq;
+
+	/* a new id means the sender restarted */
+	if (!host->seq_valid || host->id != msg->id) {
+		host->id = msg->id;
+		host->seq = msg->seq;
+		host->seq_valid = true;
+		return;
+	}
+
+	if (delta > 1) {
+		host->cur.seq_gaps++;
+		host->total.seq_gaps++;
+		host->cur.seq_lost += delta - 1;
+		host->total.seq_lost += delta - 1;
+	} else if (!delta) {
+		host->cur.seq_dup++;
+		host->total.seq_dup++;
+		return;
+	} else if (delta < 0) {
+		host->cur.seq_reorder++;
+		host->total.seq_reorder++;
+		return;
+	}
+
+	host->seq = msg->seq;
+}
+
+static void
+stats_print_host_json(struct stats_host *host, struct stats_counters *c,
+		      double elapsed)
+{
+	void *t;
+
+	t = blobmsg_open_table(&stats_buf, host->addr);
+	blobmsg_printf(&stats_buf, "id", "%08x", host->id);
+	blobmsg_add_double(&stats_buf, "msgs_per_sec", c->msgs / elapsed);
+	blobmsg_add_double(&stats_buf, "bytes_per_sec", c->bytes / elapsed);
+	blobmsg_add_u64(&stats_buf, "msgs", c->msgs);
+	blobmsg_add_u64(&stats_buf, "bytes", c->bytes);
+	blobmsg_add_double(&stats_buf, "nodes_per_msg",
+			   c->msgs ? (double) c->nodes / c->msgs : 0);
+	blobmsg_add_u32(&stats_buf, "max_nodes", c->max_nodes);
+	blobmsg_add_double(&stats_buf, "stations_per_msg",
+			   c->msgs ? (double) c->stations / c->msgs : 0);
+	blobmsg_add_u32(&stats_buf, "max_stations", c->max_stations);
+	blobmsg_add_u32(&stats_buf, "max_size", c->max_size);
+	blobmsg_add_double(&stats_buf, "max_size_pct",
+			   100.0 * c->max_size / APMGR_BUFLEN);
+	blobmsg_add_u32(&stats_buf, "seq_gaps", c->seq_gaps);
+	blobmsg_add_u32(&stats_buf, "seq_lost", c->seq_lost);
+	blobmsg_add_u32(&stats_buf, "seq_dup", c->seq_dup);
+	blobmsg_add_u32(&stats_buf, "seq_reorder", c->seq_reorder);
+	blobmsg_add_u32(&stats_buf, "invalid", c->invalid);
+	blobmsg_close_table(&stats_buf, t);
+}
+
+static void
+stats_print_host(struct stats_host *host, struct stats_counters *c,
+		 double elapsed)
+{
+	printf("  %-15s id=%08x %.1f msg/s, %.0f B/s, %.1f nodes/msg (max %u), "
+	       "%.1f stations/msg (max %u), max size %u (%.1f%% of %d)",
+	       host->addr, host->id, c->msgs / elapsed, c->bytes / elapsed,
+	       c->msgs ? (double) c->nodes / c->msgs : 0, c->max_nodes,
+	       c->msgs ? (double) c->stations / c->msgs : 0, c->max_stations,
+	       c->max_size, 100.0 * c->max_size / APMGR_BUFLEN, APMGR_BUFLEN);
+	if (c->seq_gaps || c->seq_dup || c->seq_reorder)
+		printf(", seq gaps %u (%u lost), dup %u, reorder %u",
+		       c->seq_gaps, c->seq_lost, c->seq_dup, c->seq_reorder);
+	if (c->invalid)
+		printf(", invalid %u", c->invalid);
+	printf("\n");
+}
+
+/* print the counters since the last report, or the totals */
+static void
+stats_print(bool total)
+{
+	uint64_t start = total ? stats_first : stats_last;
+	double elapsed = (stats_now - start) / 1000.0;
+	struct stats_host *host;
+	void *c;
+
+	if (elapsed <= 0)
+		elapsed = 1;
+
+	if (stats_json) {
+		blob_buf_init(&stats_buf, 0);
+		blobmsg_add_u64(&stats_buf, "time", stats_now);
+		blobmsg_add_double(&stats_buf, "interval", elapsed);
+		blobmsg_add_u8(&stats_buf, "total", total);
+		c = blobmsg_open_table(&stats_buf, "hosts");
+	} else {
+		printf("%s %.3f s:\n", total ? "Total" : "Interval", elapsed);
+	}
+
+	avl_for_each_element(&stats_hosts, host, avl) {
+		struct stats_counters *cnt = total ? &host->total : &host->cur;
+
+		if (!cnt->msgs && !cnt->invalid)
+			continue;
+
+		if (stats_json)
+			stats_print_host_json(host, cnt, elapsed);
+		else
+			stats_print_host(host, cnt, elapsed);
+
+		if (!total)
+			memset(&host->cur, 0, sizeof(host->cur));
+	}
+
+	if (stats_json) {
+		char *str;
+
+		blobmsg_close_table(&stats_buf, c);
+		str = blobmsg_format_json(stats_buf.head, true);
+		printf("%s\n", str);
+		free(str);
+	}
+
+	fflush(stdout);
+	stats_last = stats_now;
+}
+
+/* Intervals follow the capture timestamps, so offline files report the same */
+static void
+stats_add_packet(const struct in6_addr *src, const struct timeval *ts,
+		 struct blob_attr *data, int len)
+{
+	struct stats_host *host = stats_host_get(src);
+	struct apmsg_node node;
+	struct apmsg msg;
+	struct blob_attr *cur, *scur;
+	int n_nodes = 0, n_sta = 0;
+	int rem, srem;
+
+	stats_now = stats_time_ms(ts);
+	if (!stats_first)
+		stats_first = stats_last = stats_now;
+	else if (stats_now - stats_last >= stats_interval * 1000)
+		stats_print(false);
+
+	if (len != blob_pad_len(data) || !parse_apmsg(&msg, data)) {
+		host->cur.invalid++;
+		host->total.invalid++;
+		return;
+	}
+
+	stats_seq(host, &msg);
+
+	blob_for_each_attr(cur, msg.nodes, rem) {
+		if (!parse_apmsg_node(&node, cur))
+			continue;
+
+		n_nodes++;
+		blob_for_each_attr(scur, node.stations, srem)
+			n_sta++;
+	}
+
+	stats_count(&host->cur, len, n_nodes, n_sta);
+	stats_count(&host->total, len, n_nodes, n_sta);
+}
+
+static void
+stats_stop(int signo)
+{
+	pcap_breakloop(pcap);
+}
+
 static void
 recv_packet(unsigned char *user, const struct pcap_pkthdr *hdr,
 	    const unsigned char *packet)
 {
-	char addr[INET_ADDRSTRLEN];
-	struct ip_header *ip;
-	struct udp_header *uh;
-	struct blob_attr *data;
+	static uint32_t buf[APMGR_BUFLEN / 4];
+	char addr[INET6_ADDRSTRLEN];
+	struct blob_attr *data = (void *) buf;
+	struct in6_addr src;
 	int len = hdr->caplen;
-	int hdrlen;
 
-	len -= pkt_offset;
-	packet += pkt_offset;
-	ip = (void *) packet;
+	capture.packets++;
+	capture.bytes += hdr->caplen;
 
-	hdrlen = IP_HL(ip) * 4;
-	if (hdrlen < 20 || hdrlen >= len)
+	packet = capture_payload(link_type, packet, &len, &src);
+	if (!packet && !len) {
+		capture.fragments++;
 		return;
+	}
 
-	len -= hdrlen;
-	packet += hdrlen;
-
-	inet_ntop(AF_INET, &ip->ip_src, addr, sizeof(addr));
-
-	hdrlen = sizeof(*uh);
-	if (len <= hdrlen)
+	if (!packet || len < sizeof(*data) || len > sizeof(buf)) {
+		capture.skipped++;
 		return;
+	}
 
-	uh = (void *) packet;
-	packet += hdrlen;
-	len -= hdrlen;
+	/* the payload is not necessarily aligned within the frame */
+	memcpy(buf, packet, len);
+	capture.msgs++;
 
-	if (uh->uh_dport != htons(APMGR_PORT))
+	if (stats_interval) {
+		stats_add_packet(&src, &hdr->ts, data, len);
 		return;
+	}
 
-	data = (void *) packet;
+	if (bench_rounds) {
+		if (len == blob_pad_len(data))
+			bench_add_packet(data, len);
+		return;
+	}
 
+	format_addr(&src, addr);
 	fprintf(stderr, "[%s]: len=%d ", addr, len);
 
 	if (len != blob_pad_len(data)) {
@@ -174,39 +518,130 @@ recv_packet(unsigned char *user, const struct pcap_pkthdr *hdr,
 	decode_packet(data);
 }
 
-int main(int argc, char **argv)
+/* non-first fragments carry no UDP header and need to be matched separately */
+#define PEER_FILTER \
+	"(udp port "APMGR_PORT_STR" or ip[6:2] & 0x1fff != 0 or ip6[6] == 44)"
+
+static void
+set_filter(void)
 {
-	static char errbuf[PCAP_ERRBUF_SIZE];
+	static const char * const filters[] = {
+		PEER_FILTER " or (vlan and " PEER_FILTER ")",
+		PEER_FILTER,
+	};
 	struct bpf_program fp;
+	int i;
+
+	/* not every link type supports the vlan keyword */
+	for (i = 0; i < ARRAY_SIZE(filters); i++) {
+		if (pcap_compile(pcap, &fp, filters[i], 1, PCAP_NETMASK_UNKNOWN))
+			continue;
 
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s <interface>\n", argv[0]);
-		return 1;
+		pcap_setfilter(pcap, &fp);
+		pcap_freecode(&fp);
+		return;
 	}
+}
 
-	pcap = pcap_open_live(argv[1], APMGR_BUFLEN, 1, 1000, errbuf);
-	if (!pcap) {
-			fprintf(stderr, "Failed to open interface %s: %s\n", argv[1], errbuf);
-			return 1;
+static int usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] [<interface>]\n"
+		"Options:\n"
+		" -r <file>:    Read packets from a pcap capture file\n"
+		" -b <rounds>:  Decode the messages from <file> <rounds> times\n"
+		"               and report the decoder throughput\n"
+		" -s <sec>:     Print per-host statistics every <sec> seconds\n"
+		"               instead of decoding messages\n"
+		" -j:           Print statistics as JSON\n"
+		"\n", prog);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	static char errbuf[PCAP_ERRBUF_SIZE];
+	const char *file = NULL;
+	uint64_t start;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "b:jr:s:")) != -1) {
+		switch (ch) {
+		case 'b':
+			bench_rounds = atoi(optarg);
+			break;
+		case 'j':
+			stats_json = true;
+			break;
+		case 's':
+			stats_interval = atoi(optarg);
+			if (stats_interval <= 0)
+				return usage(argv[0]);
+			break;
+		case 'r':
+			file = optarg;
+			break;
+		default:
+			return usage(argv[0]);
+		}
 	}
 
-	pcap_compile(pcap, &fp, "port "APMGR_PORT_STR, 1, PCAP_NETMASK_UNKNOWN);
-	pcap_setfilter(pcap, &fp);
+	if (file) {
+		pcap = pcap_open_offline(file, errbuf);
+		if (!pcap) {
+			fprintf(stderr, "Failed to open file %s: %s\n", file, errbuf);
+			return 1;
+		}
+	} else {
+		if (optind + 1 != argc || bench_rounds)
+			return usage(argv[0]);
 
-	switch (pcap_datalink(pcap)) {
-	case DLT_EN10MB:
-		pkt_offset = 14;
-		break;
-	case DLT_RAW:
-		pkt_offset = 0;
-		break;
-	default:
-		fprintf(stderr, "Invalid link type\n");
+		pcap = pcap_open_live(argv[optind], APMGR_BUFLEN, 1, 1000, errbuf);
+		if (!pcap) {
+			fprintf(stderr, "Failed to open interface %s: %s\n", argv[optind], errbuf);
+			return 1;
+		}
+	}
+
+	link_type = pcap_datalink(pcap);
+	if (!capture_link_supported(link_type)) {
+		fprintf(stderr, "Unsupported link type %d\n", link_type);
 		return -1;
 	}
 
+	/*
+	 * Files are read without a BPF program, the parser rejects other
+	 * traffic cheaply and the decode output is block buffered.
+	 */
+	if (file)
+		setvbuf(stderr, NULL, _IOFBF, 1024 * 1024);
+	else
+		set_filter();
+
+	if (stats_interval) {
+		signal(SIGINT, stats_stop);
+		signal(SIGTERM, stats_stop);
+	}
+
+	start = bench_time_ns();
 	pcap_loop(pcap, 0, recv_packet, NULL);
 	pcap_close(pcap);
 
+	if (file) {
+		double elapsed = (bench_time_ns() - start) / 1000000000.0;
+
+		fprintf(stderr, "Read %llu packets (%.1f MB) in %.3f s, %llu messages, %llu fragments, %llu skipped\n",
+			(unsigned long long) capture.packets, capture.bytes / 1000000.0,
+			elapsed, (unsigned long long) capture.msgs,
+			(unsigned long long) capture.fragments,
+			(unsigned long long) capture.skipped);
+		fflush(stderr);
+	}
+
+	if (stats_interval && stats_first)
+		stats_print(true);
+
+	if (bench_rounds)
+		bench_run();
+
 	return 0;
 }
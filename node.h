@@ -31,6 +31,12 @@ enum local_req_state {
 	__REQ_MAX
 };
 
+enum local_setup_req {
+	SETUP_NOTIFY_RESPONSE,
+	SETUP_BSS_MGMT_ENABLE,
+	__SETUP_MAX
+};
+
 struct usteer_local_node {
 	struct usteer_node node;
 
@@ -45,6 +51,26 @@ struct usteer_local_node {
 	struct uloop_timeout req_timer;
 	int req_state;
 
+	/* hostapd configuration requests issued on registration */
+	struct {
+		struct ubus_request req[__SETUP_MAX];
+		struct uloop_timeout timeout;
+		uint32_t pending;
+		bool ready;
+	} setup;
+
+	/* node_up_script invocation */
+	struct {
+		struct list_head list;
+		struct uloop_process proc;
+		struct uloop_timeout timeout;
+		bool rerun;
+		bool timed_out;
+		int status;
+		uint64_t start;
+		uint64_t end;
+	} script;
+
 	uint32_t obj_id;
 
 	float load_ewma;
@@ -72,10 +98,19 @@ struct interface;
 
 struct usteer_remote_host {
 	struct avl_node avl;
+	struct usteer_timeout timeout;
 
 	struct list_head nodes;
 	struct blob_attr *host_info;
 	char *addr;
+
+	/* ms without updates after which nodes of this host are removed */
+	int node_timeout;
+
+	struct {
+		uint32_t applied;
+		uint32_t skipped;
+	} updates;
 };
 
 struct usteer_remote_node {
@@ -86,12 +121,21 @@ struct usteer_remote_node {
 	struct usteer_remote_host *host;
 	struct usteer_node node;
 
-	int check;
+	struct usteer_timeout timeout;
+};
+
+struct usteer_remote_stats {
+	uint64_t rx;
+	uint64_t rx_invalid;
+	uint64_t tx;
+	uint64_t updates_applied;
+	uint64_t updates_skipped;
 };
 
 extern struct avl_tree local_nodes;
 extern struct list_head remote_nodes;
 extern struct avl_tree remote_hosts;
+extern struct usteer_remote_stats remote_stats;
 
 #define for_each_local_node(node)			\
 	avl_for_each_element(&local_nodes, node, avl)	\
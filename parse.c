@@ -20,139 +20,243 @@
 #include "usteer.h"
 #include "remote.h"
 
-bool parse_apmsg(struct apmsg *msg, struct blob_attr *data)
+/*
+ * The decoders below walk each record once and store the fields directly,
+ * pointing into the received datagram instead of copying. Attributes with
+ * an invalid payload are ignored, as blob_parse() would do.
+ */
+
+static bool
+attr_valid(struct blob_attr *cur, int type)
 {
-	static const struct blob_attr_info policy[__APMSG_MAX] = {
-		[APMSG_ID] = { .type = BLOB_ATTR_INT32 },
-		[APMSG_SEQ] = { .type = BLOB_ATTR_INT32 },
-		[APMSG_NODES] = { .type = BLOB_ATTR_NESTED },
-		[APMSG_HOST_INFO] = { .type = BLOB_ATTR_NESTED },
-	};
-	struct blob_attr *tb[__APMSG_MAX];
-
-	blob_parse(data, tb, policy, __APMSG_MAX);
-	if (!tb[APMSG_ID] || !tb[APMSG_SEQ] || !tb[APMSG_NODES])
-		return false;
+	return blob_check_type(blob_data(cur), blob_len(cur), type);
+}
 
-	msg->id = blob_get_int32(tb[APMSG_ID]);
-	msg->seq = blob_get_int32(tb[APMSG_SEQ]);
-	msg->nodes = tb[APMSG_NODES];
-	msg->host_info = tb[APMSG_HOST_INFO];
+static bool
+attr_get_int32(struct blob_attr *cur, int *val)
+{
+	if (!attr_valid(cur, BLOB_ATTR_INT32))
+		return false;
 
+	*val = blob_get_int32(cur);
 	return true;
 }
 
-static int
-get_int32(struct blob_attr *attr)
+bool parse_apmsg(struct apmsg *msg, struct blob_attr *data)
 {
-	if (!attr)
-		return 0;
+	struct blob_attr *cur;
+	unsigned int found = 0;
+	int rem;
+
+	memset(msg, 0, sizeof(*msg));
 
-	return blob_get_int32(attr);
+	blob_for_each_attr(cur, data, rem) {
+		unsigned int id = blob_id(cur);
+
+		switch (id) {
+		case APMSG_ID:
+			if (!attr_valid(cur, BLOB_ATTR_INT32))
+				continue;
+			msg->id = blob_get_int32(cur);
+			break;
+		case APMSG_SEQ:
+			if (!attr_valid(cur, BLOB_ATTR_INT32))
+				continue;
+			msg->seq = blob_get_int32(cur);
+			break;
+		case APMSG_NODES:
+			msg->nodes = cur;
+			break;
+		case APMSG_HOST_INFO:
+			msg->host_info = cur;
+			break;
+		case APMSG_INTEREST:
+			msg->interest = cur;
+			break;
+		case APMSG_SUMMARY:
+			if (!attr_valid(cur, BLOB_ATTR_INT8))
+				continue;
+			msg->summary = !!blob_get_int8(cur);
+			break;
+		case APMSG_INTEREST_TIMEOUT:
+			if (!attr_valid(cur, BLOB_ATTR_INT32))
+				continue;
+			msg->interest_timeout = blob_get_int32(cur);
+			break;
+		case APMSG_INTERVAL:
+			if (!attr_valid(cur, BLOB_ATTR_INT32))
+				continue;
+			msg->interval = blob_get_int32(cur);
+			break;
+		default:
+			continue;
+		}
+
+		found |= 1 << id;
+	}
+
+	return (found & APMSG_REQUIRED) == APMSG_REQUIRED;
 }
 
-bool parse_apmsg_node(struct apmsg_node *msg, struct blob_attr *data)
+static bool
+parse_rrm_nr(struct blob_attr *cur)
 {
-	static const struct blob_attr_info policy[__APMSG_NODE_MAX] = {
-		[APMSG_NODE_NAME] = { .type = BLOB_ATTR_STRING },
-		[APMSG_NODE_BSSID] = { .type = BLOB_ATTR_BINARY },
-		[APMSG_NODE_FREQ] = { .type = BLOB_ATTR_INT32 },
-		[APMSG_NODE_N_ASSOC] = { .type = BLOB_ATTR_INT32 },
-		[APMSG_NODE_MAX_ASSOC] = { .type = BLOB_ATTR_INT32 },
-		[APMSG_NODE_STATIONS] = { .type = BLOB_ATTR_NESTED },
-		[APMSG_NODE_NOISE] = { .type = BLOB_ATTR_INT32 },
-		[APMSG_NODE_LOAD] = { .type = BLOB_ATTR_INT32 },
-		[APMSG_NODE_RRM_NR] = { .type = BLOB_ATTR_NESTED },
-		[APMSG_NODE_NODE_INFO] = { .type = BLOB_ATTR_NESTED },
-		[APMSG_NODE_CHANNEL] = { .type = BLOB_ATTR_INT32 },
-		[APMSG_NODE_OP_CLASS] = { .type = BLOB_ATTR_INT32 },
-	};
-	struct blob_attr *tb[__APMSG_NODE_MAX];
-	struct blob_attr *cur;
+	struct blob_attr *rrm_nr;
+	int rem;
+
+	if (blob_len(cur) < sizeof(struct blob_attr) ||
+	    blob_len(cur) < blob_pad_len(blob_data(cur)))
+		return false;
 
-	blob_parse(data, tb, policy, __APMSG_NODE_MAX);
-	if (!tb[APMSG_NODE_NAME] ||
-	    !tb[APMSG_NODE_BSSID] ||
-	    blob_len(tb[APMSG_NODE_BSSID]) != 6 ||
-	    !tb[APMSG_NODE_FREQ] ||
-	    !tb[APMSG_NODE_N_ASSOC] ||
-	    !tb[APMSG_NODE_STATIONS] ||
-	    !tb[APMSG_NODE_SSID])
+	rrm_nr = blob_data(cur);
+	if (blobmsg_type(rrm_nr) != BLOBMSG_TYPE_ARRAY)
 		return false;
 
-	msg->name = blob_data(tb[APMSG_NODE_NAME]);
-	msg->n_assoc = blob_get_int32(tb[APMSG_NODE_N_ASSOC]);
-	msg->freq = blob_get_int32(tb[APMSG_NODE_FREQ]);
-	msg->stations = tb[APMSG_NODE_STATIONS];
-	msg->ssid = blob_data(tb[APMSG_NODE_SSID]);
-	msg->bssid = blob_data(tb[APMSG_NODE_BSSID]);
-
-	msg->noise = get_int32(tb[APMSG_NODE_NOISE]);
-	msg->load = get_int32(tb[APMSG_NODE_LOAD]);
-	msg->max_assoc = get_int32(tb[APMSG_NODE_MAX_ASSOC]);
-	msg->rrm_nr = NULL;
-
-	if (tb[APMSG_NODE_CHANNEL] && tb[APMSG_NODE_OP_CLASS]) {
-		msg->channel = blob_get_int32(tb[APMSG_NODE_CHANNEL]);
-		msg->op_class = blob_get_int32(tb[APMSG_NODE_OP_CLASS]);
+	blobmsg_for_each_attr(cur, rrm_nr, rem) {
+		if (blobmsg_check_attr(cur, false))
+			continue;
+		if (blobmsg_type(cur) == BLOBMSG_TYPE_STRING)
+			continue;
+		return false;
 	}
 
-	cur = tb[APMSG_NODE_RRM_NR];
-	if (cur && blob_len(cur) >= sizeof(struct blob_attr) &&
-	    blob_len(cur) >= blob_pad_len(blob_data(cur))) {
-		int rem;
+	return true;
+}
+
+bool parse_apmsg_node(struct apmsg_node *msg, struct blob_attr *data)
+{
+	struct blob_attr *cur;
+	int channel = 0, op_class = 0;
+	unsigned int found = 0;
+	int rem;
+
+	memset(msg, 0, sizeof(*msg));
 
-		msg->rrm_nr = blob_data(cur);
+	blob_for_each_attr(cur, data, rem) {
+		unsigned int id = blob_id(cur);
 
-		blobmsg_for_each_attr(cur, msg->rrm_nr, rem) {
-			if (blobmsg_check_attr(cur, false))
+		switch (id) {
+		case APMSG_NODE_NAME:
+			if (!attr_valid(cur, BLOB_ATTR_STRING))
 				continue;
-			if (blobmsg_type(cur) == BLOBMSG_TYPE_STRING)
+			msg->name = blob_data(cur);
+			break;
+		case APMSG_NODE_SSID:
+			if (!attr_valid(cur, BLOB_ATTR_STRING))
 				continue;
-			msg->rrm_nr = NULL;
+			msg->ssid = blob_data(cur);
+			msg->ssid_len = strnlen(msg->ssid, blob_len(cur));
 			break;
+		case APMSG_NODE_BSSID:
+			if (blob_len(cur) != 6)
+				continue;
+			msg->bssid = blob_data(cur);
+			break;
+		case APMSG_NODE_STATIONS:
+			msg->stations = cur;
+			break;
+		case APMSG_NODE_NODE_INFO:
+			msg->node_info = cur;
+			break;
+		case APMSG_NODE_RRM_NR:
+			if (!parse_rrm_nr(cur))
+				continue;
+			msg->rrm_nr = blob_data(cur);
+			break;
+		case APMSG_NODE_FREQ:
+			if (!attr_get_int32(cur, &msg->freq))
+				continue;
+			break;
+		case APMSG_NODE_N_ASSOC:
+			if (!attr_get_int32(cur, &msg->n_assoc))
+				continue;
+			break;
+		case APMSG_NODE_MAX_ASSOC:
+			if (!attr_get_int32(cur, &msg->max_assoc))
+				continue;
+			break;
+		case APMSG_NODE_NOISE:
+			if (!attr_get_int32(cur, &msg->noise))
+				continue;
+			break;
+		case APMSG_NODE_LOAD:
+			if (!attr_get_int32(cur, &msg->load))
+				continue;
+			break;
+		case APMSG_NODE_CHANNEL:
+			if (!attr_get_int32(cur, &channel))
+				continue;
+			break;
+		case APMSG_NODE_OP_CLASS:
+			if (!attr_get_int32(cur, &op_class))
+				continue;
+			break;
+		case APMSG_NODE_ORIGIN:
+			if (!attr_valid(cur, BLOB_ATTR_INT32))
+				continue;
+			msg->origin = blob_get_int32(cur);
+			break;
+		default:
+			continue;
 		}
 
-		if (msg->rrm_nr &&
-		    blobmsg_type(msg->rrm_nr) != BLOBMSG_TYPE_ARRAY)
-			msg->rrm_nr = NULL;
+		found |= 1 << id;
 	}
 
-	msg->node_info = tb[APMSG_NODE_NODE_INFO];
+	if ((found & APMSG_NODE_REQUIRED) != APMSG_NODE_REQUIRED)
+		return false;
+
+	if ((found & (1 << APMSG_NODE_CHANNEL)) &&
+	    (found & (1 << APMSG_NODE_OP_CLASS))) {
+		msg->channel = channel;
+		msg->op_class = op_class;
+	}
 
 	return true;
 }
 
 bool parse_apmsg_sta(struct apmsg_sta *msg, struct blob_attr *data)
 {
-	static const struct blob_attr_info policy[__APMSG_STA_MAX] = {
-		[APMSG_STA_ADDR] = { .type = BLOB_ATTR_BINARY },
-		[APMSG_STA_SIGNAL] = { .type = BLOB_ATTR_INT32 },
-		[APMSG_STA_SEEN] = { .type = BLOB_ATTR_INT32 },
-		[APMSG_STA_TIMEOUT] = { .type = BLOB_ATTR_INT32 },
-		[APMSG_STA_CONNECTED] = { .type = BLOB_ATTR_INT8 },
-		[APMSG_STA_LAST_CONNECTED] = { .type = BLOB_ATTR_INT32 },
-	};
-	struct blob_attr *tb[__APMSG_STA_MAX];
-
-	blob_parse(data, tb, policy, __APMSG_STA_MAX);
-	if (!tb[APMSG_STA_ADDR] ||
-	    !tb[APMSG_STA_SIGNAL] ||
-	    !tb[APMSG_STA_SEEN] ||
-	    !tb[APMSG_STA_TIMEOUT] ||
-	    !tb[APMSG_STA_CONNECTED] ||
-	    !tb[APMSG_STA_LAST_CONNECTED])
-		return false;
+	struct blob_attr *cur;
+	unsigned int found = 0;
+	int rem;
 
-	if (blob_len(tb[APMSG_STA_ADDR]) != sizeof(msg->addr))
-		return false;
+	blob_for_each_attr(cur, data, rem) {
+		unsigned int id = blob_id(cur);
 
-	memcpy(msg->addr, blob_data(tb[APMSG_STA_ADDR]), sizeof(msg->addr));
-	msg->signal = blob_get_int32(tb[APMSG_STA_SIGNAL]);
-	msg->seen = blob_get_int32(tb[APMSG_STA_SEEN]);
-	msg->timeout = blob_get_int32(tb[APMSG_STA_TIMEOUT]);
-	msg->connected = blob_get_int8(tb[APMSG_STA_CONNECTED]);
-	msg->last_connected = blob_get_int32(tb[APMSG_STA_LAST_CONNECTED]);
+		switch (id) {
+		case APMSG_STA_ADDR:
+			if (blob_len(cur) != sizeof(msg->addr))
+				return false;
+			memcpy(msg->addr, blob_data(cur), sizeof(msg->addr));
+			break;
+		case APMSG_STA_CONNECTED:
+			if (!attr_valid(cur, BLOB_ATTR_INT8))
+				continue;
+			msg->connected = blob_get_int8(cur);
+			break;
+		case APMSG_STA_SIGNAL:
+			if (!attr_get_int32(cur, &msg->signal))
+				continue;
+			break;
+		case APMSG_STA_SEEN:
+			if (!attr_get_int32(cur, &msg->seen))
+				continue;
+			break;
+		case APMSG_STA_TIMEOUT:
+			if (!attr_get_int32(cur, &msg->timeout))
+				continue;
+			break;
+		case APMSG_STA_LAST_CONNECTED:
+			if (!attr_get_int32(cur, &msg->last_connected))
+				continue;
+			break;
+		default:
+			continue;
+		}
 
-	return true;
+		found |= 1 << id;
+	}
+
+	return (found & APMSG_STA_REQUIRED) == APMSG_STA_REQUIRED;
 }
@@ -42,7 +42,7 @@ below_assoc_threshold(struct sta_info *si_cur, struct sta_info *si_new)
 static bool
 better_signal_strength(struct sta_info *si_cur, struct sta_info *si_new)
 {
-	const bool is_better = si_new->signal - si_cur->signal
+	const bool is_better = usteer_sta_info_signal(si_new) - usteer_sta_info_signal(si_cur)
 				> (int) config.signal_diff_threshold;
 
 	if (!config.signal_diff_threshold)
@@ -75,10 +75,12 @@ below_max_assoc(struct sta_info *si)
 static bool
 over_min_signal(struct sta_info *si)
 {
-	if (config.min_snr && si->signal < usteer_snr_to_signal(si->node, config.min_snr))
+	int signal = usteer_sta_info_signal(si);
+
+	if (config.min_snr && signal < usteer_snr_to_signal(si->node, config.min_snr))
 		return false;
 
-	if (config.roam_trigger_snr && si->signal < usteer_snr_to_signal(si->node, config.roam_trigger_snr))
+	if (config.roam_trigger_snr && signal < usteer_snr_to_signal(si->node, config.roam_trigger_snr))
 		return false;
 
 	return true;
@@ -109,6 +111,18 @@ is_better_candidate(struct sta_info *si_cur, struct sta_info *si_new)
 	return reasons;
 }
 
+/* Time since the last probe or beacon report for this node */
+static uint64_t
+candidate_age(struct sta_info *si)
+{
+	uint64_t last = si->seen;
+
+	if (si->est.time > last)
+		last = si->est.time;
+
+	return current_time - last;
+}
+
 static struct sta_info *
 find_better_candidate(struct sta_info *si_ref, struct uevent *ev, uint32_t required_criteria, uint64_t max_age)
 {
@@ -120,13 +134,13 @@ find_better_candidate(struct sta_info *si_ref, struct uevent *ev, uint32_t requi
 		if (si == si_ref)
 			continue;
 
-		if (current_time - si->seen > config.seen_policy_timeout)
+		if (candidate_age(si) > config.seen_policy_timeout)
 			continue;
 
 		if (strcmp(si->node->ssid, si_ref->node->ssid) != 0)
 			continue;
 
-		if (max_age && max_age < current_time - si->seen)
+		if (max_age && max_age < candidate_age(si))
 			continue;
 
 		reasons = is_better_candidate(si_ref, si);
@@ -280,6 +294,7 @@ usteer_roam_set_state(struct sta_info *si, enum roam_trigger_state state,
 		si->roam_tries++;
 	} else {
 		si->roam_tries = 0;
+		si->node->roam_sm_count[state]++;
 	}
 
 	si->roam_state = state;
@@ -322,8 +337,9 @@ usteer_roam_sm_found_better_node(struct sta_info *si, struct uevent *ev, enum ro
 	return false;
 }
 
+/* signal and scan_signal are the values that triggered roaming */
 static bool
-usteer_roam_trigger_sm(struct sta_info *si)
+usteer_roam_trigger_sm(struct sta_info *si, int signal, int scan_signal)
 {
 	struct uevent ev = {
 		.si_cur = si,
@@ -359,8 +375,8 @@ usteer_roam_trigger_sm(struct sta_info *si)
 			break;
 		}
 
-		/* Send beacon-request to client */
-		usteer_ubus_trigger_client_scan(si);
+		/* Queue a beacon-request, the weakest clients are served first */
+		usteer_scan_request(si, 100 + scan_signal - signal);
 		usteer_roam_sm_start_scan(si, &ev);
 		break;
 
@@ -377,7 +393,7 @@ usteer_roam_trigger_sm(struct sta_info *si)
 		break;
 
 	case ROAM_TRIGGER_WAIT_KICK:
-		if (si->signal > min_signal)
+		if (usteer_sta_info_signal_predict(si, config.roam_predict_time) > min_signal)
 			break;
 
 		usteer_roam_set_state(si, ROAM_TRIGGER_NOTIFY_KICK, &ev);
@@ -402,7 +418,7 @@ static void
 usteer_local_node_roam_check(struct usteer_local_node *ln, struct uevent *ev)
 {
 	struct sta_info *si;
-	int min_signal;
+	int min_signal, signal;
 
 	if (config.roam_scan_snr)
 		min_signal = config.roam_scan_snr;
@@ -415,7 +431,8 @@ usteer_local_node_roam_check(struct usteer_local_node *ln, struct uevent *ev)
 	min_signal = usteer_snr_to_signal(&ln->node, min_signal);
 
 	list_for_each_entry(si, &ln->node.sta_info, node_list) {
-		if (si->connected != STA_CONNECTED || si->signal >= min_signal ||
+		signal = usteer_sta_info_signal_predict(si, config.roam_predict_time);
+		if (si->connected != STA_CONNECTED || signal >= min_signal ||
 		    current_time - si->roam_kick < config.roam_trigger_interval) {
 			usteer_roam_set_state(si, ROAM_TRIGGER_IDLE, ev);
 			continue;
@@ -425,7 +442,7 @@ usteer_local_node_roam_check(struct usteer_local_node *ln, struct uevent *ev)
 		 * If the state machine kicked a client, other clients should wait
 		 * until the next turn
 		 */
-		if (usteer_roam_trigger_sm(si))
+		if (usteer_roam_trigger_sm(si, signal, min_signal))
 			return;
 	}
 }
@@ -0,0 +1,53 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+
+#ifndef __USTEER_RAND_H
+#define __USTEER_RAND_H
+
+#include <stdint.h>
+
+/*
+ * Random numbers for the simulation and test tools. xorshift64*, so that
+ * runs with the same seed are reproducible. The state must not be 0.
+ */
+static inline uint32_t rand_u32(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+
+	return (*state * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+static inline int rand_range(uint64_t *state, int min, int max)
+{
+	if (max <= min)
+		return min;
+
+	return min + rand_u32(state) % (max - min + 1);
+}
+
+static inline void rand_bytes(uint64_t *state, uint8_t *buf, int len)
+{
+	while (len--)
+		*(buf++) = rand_u32(state);
+}
+
+#endif
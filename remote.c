@@ -25,33 +25,90 @@
 #include <net/if.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 
 #include <libubox/vlist.h>
 #include <libubox/avl-cmp.h>
 #include <libubox/usock.h>
+#include <libubox/ustream.h>
 #include "usteer.h"
 #include "remote.h"
 #include "node.h"
+#include "ingest.h"
 
 static uint32_t local_id;
 static struct uloop_fd remote_fd;
+static struct uloop_fd remote_stream_fd;
 static struct uloop_timeout remote_timer;
+static struct usteer_timeout_queue remote_node_tq;
+static struct usteer_timeout_queue remote_host_tq;
 static struct uloop_timeout reload_timer;
 
+static uint32_t remote_interval;
+static uint64_t remote_last_update;
+static bool remote_update_pending;
+
+static bool remote_interest_changed = true;
+static uint64_t remote_interest_sent;
+
+static uint64_t aggregator_seen;
+static int aggregator_timeout;
+static int summary_nodes;
+
 static struct blob_buf buf;
 static uint32_t msg_seq;
 
+#define PEER_RECONNECT_INTERVAL		5000
+#define PEER_STREAM_MAX_PENDING		(4 * APMGR_BUFLEN)
+
+/* limit for the update interval announced by a sender, in local intervals */
+#define REMOTE_INTERVAL_MAX_FACTOR	8
+
 struct interface {
 	struct vlist_node node;
 	int ifindex;
 };
 
+union peer_addr {
+	struct sockaddr sa;
+	struct sockaddr_in in;
+	struct sockaddr_in6 in6;
+};
+
+/* Unicast peer, updates are sent to it directly instead of being broadcast */
+struct peer {
+	struct vlist_node node;
+
+	union peer_addr addr;
+	socklen_t addr_len;
+
+	/* Outgoing stream connection, used if config.peer_stream is set */
+	struct ustream_fd stream;
+	struct uloop_timeout reconnect;
+	bool stream_active;
+};
+
+/* Incoming stream connection from a peer */
+struct peer_conn {
+	struct list_head list;
+	struct ustream_fd stream;
+	char addr[INET6_ADDRSTRLEN];
+
+	int buf_len;
+	char buf[APMGR_BUFLEN];
+};
+
 static void
 interfaces_update_cb(struct vlist_tree *tree,
 		     struct vlist_node *node_new,
 		     struct vlist_node *node_old);
 
+static void
+peers_update_cb(struct vlist_tree *tree,
+		struct vlist_node *node_new,
+		struct vlist_node *node_old);
+
 static int remote_host_cmp(const void *k1, const void *k2, void *ptr)
 {
 	unsigned long v1 = (unsigned long) k1;
@@ -61,8 +118,11 @@ static int remote_host_cmp(const void *k1, const void *k2, void *ptr)
 }
 
 static VLIST_TREE(interfaces, avl_strcmp, interfaces_update_cb, true, true);
+static VLIST_TREE(peers, avl_strcmp, peers_update_cb, true, true);
+static LIST_HEAD(peer_conns);
 LIST_HEAD(remote_nodes);
 AVL_TREE(remote_hosts, remote_host_cmp, false, NULL);
+struct usteer_remote_stats remote_stats;
 
 static const char *
 interface_name(struct interface *iface)
@@ -183,6 +243,7 @@ interface_add_station(struct usteer_remote_node *node, struct blob_attr *data)
 	si->connected = msg.connected;
 	si->signal = msg.signal;
 	si->seen = current_time - msg.seen;
+	usteer_sta_info_update_estimate(si, si->signal, si->seen);
 	si->last_connected = current_time - msg.last_connected;
 
 	/* Check if client roamed to this foreign node */
@@ -202,27 +263,160 @@ interface_add_station(struct usteer_remote_node *node, struct blob_attr *data)
 	usteer_sta_info_update_timeout(si, msg.timeout);
 }
 
+/*
+ * Compare peer state against the cached copy, so that unchanged node
+ * headers and blobs are not copied again. A length mismatch is detected
+ * without looking at the data.
+ */
+static bool
+remote_blob_changed(struct blob_attr *cur, struct blob_attr *val)
+{
+	if (!cur || !val)
+		return cur != val;
+
+	return blob_pad_len(cur) != blob_pad_len(val) ||
+	       memcmp(cur, val, blob_pad_len(val)) != 0;
+}
+
+static int
+remote_ssid_len(struct usteer_node *node, struct apmsg_node *msg)
+{
+	if (msg->ssid_len > sizeof(node->ssid) - 1)
+		return sizeof(node->ssid) - 1;
+
+	return msg->ssid_len;
+}
+
+static bool
+remote_node_header_changed(struct usteer_node *node, struct apmsg_node *msg)
+{
+	int len = remote_ssid_len(node, msg);
+
+	return node->freq != msg->freq ||
+	       node->channel != msg->channel ||
+	       node->op_class != msg->op_class ||
+	       node->n_assoc != msg->n_assoc ||
+	       node->max_assoc != msg->max_assoc ||
+	       node->noise != msg->noise ||
+	       node->load != msg->load ||
+	       memcmp(node->bssid, msg->bssid, sizeof(node->bssid)) != 0 ||
+	       strlen(node->ssid) != len ||
+	       memcmp(node->ssid, msg->ssid, len) != 0;
+}
+
+static uint32_t
+usteer_remote_interval_min(void)
+{
+	if (config.remote_update_interval_min)
+		return config.remote_update_interval_min;
+
+	return config.remote_update_interval;
+}
+
+static uint32_t
+usteer_remote_interval_max(void)
+{
+	uint32_t min = usteer_remote_interval_min();
+
+	if (config.remote_update_interval_max > min)
+		return config.remote_update_interval_max;
+
+	return min;
+}
+
+/* Time (ms) after which a silent remote node or host is removed */
+static int
+usteer_remote_node_timeout(void)
+{
+	return config.remote_node_timeout * usteer_remote_interval_max();
+}
+
+/*
+ * Senders announce their longest update interval, so that hosts backing
+ * off further than the local configuration allows do not time out
+ */
+static int
+usteer_remote_host_timeout(struct apmsg *msg)
+{
+	uint64_t interval = msg->interval;
+	uint64_t max = (uint64_t) REMOTE_INTERVAL_MAX_FACTOR *
+		       usteer_remote_interval_max();
+	uint64_t timeout;
+
+	if (!interval)
+		return usteer_remote_node_timeout();
+
+	if (interval > max)
+		interval = max;
+
+	timeout = config.remote_node_timeout * interval;
+	if (timeout > INT_MAX)
+		return INT_MAX;
+
+	return timeout;
+}
+
 static void
 remote_node_free(struct usteer_remote_node *node)
 {
-	struct usteer_remote_host *host = node->host;
-
+	usteer_timeout_cancel(&remote_node_tq, &node->timeout);
 	list_del(&node->list);
 	list_del(&node->host_list);
 	usteer_sta_node_cleanup(&node->node);
 	usteer_measurement_report_node_cleanup(&node->node);
 	free(node);
+}
 
-	if (!list_empty(&host->nodes))
-		return;
+static void
+remote_host_free(struct usteer_remote_host *host)
+{
+	struct usteer_remote_node *node, *tmp;
+
+	list_for_each_entry_safe(node, tmp, &host->nodes, host_list)
+		remote_node_free(node);
 
+	usteer_timeout_cancel(&remote_host_tq, &host->timeout);
 	avl_delete(&remote_hosts, &host->avl);
+	free(host->host_info);
 	free(host->addr);
 	free(host);
 }
 
+static void
+remote_node_timeout_cb(struct usteer_timeout_queue *q, struct usteer_timeout *t)
+{
+	struct usteer_remote_node *node = container_of(t, struct usteer_remote_node, timeout);
+
+	MSG(VERBOSE, "Remote node %s timed out\n", usteer_node_name(&node->node));
+	remote_node_free(node);
+}
+
+static void
+remote_host_timeout_cb(struct usteer_timeout_queue *q, struct usteer_timeout *t)
+{
+	struct usteer_remote_host *host = container_of(t, struct usteer_remote_host, timeout);
+
+	MSG(VERBOSE, "Remote host %s timed out\n", host->addr);
+	remote_host_free(host);
+}
+
+static void
+interface_add_interest(struct blob_attr *data, uint32_t timeout)
+{
+	struct sta *sta;
+
+	if (blob_len(data) != sizeof(sta->addr))
+		return;
+
+	sta = usteer_sta_get(blob_data(data), false);
+	if (!sta)
+		return;
+
+	sta->remote_interest = current_time + timeout;
+}
+
 static struct usteer_remote_host *
-interface_get_host(const char *addr, unsigned long id)
+interface_get_host(const char *addr, unsigned long id, int timeout)
 {
 	struct usteer_remote_host *host;
 
@@ -236,6 +430,9 @@ interface_get_host(const char *addr, unsigned long id)
 	avl_insert(&remote_hosts, &host->avl);
 
 out:
+	host->node_timeout = timeout;
+	usteer_timeout_set(&remote_host_tq, &host->timeout, timeout);
+
 	if (host->addr && !strcmp(host->addr, addr))
 		return host;
 
@@ -270,6 +467,8 @@ interface_get_node(struct usteer_remote_host *host, const char *name)
 	list_add_tail(&node->list, &remote_nodes);
 	list_add_tail(&node->host_list, &host->nodes);
 
+	usteer_snapshot_node_added(&node->node);
+
 	return node;
 }
 
@@ -279,35 +478,62 @@ interface_add_node(struct usteer_remote_host *host, struct blob_attr *data)
 	struct usteer_remote_node *node;
 	struct apmsg_node msg;
 	struct blob_attr *cur;
-	int rem;
+	bool changed = false;
+	int rem, len;
 
 	if (!parse_apmsg_node(&msg, data)) {
 		MSG(DEBUG, "Cannot parse node in message\n");
 		return;
 	}
 
+	/* Our own nodes, re-published by an aggregator */
+	if (msg.origin && msg.origin == local_id)
+		return;
+
 	node = interface_get_node(host, msg.name);
-	node->check = 0;
-	node->node.freq = msg.freq;
-	node->node.channel = msg.channel;
-	node->node.op_class = msg.op_class;
-	node->node.n_assoc = msg.n_assoc;
-	node->node.max_assoc = msg.max_assoc;
-	node->node.noise = msg.noise;
-	node->node.load = msg.load;
+	usteer_timeout_set(&remote_node_tq, &node->timeout, host->node_timeout);
+
+	if (remote_node_header_changed(&node->node, &msg)) {
+		node->node.freq = msg.freq;
+		node->node.channel = msg.channel;
+		node->node.op_class = msg.op_class;
+		node->node.n_assoc = msg.n_assoc;
+		node->node.max_assoc = msg.max_assoc;
+		node->node.noise = msg.noise;
+		node->node.load = msg.load;
+
+		memcpy(node->node.bssid, msg.bssid, sizeof(node->node.bssid));
+
+		len = remote_ssid_len(&node->node, &msg);
+		memcpy(node->node.ssid, msg.ssid, len);
+		node->node.ssid[len] = 0;
+		changed = true;
+	}
 
-	memcpy(node->node.bssid, msg.bssid, sizeof(node->node.bssid));
+	if (remote_blob_changed(node->node.rrm_nr, msg.rrm_nr)) {
+		usteer_node_set_blob(&node->node.rrm_nr, msg.rrm_nr);
+		changed = true;
+	}
+
+	if (remote_blob_changed(node->node.node_info, msg.node_info)) {
+		usteer_node_set_blob(&node->node.node_info, msg.node_info);
+		changed = true;
+	}
 
-	snprintf(node->node.ssid, sizeof(node->node.ssid), "%s", msg.ssid);
-	usteer_node_set_blob(&node->node.rrm_nr, msg.rrm_nr);
-	usteer_node_set_blob(&node->node.node_info, msg.node_info);
+	if (changed) {
+		host->updates.applied++;
+		remote_stats.updates_applied++;
+	} else {
+		host->updates.skipped++;
+		remote_stats.updates_skipped++;
+	}
 
 	blob_for_each_attr(cur, msg.stations, rem)
 		interface_add_station(node, cur);
 }
 
 static void
-interface_recv_msg(struct interface *iface, char *addr_str, void *buf, int len)
+interface_recv_msg(const char *src, char *addr_str, void *buf, int len)
 {
 	struct usteer_remote_host *host;
 	struct blob_attr *data = buf;
@@ -315,24 +541,45 @@ interface_recv_msg(struct interface *iface, char *addr_str, void *buf, int len)
 	struct blob_attr *cur;
 	int rem;
 
+	remote_stats.rx++;
 	if (blob_pad_len(data) != len) {
 		MSG(DEBUG, "Invalid message length (header: %d, real: %d)\n", blob_pad_len(data), len);
+		remote_stats.rx_invalid++;
 		return;
 	}
 
 	if (!parse_apmsg(&msg, data)) {
 		MSG(DEBUG, "Missing fields in message\n");
+		remote_stats.rx_invalid++;
 		return;
 	}
 
 	if (msg.id == local_id)
 		return;
 
+	if (msg.summary && config.aggregator && msg.id < local_id) {
+		aggregator_seen = current_time;
+		aggregator_timeout = usteer_remote_host_timeout(&msg);
+	}
+
+	/* Instances in summary_only mode only process aggregated state, all
+	 * other instances ignore it in favor of the raw updates. */
+	if (config.aggregator ? msg.summary : msg.summary != config.summary_only)
+		return;
+
 	MSG(NETWORK, "Received message on %s (id=%08x->%08x seq=%d len=%d)\n",
-		interface_name(iface), msg.id, local_id, msg.seq, len);
+		src, msg.id, local_id, msg.seq, len);
+
+	host = interface_get_host(addr_str, msg.id, usteer_remote_host_timeout(&msg));
+	if (remote_blob_changed(host->host_info, msg.host_info))
+		usteer_node_set_blob(&host->host_info, msg.host_info);
 
-	host = interface_get_host(addr_str, msg.id);
-	usteer_node_set_blob(&host->host_info, msg.host_info);
+	/* Peers without APMSG_INTEREST_TIMEOUT resend their interest with every update */
+	if (!msg.interest_timeout)
+		msg.interest_timeout = host->node_timeout;
+
+	blob_for_each_attr(cur, msg.interest, rem)
+		interface_add_interest(cur, msg.interest_timeout);
 
 	blob_for_each_attr(cur, msg.nodes, rem)
 		interface_add_node(host, cur);
@@ -351,20 +598,23 @@ interface_find_by_ifindex(int index)
 	return NULL;
 }
 
-static void
-interface_recv_v4(struct uloop_fd *u, unsigned int events)
+/*
+ * Receive a single datagram along with its source address and the index of
+ * the receiving interface (-1 if unknown). Returns 0 for datagrams that
+ * should be ignored. Safe to call from the ingest thread.
+ */
+static int
+remote_recvmsg(int fd, void *data, int data_len, char *addr_str, int *ifindex)
 {
-	static char buf[APMGR_BUFLEN];
-	static char cmsg_buf[( CMSG_SPACE(sizeof(struct in_pktinfo)) + sizeof(int)) + 1];
-	static struct sockaddr_in sin;
-	char addr_str[INET_ADDRSTRLEN];
-	static struct iovec iov = {
-		.iov_base = buf,
-		.iov_len = sizeof(buf)
+	char cmsg_buf[CMSG_SPACE(sizeof(struct in6_pktinfo)) + sizeof(int) + 1];
+	union peer_addr sa;
+	struct iovec iov = {
+		.iov_base = data,
+		.iov_len = data_len,
 	};
-	static struct msghdr msg = {
-		.msg_name = &sin,
-		.msg_namelen = sizeof(sin),
+	struct msghdr msg = {
+		.msg_name = &sa,
+		.msg_namelen = sizeof(sa),
 		.msg_iov = &iov,
 		.msg_iovlen = 1,
 		.msg_control = cmsg_buf,
@@ -373,74 +623,74 @@ interface_recv_v4(struct uloop_fd *u, unsigned int events)
 	struct cmsghdr *cmsg;
 	int len;
 
-	do {
-		struct in_pktinfo *pkti = NULL;
-		struct interface *iface;
+	len = recvmsg(fd, &msg, 0);
+	if (len < 0)
+		return -1;
 
-		len = recvmsg(u->fd, &msg, 0);
-		if (len < 0) {
-			switch (errno) {
-			case EAGAIN:
-				return;
-			case EINTR:
-				continue;
-			default:
-				perror("recvmsg");
-				uloop_fd_delete(u);
-				return;
-			}
-		}
+	*ifindex = -1;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == IPPROTO_IP &&
+		    cmsg->cmsg_type == IP_PKTINFO)
+			*ifindex = ((struct in_pktinfo *) CMSG_DATA(cmsg))->ipi_ifindex;
+		else if (cmsg->cmsg_level == IPPROTO_IPV6 &&
+			 cmsg->cmsg_type == IPV6_PKTINFO)
+			*ifindex = ((struct in6_pktinfo *) CMSG_DATA(cmsg))->ipi6_ifindex;
+	}
 
-		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-			if (cmsg->cmsg_type != IP_PKTINFO)
-				continue;
+	switch (sa.sa.sa_family) {
+	case AF_INET:
+		inet_ntop(AF_INET, &sa.in.sin_addr, addr_str, INET6_ADDRSTRLEN);
+		break;
+	case AF_INET6:
+		/* IPv4 mapped address. Ignore. */
+		if (sa.in6.sin6_addr.s6_addr[0] == 0)
+			return 0;
+
+		inet_ntop(AF_INET6, &sa.in6.sin6_addr, addr_str, INET6_ADDRSTRLEN);
+		break;
+	default:
+		return 0;
+	}
 
-			pkti = (struct in_pktinfo *) CMSG_DATA(cmsg);
-		}
+	return len;
+}
 
-		if (!pkti) {
-			MSG(DEBUG, "Received packet without ifindex\n");
-			continue;
-		}
+static void
+interface_recv_dispatch(int ifindex, char *addr_str, void *data, int len)
+{
+	struct interface *iface;
+	struct peer *peer;
 
-		iface = interface_find_by_ifindex(pkti->ipi_ifindex);
-		if (!iface) {
-			MSG(DEBUG, "Received packet from unconfigured interface %d\n", pkti->ipi_ifindex);
-			continue;
-		}
+	if (ifindex < 0) {
+		MSG(DEBUG, "Received packet without ifindex\n");
+		return;
+	}
 
-		inet_ntop(AF_INET, &sin.sin_addr, addr_str, sizeof(addr_str));
+	iface = interface_find_by_ifindex(ifindex);
+	if (iface) {
+		interface_recv_msg(interface_name(iface), addr_str, data, len);
+		return;
+	}
 
-		interface_recv_msg(iface, addr_str, buf, len);
-	} while (1);
-}
+	peer = vlist_find(&peers, addr_str, peer, node);
+	if (!peer) {
+		MSG(DEBUG, "Received packet from unconfigured interface %d\n", ifindex);
+		return;
+	}
 
+	interface_recv_msg("peer", addr_str, data, len);
+}
 
-static void interface_recv_v6(struct uloop_fd *u, unsigned int events){
+static void
+interface_recv(struct uloop_fd *u, unsigned int events)
+{
 	static char buf[APMGR_BUFLEN];
-	static char cmsg_buf[( CMSG_SPACE(sizeof(struct in6_pktinfo)) + sizeof(int)) + 1];
-	static struct sockaddr_in6 sin;
-	static struct iovec iov = {
-		.iov_base = buf,
-		.iov_len = sizeof(buf)
-	};
-	static struct msghdr msg = {
-		.msg_name = &sin,
-		.msg_namelen = sizeof(sin),
-		.msg_iov = &iov,
-		.msg_iovlen = 1,
-		.msg_control = cmsg_buf,
-		.msg_controllen = sizeof(cmsg_buf),
-	};
-	struct cmsghdr *cmsg;
 	char addr_str[INET6_ADDRSTRLEN];
+	int ifindex;
 	int len;
 
 	do {
-		struct in6_pktinfo *pkti = NULL;
-		struct interface *iface;
-
-		len = recvmsg(u->fd, &msg, 0);
+		len = remote_recvmsg(u->fd, buf, sizeof(buf), addr_str, &ifindex);
 		if (len < 0) {
 			switch (errno) {
 			case EAGAIN:
@@ -454,34 +704,43 @@ static void interface_recv_v6(struct uloop_fd *u, unsigned int events){
 			}
 		}
 
-		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-			if (cmsg->cmsg_type != IPV6_PKTINFO)
-				continue;
+		if (!len)
+			continue;
 
-			pkti = (struct in6_pktinfo *) CMSG_DATA(cmsg);
-		}
+		interface_recv_dispatch(ifindex, addr_str, buf, len);
+	} while (1);
+}
 
-		if (!pkti) {
-			MSG(DEBUG, "Received packet without ifindex\n");
-			continue;
-		}
+static int
+interface_ingest_recv(int fd, struct usteer_ingest_msg *msg, int buf_len)
+{
+	struct blob_attr *data = (struct blob_attr *) msg->data;
+	struct apmsg apmsg;
+	int len;
 
-		iface = interface_find_by_ifindex(pkti->ipi6_ifindex);
-		if (!iface) {
-			MSG(DEBUG, "Received packet from unconfigured interface %d\n", pkti->ipi6_ifindex);
-			continue;
-		}
+	len = remote_recvmsg(fd, msg->data, buf_len, msg->addr, &msg->ifindex);
+	if (len <= 0)
+		return len;
 
-		inet_ntop(AF_INET6, &sin.sin6_addr, addr_str, sizeof(addr_str));
-		if (sin.sin6_addr.s6_addr[0] == 0) {
-			/* IPv4 mapped address. Ignore. */
-			continue;
-		}
+	/* Drop malformed messages and our own broadcasts on the ingest thread */
+	if (len < sizeof(*data) || blob_pad_len(data) != len ||
+	    !parse_apmsg(&apmsg, data) || apmsg.id == local_id)
+		return 0;
 
-		interface_recv_msg(iface, addr_str, buf, len);
-	} while (1);
+	return len;
+}
+
+static void
+interface_ingest_handle(struct usteer_ingest_msg *msg)
+{
+	interface_recv_dispatch(msg->ifindex, msg->addr, msg->data, msg->len);
 }
 
+static const struct usteer_ingest_ops ingest_ops = {
+	.recv = interface_ingest_recv,
+	.handle = interface_ingest_handle,
+};
+
 static void interface_send_msg_v4(struct interface *iface, struct blob_attr *data)
 {
 	static size_t cmsg_data[( CMSG_SPACE(sizeof(struct in_pktinfo)) / sizeof(size_t)) + 1];
@@ -540,6 +799,345 @@ static void interface_send_msg(struct interface *iface, struct blob_attr *data){
 	}
 }
 
+static int
+peer_family(void)
+{
+	return config.ipv6 ? AF_INET6 : AF_INET;
+}
+
+static const char *
+peer_name(struct peer *peer)
+{
+	return peer->node.avl.key;
+}
+
+static void
+peer_stream_close(struct peer *peer)
+{
+	if (!peer->stream_active)
+		return;
+
+	ustream_free(&peer->stream.stream);
+	close(peer->stream.fd.fd);
+	peer->stream_active = false;
+}
+
+static void
+peer_stream_state_cb(struct ustream *s)
+{
+	struct peer *peer = container_of(s, struct peer, stream.stream);
+
+	if (!s->eof && !s->write_error)
+		return;
+
+	MSG(INFO, "Stream connection to peer %s lost\n", peer_name(peer));
+	peer_stream_close(peer);
+	uloop_timeout_set(&peer->reconnect, PEER_RECONNECT_INTERVAL);
+}
+
+static void
+peer_stream_discard_cb(struct ustream *s, int bytes)
+{
+	/* Outgoing connections are only used for sending */
+	ustream_consume(s, bytes);
+}
+
+static void
+peer_stream_connect(struct uloop_timeout *t)
+{
+	struct peer *peer = container_of(t, struct peer, reconnect);
+	int type = USOCK_TCP | USOCK_NONBLOCK | USOCK_NUMERIC;
+	int fd;
+
+	if (!config.peer_stream || peer->stream_active ||
+	    peer->addr.sa.sa_family != peer_family())
+		return;
+
+	type |= config.ipv6 ? USOCK_IPV6ONLY : USOCK_IPV4ONLY;
+	fd = usock(type, peer_name(peer), APMGR_PORT_STR);
+	if (fd < 0) {
+		MSG(DEBUG, "Failed to connect to peer %s\n", peer_name(peer));
+		uloop_timeout_set(&peer->reconnect, PEER_RECONNECT_INTERVAL);
+		return;
+	}
+
+	memset(&peer->stream, 0, sizeof(peer->stream));
+	peer->stream.stream.notify_state = peer_stream_state_cb;
+	peer->stream.stream.notify_read = peer_stream_discard_cb;
+	ustream_fd_init(&peer->stream, fd);
+	peer->stream_active = true;
+}
+
+static void
+peer_init(struct peer *peer)
+{
+	peer->reconnect.cb = peer_stream_connect;
+	uloop_timeout_set(&peer->reconnect, 1);
+}
+
+static void
+peer_free(struct peer *peer)
+{
+	uloop_timeout_cancel(&peer->reconnect);
+	peer_stream_close(peer);
+	avl_delete(&peers.avl, &peer->node.avl);
+	free(peer);
+}
+
+static void
+peers_update_cb(struct vlist_tree *tree,
+		struct vlist_node *node_new,
+		struct vlist_node *node_old)
+{
+	struct peer *peer;
+
+	if (node_new && node_old) {
+		peer = container_of(node_new, struct peer, node);
+		free(peer);
+	} else if (node_old) {
+		peer = container_of(node_old, struct peer, node);
+		peer_free(peer);
+	} else {
+		peer = container_of(node_new, struct peer, node);
+		peer_init(peer);
+	}
+}
+
+static void
+usteer_peer_add(const char *name)
+{
+	char addr_str[INET6_ADDRSTRLEN];
+	union peer_addr addr = {};
+	socklen_t addr_len;
+	struct peer *peer;
+	char *name_buf;
+
+	if (inet_pton(AF_INET, name, &addr.in.sin_addr) == 1) {
+		addr.in.sin_family = AF_INET;
+		addr.in.sin_port = htons(APMGR_PORT);
+		addr_len = sizeof(addr.in);
+		inet_ntop(AF_INET, &addr.in.sin_addr, addr_str, sizeof(addr_str));
+	} else if (inet_pton(AF_INET6, name, &addr.in6.sin6_addr) == 1) {
+		addr.in6.sin6_family = AF_INET6;
+		addr.in6.sin6_port = htons(APMGR_PORT);
+		addr_len = sizeof(addr.in6);
+		inet_ntop(AF_INET6, &addr.in6.sin6_addr, addr_str, sizeof(addr_str));
+	} else {
+		MSG(INFO, "Invalid peer address %s\n", name);
+		return;
+	}
+
+	peer = calloc_a(sizeof(*peer), &name_buf, strlen(addr_str) + 1);
+	strcpy(name_buf, addr_str);
+	peer->addr = addr;
+	peer->addr_len = addr_len;
+	vlist_add(&peers, &peer->node, name_buf);
+}
+
+void config_set_peers(struct blob_attr *data)
+{
+	struct blob_attr *cur;
+	int rem;
+
+	if (!data)
+		return;
+
+	if (!blobmsg_check_attr_list(data, BLOBMSG_TYPE_STRING))
+		return;
+
+	vlist_update(&peers);
+	blobmsg_for_each_attr(cur, data, rem) {
+		usteer_peer_add(blobmsg_data(cur));
+	}
+	vlist_flush(&peers);
+}
+
+void config_get_peers(struct blob_buf *buf)
+{
+	struct peer *peer;
+	void *c;
+
+	c = blobmsg_open_array(buf, "peers");
+	vlist_for_each_element(&peers, peer, node) {
+		blobmsg_add_string(buf, NULL, peer_name(peer));
+	}
+	blobmsg_close_array(buf, c);
+}
+
+static void
+peer_conn_free(struct peer_conn *conn)
+{
+	list_del(&conn->list);
+	ustream_free(&conn->stream.stream);
+	close(conn->stream.fd.fd);
+	free(conn);
+}
+
+static void
+peer_conn_state_cb(struct ustream *s)
+{
+	struct peer_conn *conn = container_of(s, struct peer_conn, stream.stream);
+
+	if (!s->eof && !s->write_error)
+		return;
+
+	MSG(DEBUG, "Stream connection from peer %s closed\n", conn->addr);
+	peer_conn_free(conn);
+}
+
+/*
+ * Messages on a stream are framed by the length in the blob header.
+ * The connection must not be freed from here, as ustream still uses it
+ * afterwards; invalid streams are closed from peer_conn_state_cb.
+ */
+static void
+peer_conn_read_cb(struct ustream *s, int bytes)
+{
+	struct peer_conn *conn = container_of(s, struct peer_conn, stream.stream);
+	struct blob_attr *data = (struct blob_attr *) conn->buf;
+	int len, n;
+
+	if (s->eof)
+		return;
+
+	while (1) {
+		len = sizeof(*data);
+		if (conn->buf_len >= len)
+			len = blob_pad_len(data);
+
+		if (len < sizeof(*data) || len > sizeof(conn->buf)) {
+			MSG(DEBUG, "Invalid message length %d from peer %s\n", len, conn->addr);
+			s->eof = true;
+			ustream_state_change(s);
+			return;
+		}
+
+		if (conn->buf_len < len) {
+			n = ustream_read(s, conn->buf + conn->buf_len, len - conn->buf_len);
+			if (!n)
+				return;
+
+			conn->buf_len += n;
+			continue;
+		}
+
+		interface_recv_msg("stream", conn->addr, conn->buf, len);
+		conn->buf_len = 0;
+	}
+}
+
+static void
+peer_stream_accept(struct uloop_fd *u, unsigned int events)
+{
+	char addr_str[INET6_ADDRSTRLEN];
+	struct peer_conn *conn;
+	union peer_addr addr;
+	socklen_t addr_len;
+	struct peer *peer;
+	int fd;
+
+	while (1) {
+		addr_len = sizeof(addr);
+		fd = accept4(u->fd, &addr.sa, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return;
+		}
+
+		if (addr.sa.sa_family == AF_INET6)
+			inet_ntop(AF_INET6, &addr.in6.sin6_addr, addr_str, sizeof(addr_str));
+		else
+			inet_ntop(AF_INET, &addr.in.sin_addr, addr_str, sizeof(addr_str));
+
+		peer = vlist_find(&peers, addr_str, peer, node);
+		if (!peer) {
+			MSG(DEBUG, "Refusing stream connection from unconfigured peer %s\n", addr_str);
+			close(fd);
+			continue;
+		}
+
+		conn = calloc(1, sizeof(*conn));
+		if (!conn) {
+			close(fd);
+			continue;
+		}
+
+		strcpy(conn->addr, addr_str);
+		conn->stream.stream.notify_read = peer_conn_read_cb;
+		conn->stream.stream.notify_state = peer_conn_state_cb;
+		ustream_fd_init(&conn->stream, fd);
+		list_add_tail(&conn->list, &peer_conns);
+
+		MSG(DEBUG, "Accepted stream connection from peer %s\n", addr_str);
+	}
+}
+
+static void
+peer_stream_reload(void)
+{
+	struct peer_conn *conn, *tmp;
+	struct peer *peer;
+	int type = USOCK_TCP | USOCK_SERVER | USOCK_NONBLOCK | USOCK_NUMERIC;
+
+	if (remote_stream_fd.registered) {
+		uloop_fd_delete(&remote_stream_fd);
+		close(remote_stream_fd.fd);
+	}
+
+	list_for_each_entry_safe(conn, tmp, &peer_conns, list)
+		peer_conn_free(conn);
+
+	vlist_for_each_element(&peers, peer, node) {
+		peer_stream_close(peer);
+		uloop_timeout_set(&peer->reconnect, 1);
+	}
+
+	if (!config.peer_stream)
+		return;
+
+	if (config.ipv6)
+		remote_stream_fd.fd = usock(type | USOCK_IPV6ONLY, "::", APMGR_PORT_STR);
+	else
+		remote_stream_fd.fd = usock(type | USOCK_IPV4ONLY, "0.0.0.0", APMGR_PORT_STR);
+
+	if (remote_stream_fd.fd < 0) {
+		perror("usock");
+		return;
+	}
+
+	remote_stream_fd.cb = peer_stream_accept;
+	uloop_fd_add(&remote_stream_fd, ULOOP_READ);
+}
+
+static void peer_send_msg(struct peer *peer, struct blob_attr *data)
+{
+	struct ustream *s = &peer->stream.stream;
+	int len = blob_pad_len(data);
+
+	if (peer->addr.sa.sa_family != peer_family())
+		return;
+
+	if (!config.peer_stream) {
+		if (sendto(remote_fd.fd, data, len, 0, &peer->addr.sa, peer->addr_len) < 0)
+			perror("sendto");
+		return;
+	}
+
+	if (!peer->stream_active)
+		return;
+
+	/* State is resent periodically, drop updates to a stalled peer
+	 * instead of queueing them (or writing partial messages). */
+	if (ustream_pending_data(s, true) + len > PEER_STREAM_MAX_PENDING) {
+		MSG(DEBUG, "Dropping update for stalled peer %s\n", peer_name(peer));
+		return;
+	}
+
+	ustream_write(s, (const char *) data, len, false);
+}
+
 static void usteer_send_sta_info(struct sta_info *sta)
 {
 	int seen = current_time - sta->seen;
@@ -556,11 +1154,23 @@ static void usteer_send_sta_info(struct sta_info *sta)
 	blob_nest_end(&buf, c);
 }
 
-static void usteer_send_node(struct usteer_node *node, struct sta_info *sta)
+static bool usteer_sta_info_relevant(struct sta_info *si)
 {
-	void *c, *s, *r;
+	if (si->connected == STA_CONNECTED)
+		return true;
 
-	c = blob_nest_start(&buf, 0);
+	if (current_time - si->seen > config.seen_policy_timeout)
+		return false;
+
+	if (config.remote_sta_filter < REMOTE_STA_FILTER_INTEREST)
+		return true;
+
+	return si->sta->remote_interest > current_time;
+}
+
+static void usteer_send_node_info(struct usteer_node *node)
+{
+	void *r;
 
 	blob_put_string(&buf, APMSG_NODE_NAME, usteer_node_name(node));
 	blob_put_string(&buf, APMSG_NODE_SSID, node->ssid);
@@ -584,14 +1194,27 @@ static void usteer_send_node(struct usteer_node *node, struct sta_info *sta)
 		blob_put(&buf, APMSG_NODE_NODE_INFO,
 			 blob_data(node->node_info),
 			 blob_len(node->node_info));
+}
+
+static void usteer_send_node(struct usteer_node *node, struct sta_info *sta)
+{
+	void *c, *s;
+
+	c = blob_nest_start(&buf, 0);
+	usteer_send_node_info(node);
 
 	s = blob_nest_start(&buf, APMSG_NODE_STATIONS);
 
 	if (sta) {
 		usteer_send_sta_info(sta);
 	} else {
-		list_for_each_entry(sta, &node->sta_info, node_list)
+		list_for_each_entry(sta, &node->sta_info, node_list) {
+			if (config.remote_sta_filter != REMOTE_STA_FILTER_NONE &&
+			    !usteer_sta_info_relevant(sta))
+				continue;
+
 			usteer_send_sta_info(sta);
+		}
 	}
 
 	blob_nest_end(&buf, s);
@@ -599,29 +1222,61 @@ static void usteer_send_node(struct usteer_node *node, struct sta_info *sta)
 	blob_nest_end(&buf, c);
 }
 
+void usteer_remote_interest_changed(void)
+{
+	remote_interest_changed = true;
+}
+
+/*
+ * Report the stations tracked by local nodes, so peers can filter their
+ * updates. The list is only sent when it changed, and refreshed before
+ * peers expire it. Updates are broadcast to all peers, so a peer includes
+ * a station if any other host reported interest in it.
+ */
 static void
-usteer_check_timeout(void)
+usteer_send_interest(void)
 {
-	struct usteer_remote_node *node, *tmp;
-	int timeout = config.remote_node_timeout;
+	uint32_t timeout = usteer_remote_node_timeout();
+	struct sta_info *si;
+	struct sta *sta;
+	void *c;
+
+	if (!remote_interest_changed &&
+	    current_time - remote_interest_sent < timeout / 2)
+		return;
+
+	remote_interest_changed = false;
+	remote_interest_sent = current_time;
 
-	list_for_each_entry_safe(node, tmp, &remote_nodes, list) {
-		if (node->check++ > timeout)
-			remote_node_free(node);
+	blob_put_int32(&buf, APMSG_INTEREST_TIMEOUT, timeout);
+	c = blob_nest_start(&buf, APMSG_INTEREST);
+	avl_for_each_element(&stations, sta, avl) {
+		list_for_each_entry(si, &sta->nodes, list) {
+			if (si->node->type != NODE_TYPE_LOCAL)
+				continue;
+
+			blob_put(&buf, 0, sta->addr, sizeof(sta->addr));
+			break;
+		}
 	}
+	blob_nest_end(&buf, c);
 }
 
 static void *
-usteer_update_init(void)
+usteer_update_init(bool interest)
 {
 	blob_buf_init(&buf, 0);
 	blob_put_int32(&buf, APMSG_ID, local_id);
 	blob_put_int32(&buf, APMSG_SEQ, ++msg_seq);
+	blob_put_int32(&buf, APMSG_INTERVAL, usteer_remote_interval_max());
 	if (host_info_blob)
 		blob_put(&buf, APMSG_HOST_INFO,
 			 blob_data(host_info_blob),
 			 blob_len(host_info_blob));
 
+	if (interest && config.remote_sta_filter == REMOTE_STA_FILTER_INTEREST)
+		usteer_send_interest();
+
 	return blob_nest_start(&buf, APMSG_NODES);
 }
 
@@ -629,21 +1284,190 @@ static void
 usteer_update_send(void *c)
 {
 	struct interface *iface;
+	struct peer *peer;
 
 	blob_nest_end(&buf, c);
 
-	vlist_for_each_element(&interfaces, iface, node)
+	vlist_for_each_element(&interfaces, iface, node) {
 		interface_send_msg(iface, buf.head);
+		remote_stats.tx++;
+	}
+
+	vlist_for_each_element(&peers, peer, node) {
+		peer_send_msg(peer, buf.head);
+		remote_stats.tx++;
+	}
+}
+
+static int usteer_sta_info_signal_cmp(struct sta_info *si1, struct sta_info *si2)
+{
+	if (si1->signal == si2->signal)
+		return 0;
+
+	if (si1->signal == NO_SIGNAL)
+		return -1;
+
+	if (si2->signal == NO_SIGNAL)
+		return 1;
+
+	return si1->signal - si2->signal;
+}
+
+/* Connected entries and the entry with the best signal per SSID are summarized */
+static bool usteer_sta_info_summary_relevant(struct sta_info *si)
+{
+	struct sta_info *cur;
+	int cmp;
+
+	if (si->connected == STA_CONNECTED)
+		return true;
+
+	list_for_each_entry(cur, &si->sta->nodes, list) {
+		if (cur == si || strcmp(cur->node->ssid, si->node->ssid) != 0)
+			continue;
+
+		cmp = usteer_sta_info_signal_cmp(cur, si);
+		if (cmp > 0 || (!cmp && cur->created < si->created))
+			return false;
+	}
+
+	return true;
+}
+
+static void usteer_send_summary_node(struct usteer_node *node, uint32_t origin)
+{
+	struct sta_info *si;
+	void *c, *s;
+
+	c = blob_nest_start(&buf, 0);
+	usteer_send_node_info(node);
+	blob_put_int32(&buf, APMSG_NODE_ORIGIN, origin);
+
+	s = blob_nest_start(&buf, APMSG_NODE_STATIONS);
+	list_for_each_entry(si, &node->sta_info, node_list) {
+		if (!usteer_sta_info_summary_relevant(si))
+			continue;
+
+		usteer_send_sta_info(si);
+	}
+	blob_nest_end(&buf, s);
+
+	blob_nest_end(&buf, c);
+}
+
+static void *
+usteer_summary_init(void)
+{
+	summary_nodes = 0;
+	blob_buf_init(&buf, 0);
+	blob_put_int32(&buf, APMSG_ID, local_id);
+	blob_put_int32(&buf, APMSG_SEQ, ++msg_seq);
+	blob_put_int32(&buf, APMSG_INTERVAL, usteer_remote_interval_max());
+	blob_put_int8(&buf, APMSG_SUMMARY, 1);
+
+	return blob_nest_start(&buf, APMSG_NODES);
+}
+
+/* Append a node, or leave the message unchanged if it would get too large */
+static bool
+usteer_summary_put_node(struct usteer_node *node, uint32_t origin)
+{
+	unsigned int len = blob_raw_len(buf.head);
+
+	usteer_send_summary_node(node, origin);
+	if (apmsg_len(&buf) <= APMSG_MAX_DATAGRAM) {
+		summary_nodes++;
+		return true;
+	}
+
+	blob_set_raw_len(buf.head, len);
+	return false;
+}
+
+static void *
+usteer_summary_add_node(void *c, struct usteer_node *node, uint32_t origin)
+{
+	if (usteer_summary_put_node(node, origin))
+		return c;
+
+	/* Split the summary into multiple messages to stay below the datagram size */
+	if (summary_nodes) {
+		usteer_update_send(c);
+		c = usteer_summary_init();
+		if (usteer_summary_put_node(node, origin))
+			return c;
+	}
+
+	MSG(DEBUG, "Node %s does not fit into a summary message\n",
+	    usteer_node_name(node));
+
+	return c;
+}
+
+/* Re-publish the merged state of all known nodes for summary_only instances */
+static void
+usteer_send_summary(void)
+{
+	struct usteer_remote_node *rn;
+	struct usteer_node *node;
+	void *c;
+
+	c = usteer_summary_init();
+
+	for_each_local_node(node)
+		c = usteer_summary_add_node(c, node, local_id);
+
+	for_each_remote_node(rn)
+		c = usteer_summary_add_node(c, &rn->node,
+					    (uint32_t)(uintptr_t) rn->host->avl.key);
+
+	if (summary_nodes)
+		usteer_update_send(c);
+}
+
+/*
+ * With several aggregators on a network, only the one with the lowest id
+ * publishes summaries. The others take over once its summaries have not
+ * been seen for a node timeout.
+ */
+static bool
+usteer_summary_active(void)
+{
+	return !aggregator_seen ||
+	       current_time - aggregator_seen > aggregator_timeout;
 }
 
 void
 usteer_send_sta_update(struct sta_info *si)
 {
-	void *c = usteer_update_init();
+	void *c = usteer_update_init(false);
 	usteer_send_node(si->node, si);
 	usteer_update_send(c);
 }
 
+/* Local state changed, shorten the wait for the next update */
+void
+usteer_send_update_soon(void)
+{
+	int64_t delay;
+	int remaining;
+
+	if (remote_update_pending)
+		return;
+
+	remote_update_pending = true;
+
+	delay = remote_last_update + usteer_remote_interval_min() - current_time;
+	if (delay < 1)
+		delay = 1;
+
+	remaining = uloop_timeout_remaining(&remote_timer);
+	if (remaining >= 0 && remaining <= delay)
+		return;
+
+	uloop_timeout_set(&remote_timer, delay);
+}
+
 static void
 usteer_send_update_timer(struct uloop_timeout *t)
 {
@@ -651,16 +1475,32 @@ usteer_send_update_timer(struct uloop_timeout *t)
 	void *c;
 
 	usteer_update_time();
-	uloop_timeout_set(t, config.remote_update_interval);
+
+	/* Send quickly while there are changes, back off while idle */
+	if (remote_update_pending)
+		remote_interval = usteer_remote_interval_min();
+	else
+		remote_interval *= 2;
+
+	if (remote_interval > usteer_remote_interval_max())
+		remote_interval = usteer_remote_interval_max();
+	if (remote_interval < usteer_remote_interval_min())
+		remote_interval = usteer_remote_interval_min();
+
+	remote_update_pending = false;
+	remote_last_update = current_time;
+	uloop_timeout_set(t, remote_interval);
 
 	if (!avl_is_empty(&local_nodes) || host_info_blob) {
-		c = usteer_update_init();
+		c = usteer_update_init(true);
 		for_each_local_node(node)
 			usteer_send_node(node, NULL);
 
 		usteer_update_send(c);
 	}
-	usteer_check_timeout();
+
+	if (config.aggregator && usteer_summary_active())
+		usteer_send_summary();
 }
 
 static int
@@ -737,24 +1577,38 @@ static int usteer_create_v6_socket() {
 }
 
 static void usteer_reload_timer(struct uloop_timeout *t) {
-	/* Remove uloop descriptor */
-	if (remote_fd.fd && remote_fd.registered) {
+	/* Remove uloop descriptor or stop the ingest thread */
+	if (usteer_ingest_running()) {
+		usteer_ingest_stop();
+		close(remote_fd.fd);
+	} else if (remote_fd.fd && remote_fd.registered) {
 		uloop_fd_delete(&remote_fd);
 		close(remote_fd.fd);
 	}
 
-	if (config.ipv6) {
+	if (config.ipv6)
 		remote_fd.fd = usteer_create_v6_socket();
-		remote_fd.cb = interface_recv_v6;
-	} else {
+	else
 		remote_fd.fd = usteer_create_v4_socket();
-		remote_fd.cb = interface_recv_v4;
-	}
+	remote_fd.cb = interface_recv;
 
-	if (remote_fd.fd < 0)
-		return;
+	/* Fall back to receiving on the main loop if the thread fails to start */
+	if (remote_fd.fd >= 0 &&
+	    (!config.remote_ingest_thread ||
+	     usteer_ingest_start(remote_fd.fd, &ingest_ops)))
+		uloop_fd_add(&remote_fd, ULOOP_READ);
 
-	uloop_fd_add(&remote_fd, ULOOP_READ);
+	peer_stream_reload();
+}
+
+static void __usteer_init usteer_remote_timeout_init(void)
+{
+	usteer_timeout_init(&remote_node_tq);
+	remote_node_tq.cb = remote_node_timeout_cb;
+	remote_node_tq.name = "remote_node";
+	usteer_timeout_init(&remote_host_tq);
+	remote_host_tq.cb = remote_host_timeout_cb;
+	remote_host_tq.name = "remote_host";
 }
 
 int usteer_interface_init(void)
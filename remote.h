@@ -27,14 +27,38 @@ enum {
 	APMSG_SEQ,
 	APMSG_NODES,
 	APMSG_HOST_INFO,
+	APMSG_INTEREST,
+	APMSG_SUMMARY,
+	APMSG_INTEREST_TIMEOUT,
+	APMSG_INTERVAL,
 	__APMSG_MAX
 };
 
+#define APMSG_REQUIRED \
+	((1 << APMSG_ID) | (1 << APMSG_SEQ) | (1 << APMSG_NODES))
+
+/* largest UDP payload over IPv4 */
+#define APMSG_MAX_DATAGRAM	65507
+
+/*
+ * Size of the message being built in buf, including the nest that is still
+ * open. The enclosing attributes are only updated by blob_nest_end().
+ */
+static inline unsigned int
+apmsg_len(struct blob_buf *buf)
+{
+	return (char *) buf->head - (char *) buf->buf + blob_pad_len(buf->head);
+}
+
 struct apmsg {
 	uint32_t id;
 	uint32_t seq;
 	struct blob_attr *nodes;
 	struct blob_attr *host_info;
+	struct blob_attr *interest;
+	uint32_t interest_timeout;
+	uint32_t interval;
+	bool summary;
 };
 
 enum {
@@ -51,12 +75,19 @@ enum {
 	APMSG_NODE_BSSID,
 	APMSG_NODE_CHANNEL,
 	APMSG_NODE_OP_CLASS,
+	APMSG_NODE_ORIGIN,
 	__APMSG_NODE_MAX
 };
 
+#define APMSG_NODE_REQUIRED \
+	((1 << APMSG_NODE_NAME) | (1 << APMSG_NODE_BSSID) | \
+	 (1 << APMSG_NODE_FREQ) | (1 << APMSG_NODE_N_ASSOC) | \
+	 (1 << APMSG_NODE_STATIONS) | (1 << APMSG_NODE_SSID))
+
 struct apmsg_node {
 	const char *name;
 	const char *ssid;
+	int ssid_len;
 	const char *bssid;
 	int freq;
 	int channel;
@@ -65,6 +96,7 @@ struct apmsg_node {
 	int max_assoc;
 	int noise;
 	int load;
+	uint32_t origin;
 	struct blob_attr *stations;
 	struct blob_attr *rrm_nr;
 	struct blob_attr *node_info;
@@ -80,6 +112,8 @@ enum {
 	__APMSG_STA_MAX
 };
 
+#define APMSG_STA_REQUIRED	((1 << __APMSG_STA_MAX) - 1)
+
 struct apmsg_sta {
 	uint8_t addr[6];
 
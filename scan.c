@@ -0,0 +1,288 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+#include "usteer.h"
+#include "node.h"
+
+/*
+ * Beacon measurement requests are queued per radio instead of being sent
+ * right away. A station measuring beacons is off its serving channel for
+ * the measurement duration on every channel it scans, so each radio gets
+ * a limit on concurrent measurements and a budget of measurement time per
+ * second. Queued requests are served by priority, and the request targets
+ * the channels of known neighbor nodes when all of them are known.
+ */
+
+#define SCAN_TICK		100
+#define SCAN_MAX_CHANNELS	8
+
+struct usteer_scan_radio {
+	struct avl_node avl;
+	int freq;
+
+	struct list_head queue;
+	struct list_head active;
+	int n_active;
+
+	int64_t budget;
+	uint64_t last;
+};
+
+struct usteer_scan_channel {
+	int op_class;
+	int channel;
+};
+
+static int avl_freq_cmp(const void *k1, const void *k2, void *ptr)
+{
+	return (int)(intptr_t) k1 - (int)(intptr_t) k2;
+}
+
+static AVL_TREE(scan_radios, avl_freq_cmp, false, NULL);
+static struct uloop_timeout scan_timer;
+
+/* BSSes on the same channel share the radio airtime */
+static struct usteer_scan_radio *
+scan_radio_get(struct usteer_node *node)
+{
+	struct usteer_scan_radio *radio;
+
+	radio = avl_find_element(&scan_radios, (void *)(intptr_t) node->freq, radio, avl);
+	if (radio)
+		return radio;
+
+	radio = calloc(1, sizeof(*radio));
+	radio->freq = node->freq;
+	radio->avl.key = (void *)(intptr_t) radio->freq;
+	radio->last = current_time;
+	INIT_LIST_HEAD(&radio->queue);
+	INIT_LIST_HEAD(&radio->active);
+	avl_insert(&scan_radios, &radio->avl);
+
+	return radio;
+}
+
+static int
+scan_add_channel(struct usteer_scan_channel *list, int n, struct usteer_node *node)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (list[i].op_class == node->op_class &&
+		    list[i].channel == node->channel)
+			return n;
+
+	if (n == SCAN_MAX_CHANNELS)
+		return -1;
+
+	list[n].op_class = node->op_class;
+	list[n].channel = node->channel;
+
+	return n + 1;
+}
+
+/*
+ * Collect the channels of all other nodes serving the same SSID. Returns -1
+ * if any of them does not advertise its channel or there are too many to
+ * scan individually.
+ */
+static int
+scan_neighbor_channels(struct usteer_node *cur, struct usteer_scan_channel *list)
+{
+	struct usteer_remote_node *rn;
+	struct usteer_node *node;
+	int n = 0;
+
+	for_each_local_node(node) {
+		if (node == cur || strcmp(node->ssid, cur->ssid) != 0)
+			continue;
+
+		if (!node->op_class || !node->channel)
+			return -1;
+
+		n = scan_add_channel(list, n, node);
+		if (n < 0)
+			return -1;
+	}
+
+	for_each_remote_node(rn) {
+		node = &rn->node;
+		if (strcmp(node->ssid, cur->ssid) != 0)
+			continue;
+
+		if (!node->op_class || !node->channel)
+			return -1;
+
+		n = scan_add_channel(list, n, node);
+		if (n < 0)
+			return -1;
+	}
+
+	return n;
+}
+
+/* Send the next request for a station, returns the expected measurement time */
+static uint32_t
+scan_send(struct sta_info *si)
+{
+	struct usteer_scan_channel list[SCAN_MAX_CHANNELS];
+	uint32_t duration = config.roam_scan_interval / 100;
+	int op_class, channel, n_channels;
+	int n;
+
+	n = scan_neighbor_channels(si->node, list);
+	if (n > 0) {
+		/* rotate through the neighbor channels, one per request */
+		n = si->scan.idx++ % n;
+		op_class = list[n].op_class;
+		channel = list[n].channel;
+		n_channels = 1;
+	} else {
+		si->scan_band = !si->scan_band;
+		op_class = si->scan_band ? 1 : 12;
+		channel = 0;
+		n_channels = si->scan_band ? 4 : 11;
+	}
+
+	usteer_ubus_trigger_client_scan(si, op_class, channel, duration);
+
+	/* duration is in TUs */
+	return duration * n_channels * 1024 / 1000;
+}
+
+static void
+scan_radio_run(struct usteer_scan_radio *radio)
+{
+	int64_t max_budget = config.beacon_req_airtime;
+	struct sta_info *si, *tmp;
+	uint32_t cost;
+
+	radio->budget += (current_time - radio->last) * config.beacon_req_airtime / 1000;
+	if (radio->budget > max_budget)
+		radio->budget = max_budget;
+	radio->last = current_time;
+
+	list_for_each_entry_safe(si, tmp, &radio->active, scan.list) {
+		if (current_time < si->scan.end)
+			continue;
+
+		list_del_init(&si->scan.list);
+		radio->n_active--;
+	}
+
+	while (!list_empty(&radio->queue)) {
+		if (config.beacon_req_max_active &&
+		    radio->n_active >= config.beacon_req_max_active)
+			break;
+
+		/* a single request may exceed the budget if the radio is idle */
+		if (config.beacon_req_airtime && radio->budget <= 0 &&
+		    radio->n_active)
+			break;
+
+		si = list_first_entry(&radio->queue, struct sta_info, scan.list);
+		cost = scan_send(si);
+
+		if (config.beacon_req_airtime)
+			radio->budget -= cost;
+
+		si->scan.end = current_time + cost;
+		si->scan.queued = false;
+		list_move_tail(&si->scan.list, &radio->active);
+		radio->n_active++;
+	}
+}
+
+static void
+scan_timer_cb(struct uloop_timeout *t)
+{
+	struct usteer_scan_radio *radio;
+	bool pending = false;
+
+	usteer_update_time();
+
+	avl_for_each_element(&scan_radios, radio, avl) {
+		scan_radio_run(radio);
+
+		if (!list_empty(&radio->queue) || radio->n_active)
+			pending = true;
+	}
+
+	if (pending)
+		uloop_timeout_set(t, SCAN_TICK);
+}
+
+/*
+ * Queue a beacon measurement request. Requests with a higher priority are
+ * sent first, a station already queued only has its priority raised.
+ */
+void usteer_scan_request(struct sta_info *si, int prio)
+{
+	struct usteer_scan_radio *radio;
+	struct sta_info *cur;
+
+	if (!usteer_sta_supports_beacon_measurement_mode(si->sta, BEACON_MEASUREMENT_ACTIVE)) {
+		MSG(DEBUG, "STA does not support beacon measurement sta=" MAC_ADDR_FMT "\n", MAC_ADDR_DATA(si->sta->addr));
+		return;
+	}
+
+	if (si->scan.queued) {
+		if (prio <= si->scan.prio)
+			return;
+
+		list_del(&si->scan.list);
+	} else if (!list_empty(&si->scan.list)) {
+		/* measurement in progress */
+		return;
+	}
+
+	radio = scan_radio_get(si->node);
+	si->scan.radio = radio;
+	si->scan.prio = prio;
+	si->scan.queued = true;
+
+	list_for_each_entry(cur, &radio->queue, scan.list)
+		if (cur->scan.prio < prio)
+			break;
+
+	list_add_tail(&si->scan.list, &cur->scan.list);
+
+	MSG(DEBUG, "Queue beacon measurement on sta=" MAC_ADDR_FMT " prio=%d\n",
+	    MAC_ADDR_DATA(si->sta->addr), prio);
+
+	if (!scan_timer.pending)
+		uloop_timeout_set(&scan_timer, 0);
+}
+
+void usteer_scan_cancel(struct sta_info *si)
+{
+	if (list_empty(&si->scan.list))
+		return;
+
+	if (!si->scan.queued)
+		si->scan.radio->n_active--;
+
+	list_del_init(&si->scan.list);
+	si->scan.queued = false;
+}
+
+static void __usteer_init usteer_scan_init(void)
+{
+	scan_timer.cb = scan_timer_cb;
+}
@@ -0,0 +1,888 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name>
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org>
+ */
+
+/*
+ * usteer-sim: run the policy engine against synthetic nodes and stations
+ * on a virtual clock.
+ *
+ * The policy, station and node code is linked unmodified. ubus calls are
+ * replaced with stubs that act on the simulated stations, and uloop
+ * timeouts are kept on a virtual timeline that is advanced directly from
+ * one expiry to the next, so a run is fully determined by the scenario
+ * and the seed.
+ *
+ * Scenario file format (one statement per line, '#' starts a comment):
+ *
+ *   seed <n>
+ *   duration <seconds>
+ *   jitter <dB>
+ *   config <option> <value>
+ *   node <name> <freq> [load <pct>] [max_assoc <n>] [noise <dBm>]
+ *   stations <count> [interval <ms>] [rrm] [nobtm] <node>=<dBm>[:<dBm>] ...
+ *
+ * A station group sees each listed node at a signal that moves linearly
+ * from the first to the second value over the duration of the run.
+ * Nodes that are not listed are out of range.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "usteer.h"
+#include "node.h"
+#include "rand.h"
+
+#define SIM_MAX_NODES		32
+#define SIM_MIN_SIGNAL		-90
+#define SIM_TIME_BASE		(24 * 3600 * 1000ULL)
+#define SIM_RECONNECT_DELAY	100
+#define SIM_PROBE_INTERVAL	1000
+
+AVL_TREE(local_nodes, avl_strcmp, false, NULL);
+LIST_HEAD(remote_nodes);
+struct ubus_object usteer_obj;
+
+struct sim_group {
+	int probe_interval;
+	bool rrm;
+	bool btm;
+	struct {
+		bool valid;
+		int start;
+		int end;
+	} signal[SIM_MAX_NODES];
+};
+
+struct sim_sta {
+	struct uloop_timeout probe;
+	struct sim_group *group;
+	uint8_t addr[6];
+
+	/* index of the associated node or -1 */
+	int node;
+	int last_node;
+	uint64_t disconnected;
+};
+
+struct sim_latency {
+	uint32_t *ns;
+	size_t len;
+	size_t size;
+	uint64_t total;
+};
+
+static LIST_HEAD(sim_timeouts);
+static struct usteer_local_node *nodes[SIM_MAX_NODES];
+static int n_nodes;
+static struct sim_sta *stas;
+static int n_stas;
+static uint64_t sim_state = 1;
+static uint64_t sim_start;
+static uint32_t sim_duration = 300;
+static int sim_jitter;
+
+static struct {
+	uint64_t requests[__EVENT_TYPE_MAX];
+	uint64_t accepted[__EVENT_TYPE_MAX];
+	uint64_t kick_checks;
+	uint64_t kicks;
+	uint64_t disassoc;
+	uint64_t scans;
+	uint64_t connects;
+	uint64_t roams;
+	uint64_t drops;
+	uint64_t reconnects;
+	uint64_t reconnect_time;
+	uint64_t reconnect_max;
+	struct sim_latency decision;
+	struct sim_latency kick;
+} stats;
+
+enum sim_cfg_type {
+	SIM_CFG_BOOL,
+	SIM_CFG_I32,
+	SIM_CFG_U32,
+};
+
+#define SIM_CFG(_type, _name) { #_name, SIM_CFG_##_type, &config._name }
+
+static const struct {
+	const char *name;
+	enum sim_cfg_type type;
+	void *ptr;
+} sim_cfg[] = {
+	SIM_CFG(U32, debug_level),
+	SIM_CFG(U32, sta_block_timeout),
+	SIM_CFG(U32, local_sta_timeout),
+	SIM_CFG(U32, local_sta_update),
+	SIM_CFG(U32, max_retry_band),
+	SIM_CFG(U32, seen_policy_timeout),
+	SIM_CFG(U32, measurement_report_timeout),
+	SIM_CFG(U32, measurement_report_limit),
+	SIM_CFG(BOOL, assoc_steering),
+	SIM_CFG(U32, band_steering_threshold),
+	SIM_CFG(U32, load_balancing_threshold),
+	SIM_CFG(I32, min_snr),
+	SIM_CFG(U32, min_snr_kick_delay),
+	SIM_CFG(I32, min_connect_snr),
+	SIM_CFG(U32, signal_diff_threshold),
+	SIM_CFG(I32, roam_scan_snr),
+	SIM_CFG(U32, roam_process_timeout),
+	SIM_CFG(U32, roam_scan_tries),
+	SIM_CFG(U32, roam_scan_timeout),
+	SIM_CFG(U32, roam_scan_interval),
+	SIM_CFG(I32, roam_trigger_snr),
+	SIM_CFG(U32, roam_trigger_interval),
+	SIM_CFG(U32, roam_predict_time),
+	SIM_CFG(U32, beacon_req_max_active),
+	SIM_CFG(U32, beacon_req_airtime),
+	SIM_CFG(U32, roam_kick_delay),
+	SIM_CFG(U32, initial_connect_delay),
+	SIM_CFG(BOOL, load_kick_enabled),
+	SIM_CFG(U32, load_kick_threshold),
+	SIM_CFG(U32, load_kick_delay),
+	SIM_CFG(U32, load_kick_min_clients),
+};
+
+static uint64_t sim_wall_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sim_latency_add(struct sim_latency *l, uint64_t start)
+{
+	uint64_t ns = sim_wall_ns() - start;
+
+	if (l->len == l->size) {
+		l->size = l->size ? l->size * 2 : 4096;
+		l->ns = realloc(l->ns, l->size * sizeof(*l->ns));
+	}
+
+	l->ns[l->len++] = ns > UINT32_MAX ? UINT32_MAX : ns;
+	l->total += ns;
+}
+
+static int sim_latency_cmp(const void *a, const void *b)
+{
+	uint32_t v1 = *(const uint32_t *) a;
+	uint32_t v2 = *(const uint32_t *) b;
+
+	return v1 < v2 ? -1 : v1 > v2;
+}
+
+static void sim_latency_print(const char *name, struct sim_latency *l)
+{
+	double rate = 0;
+
+	if (!l->len) {
+		printf("%-14s 0\n", name);
+		return;
+	}
+
+	qsort(l->ns, l->len, sizeof(*l->ns), sim_latency_cmp);
+	if (l->total)
+		rate = l->len * 1e9 / l->total;
+
+	printf("%-14s %zu (%.0f/s), avg %llu ns, p50 %u ns, p99 %u ns, max %u ns\n",
+	       name, l->len, rate, (unsigned long long) (l->total / l->len),
+	       l->ns[l->len / 2], l->ns[l->len * 99 / 100], l->ns[l->len - 1]);
+}
+
+/* virtual uloop timeouts, kept sorted by expiry */
+
+static uint64_t sim_timeout_expiry(struct uloop_timeout *t)
+{
+	return (uint64_t) t->time.tv_sec * 1000 + t->time.tv_usec / 1000;
+}
+
+int uloop_timeout_cancel(struct uloop_timeout *t)
+{
+	if (!t->pending)
+		return -1;
+
+	list_del(&t->list);
+	t->pending = false;
+
+	return 0;
+}
+
+int uloop_timeout_set(struct uloop_timeout *t, int msecs)
+{
+	struct uloop_timeout *cur;
+	uint64_t expiry;
+
+	if (t->pending)
+		uloop_timeout_cancel(t);
+
+	if (msecs < 0)
+		msecs = 0;
+
+	expiry = current_time + msecs;
+	t->time.tv_sec = expiry / 1000;
+	t->time.tv_usec = (expiry % 1000) * 1000;
+
+	/* insert after all timeouts with the same expiry to keep runs stable */
+	list_for_each_entry_reverse(cur, &sim_timeouts, list) {
+		if (sim_timeout_expiry(cur) <= expiry)
+			break;
+	}
+	list_add(&t->list, &cur->list);
+	t->pending = true;
+
+	return 0;
+}
+
+void usteer_update_time(void)
+{
+}
+
+static void sim_run(uint64_t end)
+{
+	struct uloop_timeout *t;
+	uint64_t expiry;
+
+	while (!list_empty(&sim_timeouts)) {
+		t = list_first_entry(&sim_timeouts, struct uloop_timeout, list);
+		expiry = sim_timeout_expiry(t);
+		if (expiry > end)
+			break;
+
+		if (expiry > current_time)
+			current_time = expiry;
+
+		uloop_timeout_cancel(t);
+		if (t->cb)
+			t->cb(t);
+	}
+
+	current_time = end;
+}
+
+/* simulated stations */
+
+static struct sim_sta *sim_sta_by_addr(const uint8_t *addr)
+{
+	unsigned int idx = (addr[3] << 16) | (addr[4] << 8) | addr[5];
+
+	if (addr[0] != 0x02 || addr[1] != 'U' || addr[2] != 'S' ||
+	    idx >= n_stas)
+		return NULL;
+
+	return &stas[idx];
+}
+
+static int sim_node_index(struct usteer_node *node)
+{
+	int i;
+
+	for (i = 0; i < n_nodes; i++)
+		if (&nodes[i]->node == node)
+			return i;
+
+	return -1;
+}
+
+static int sim_signal(struct sim_sta *ss, int idx)
+{
+	struct sim_group *g = ss->group;
+	int64_t elapsed = current_time - sim_start;
+	int signal;
+
+	if (!g->signal[idx].valid)
+		return NO_SIGNAL;
+
+	signal = g->signal[idx].start;
+	signal += (g->signal[idx].end - g->signal[idx].start) * elapsed /
+		  ((int64_t) sim_duration * 1000);
+	if (sim_jitter)
+		signal += (int) (rand_u32(&sim_state) % (2 * sim_jitter + 1)) - sim_jitter;
+
+	if (signal < SIM_MIN_SIGNAL)
+		return NO_SIGNAL;
+
+	return signal;
+}
+
+static bool sim_sta_event(struct sim_sta *ss, int idx, enum usteer_event_type type,
+			  int signal)
+{
+	struct usteer_node *node = &nodes[idx]->node;
+	uint64_t start = sim_wall_ns();
+	bool ret;
+
+	ret = usteer_handle_sta_event(node, ss->addr, type, node->freq, signal);
+	sim_latency_add(&stats.decision, start);
+
+	stats.requests[type]++;
+	if (ret)
+		stats.accepted[type]++;
+
+	return ret;
+}
+
+static void sim_sta_disconnect(struct sim_sta *ss, bool steered)
+{
+	if (ss->node < 0)
+		return;
+
+	nodes[ss->node]->node.n_assoc--;
+	ss->last_node = ss->node;
+	ss->node = -1;
+
+	if (!steered) {
+		stats.drops++;
+		return;
+	}
+
+	/* a steered client starts looking for a new BSS right away */
+	ss->disconnected = current_time;
+	uloop_timeout_set(&ss->probe, SIM_RECONNECT_DELAY);
+}
+
+static void sim_sta_connect(struct sim_sta *ss, int idx, int signal)
+{
+	struct usteer_node *node = &nodes[idx]->node;
+	struct sta_info *si;
+	struct sta *sta;
+
+	if (!sim_sta_event(ss, idx, EVENT_TYPE_AUTH, signal) ||
+	    !sim_sta_event(ss, idx, EVENT_TYPE_ASSOC, signal))
+		return;
+
+	sta = usteer_sta_get(ss->addr, false);
+	si = usteer_sta_info_get(sta, node, NULL);
+	if (!si)
+		return;
+
+	si->connected = STA_CONNECTED;
+	si->last_connected = current_time;
+	usteer_sta_info_update(si, signal, true);
+	node->n_assoc++;
+
+	ss->node = idx;
+	stats.connects++;
+	if (ss->last_node >= 0 && ss->last_node != idx)
+		stats.roams++;
+
+	if (ss->disconnected) {
+		uint64_t delay = current_time - ss->disconnected;
+
+		stats.reconnects++;
+		stats.reconnect_time += delay;
+		if (delay > stats.reconnect_max)
+			stats.reconnect_max = delay;
+		ss->disconnected = 0;
+	}
+}
+
+static void sim_sta_probe(struct uloop_timeout *t)
+{
+	struct sim_sta *ss = container_of(t, struct sim_sta, probe);
+	struct sta *sta;
+	int best = -1, best_signal = NO_SIGNAL;
+	int i;
+
+	sta = usteer_sta_get(ss->addr, true);
+	if (ss->group->rrm)
+		sta->rrm = (1 << 4) | (1 << 5);
+
+	for (i = 0; i < n_nodes; i++) {
+		int signal = sim_signal(ss, i);
+
+		if (signal == NO_SIGNAL)
+			continue;
+
+		/* a denied probe request gets no response */
+		if (!sim_sta_event(ss, i, EVENT_TYPE_PROBE, signal))
+			continue;
+
+		if (best < 0 || signal > best_signal) {
+			best = i;
+			best_signal = signal;
+		}
+	}
+
+	if (ss->node < 0 && best >= 0)
+		sim_sta_connect(ss, best, best_signal);
+
+	uloop_timeout_set(t, ss->group->probe_interval);
+}
+
+/* node polling, standing in for get_clients and the nl80211 signal update */
+
+static void sim_node_update(struct uloop_timeout *t)
+{
+	struct usteer_local_node *ln = container_of(t, struct usteer_local_node, update);
+	int idx = sim_node_index(&ln->node);
+	struct sta_info *si, *tmp;
+	uint64_t start;
+
+	list_for_each_entry_safe(si, tmp, &ln->node.sta_info, node_list) {
+		struct sim_sta *ss = sim_sta_by_addr(si->sta->addr);
+		int signal;
+
+		if (!ss || si->connected != STA_CONNECTED)
+			continue;
+
+		signal = sim_signal(ss, idx);
+		if (signal == NO_SIGNAL) {
+			usteer_sta_disconnected(si);
+			sim_sta_disconnect(ss, false);
+			continue;
+		}
+
+		si->last_connected = current_time;
+		usteer_sta_info_update(si, signal, true);
+	}
+
+	start = sim_wall_ns();
+	usteer_local_node_kick(ln);
+	sim_latency_add(&stats.kick, start);
+	stats.kick_checks++;
+
+	uloop_timeout_set(t, config.local_sta_update);
+}
+
+/* ubus stubs */
+
+int ubus_notify(struct ubus_context *ctx, struct ubus_object *obj,
+		const char *type, struct blob_attr *msg, int timeout)
+{
+	return 0;
+}
+
+struct usteer_local_node *
+usteer_local_node_by_bssid(uint8_t *bssid)
+{
+	int i;
+
+	for (i = 0; i < n_nodes; i++)
+		if (!memcmp(nodes[i]->node.bssid, bssid, 6))
+			return nodes[i];
+
+	return NULL;
+}
+
+void usteer_send_sta_update(struct sta_info *si)
+{
+}
+
+uint64_t usteer_metrics_time(void)
+{
+	return 0;
+}
+
+void usteer_metrics_decision(enum usteer_event_type type, uint64_t start)
+{
+}
+
+void usteer_send_update_soon(void)
+{
+}
+
+void usteer_remote_interest_changed(void)
+{
+}
+
+void usteer_ubus_kick_client(struct sta_info *si)
+{
+	struct sim_sta *ss = sim_sta_by_addr(si->sta->addr);
+
+	stats.kicks++;
+	usteer_sta_disconnected(si);
+	si->roam_kick = current_time;
+
+	if (ss && ss->node == sim_node_index(si->node))
+		sim_sta_disconnect(ss, true);
+}
+
+int usteer_ubus_notify_client_disassoc(struct sta_info *si)
+{
+	struct sim_sta *ss = sim_sta_by_addr(si->sta->addr);
+
+	stats.disassoc++;
+	if (!ss || !ss->group->btm || ss->node != sim_node_index(si->node))
+		return 0;
+
+	/* the client follows the transition request and leaves on its own */
+	usteer_sta_disconnected(si);
+	sim_sta_disconnect(ss, true);
+
+	return 0;
+}
+
+int usteer_ubus_trigger_client_scan(struct sta_info *si, int op_class,
+				    int channel, uint32_t duration)
+{
+	struct sim_sta *ss = sim_sta_by_addr(si->sta->addr);
+	int i;
+
+	if (!ss)
+		return 0;
+
+	stats.scans++;
+
+	/* an active scan shows up as probe requests plus a beacon report */
+	for (i = 0; i < n_nodes; i++) {
+		struct usteer_beacon_report br = {};
+		int signal = sim_signal(ss, i);
+
+		if (signal == NO_SIGNAL)
+			continue;
+
+		if (channel && nodes[i]->node.channel != channel)
+			continue;
+
+		sim_sta_event(ss, i, EVENT_TYPE_PROBE, signal);
+
+		br.rcpi = (signal + 110) * 2;
+		usteer_measurement_report_add_beacon_report(si->sta, &nodes[i]->node,
+							    &br, current_time);
+	}
+
+	return 0;
+}
+
+/* scenario parsing */
+
+static int sim_find_node(const char *name)
+{
+	int i;
+
+	for (i = 0; i < n_nodes; i++)
+		if (!strcmp(usteer_node_name(&nodes[i]->node), name))
+			return i;
+
+	return -1;
+}
+
+static int sim_parse_config(char *name, char *val)
+{
+	int i;
+
+	if (!name || !val)
+		return -1;
+
+	for (i = 0; i < ARRAY_SIZE(sim_cfg); i++) {
+		if (strcmp(sim_cfg[i].name, name) != 0)
+			continue;
+
+		switch (sim_cfg[i].type) {
+		case SIM_CFG_BOOL:
+			*(bool *) sim_cfg[i].ptr = !!atoi(val);
+			break;
+		case SIM_CFG_I32:
+			*(int32_t *) sim_cfg[i].ptr = strtol(val, NULL, 0);
+			break;
+		case SIM_CFG_U32:
+			*(uint32_t *) sim_cfg[i].ptr = strtoul(val, NULL, 0);
+			break;
+		}
+
+		return 0;
+	}
+
+	return -1;
+}
+
+static int sim_parse_node(char *name, char **save)
+{
+	struct usteer_local_node *ln;
+	struct usteer_node *node;
+	char *key, *val;
+
+	if (!name || n_nodes >= SIM_MAX_NODES || sim_find_node(name) >= 0)
+		return -1;
+
+	val = strtok_r(NULL, " \t", save);
+	if (!val)
+		return -1;
+
+	ln = calloc(1, sizeof(*ln) + strlen(name) + 1);
+	node = &ln->node;
+	node->avl.key = strcpy((char *) (ln + 1), name);
+	node->type = NODE_TYPE_LOCAL;
+	node->freq = atoi(val);
+	node->created = current_time;
+	node->bssid[0] = 0x02;
+	node->bssid[5] = n_nodes + 1;
+	strcpy(node->ssid, "usteer-sim");
+	INIT_LIST_HEAD(&node->sta_info);
+	INIT_LIST_HEAD(&node->measurements);
+	ln->iface = node->avl.key;
+	ln->update.cb = sim_node_update;
+
+	while ((key = strtok_r(NULL, " \t", save)) != NULL) {
+		val = strtok_r(NULL, " \t", save);
+		if (!val)
+			return -1;
+
+		if (!strcmp(key, "load"))
+			node->load = atoi(val);
+		else if (!strcmp(key, "max_assoc"))
+			node->max_assoc = atoi(val);
+		else if (!strcmp(key, "noise"))
+			node->noise = atoi(val);
+		else
+			return -1;
+	}
+
+	avl_insert(&local_nodes, &node->avl);
+	nodes[n_nodes++] = ln;
+
+	return 0;
+}
+
+static int sim_parse_signal(struct sim_group *g, char *spec)
+{
+	char *sep = strchr(spec, '=');
+	int idx;
+
+	*sep++ = 0;
+	idx = sim_find_node(spec);
+	if (idx < 0)
+		return -1;
+
+	g->signal[idx].valid = true;
+	g->signal[idx].start = strtol(sep, &sep, 0);
+	g->signal[idx].end = g->signal[idx].start;
+	if (*sep == ':')
+		g->signal[idx].end = strtol(sep + 1, NULL, 0);
+
+	return 0;
+}
+
+static int sim_parse_stations(char *count, char **save)
+{
+	struct sim_group *g;
+	char *tok;
+	int i, n;
+
+	if (!count || (n = atoi(count)) <= 0 || n_stas + n > (1 << 24))
+		return -1;
+
+	g = calloc(1, sizeof(*g));
+	g->probe_interval = SIM_PROBE_INTERVAL;
+	g->btm = true;
+
+	while ((tok = strtok_r(NULL, " \t", save)) != NULL) {
+		if (!strcmp(tok, "rrm")) {
+			g->rrm = true;
+		} else if (!strcmp(tok, "nobtm")) {
+			g->btm = false;
+		} else if (!strcmp(tok, "interval")) {
+			tok = strtok_r(NULL, " \t", save);
+			if (!tok || (g->probe_interval = atoi(tok)) <= 0)
+				return -1;
+		} else if (!strchr(tok, '=') || sim_parse_signal(g, tok)) {
+			return -1;
+		}
+	}
+
+	stas = realloc(stas, (n_stas + n) * sizeof(*stas));
+	for (i = n_stas; i < n_stas + n; i++) {
+		struct sim_sta *ss = &stas[i];
+
+		memset(ss, 0, sizeof(*ss));
+		ss->group = g;
+		ss->node = -1;
+		ss->last_node = -1;
+		ss->addr[0] = 0x02;
+		ss->addr[1] = 'U';
+		ss->addr[2] = 'S';
+		ss->addr[3] = i >> 16;
+		ss->addr[4] = i >> 8;
+		ss->addr[5] = i;
+	}
+	n_stas += n;
+
+	return 0;
+}
+
+static int sim_parse_line(char *line)
+{
+	char *save, *cmd, *arg;
+
+	line[strcspn(line, "#\r\n")] = 0;
+	cmd = strtok_r(line, " \t", &save);
+	if (!cmd)
+		return 0;
+
+	arg = strtok_r(NULL, " \t", &save);
+	if (!strcmp(cmd, "node"))
+		return sim_parse_node(arg, &save);
+	if (!strcmp(cmd, "stations"))
+		return sim_parse_stations(arg, &save);
+
+	if (!arg)
+		return -1;
+
+	if (!strcmp(cmd, "seed"))
+		sim_state = strtoull(arg, NULL, 0) ?: 1;
+	else if (!strcmp(cmd, "duration"))
+		sim_duration = atoi(arg);
+	else if (!strcmp(cmd, "jitter"))
+		sim_jitter = atoi(arg);
+	else if (!strcmp(cmd, "config"))
+		return sim_parse_config(arg, strtok_r(NULL, " \t", &save));
+	else
+		return -1;
+
+	return 0;
+}
+
+static int sim_load(const char *file)
+{
+	char line[512];
+	int n = 0;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (!f) {
+		perror(file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		n++;
+		if (sim_parse_line(line)) {
+			fprintf(stderr, "%s:%d: invalid statement\n", file, n);
+			fclose(f);
+			return -1;
+		}
+	}
+
+	fclose(f);
+
+	if (!n_nodes || !n_stas || !sim_duration) {
+		fprintf(stderr, "%s: scenario needs nodes, stations and a duration\n", file);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void sim_report(const char *file, uint64_t seed, uint64_t wall)
+{
+	int i;
+
+	printf("scenario:      %s (seed %llu)\n", file, (unsigned long long) seed);
+	printf("virtual time:  %u s, %d nodes, %d stations, %.3f s wall\n",
+	       sim_duration, n_nodes, n_stas, wall / 1e9);
+
+	sim_latency_print("decisions:", &stats.decision);
+	for (i = 0; i < __EVENT_TYPE_MAX; i++)
+		printf("  %-12s %llu requests, %llu accepted\n", event_types[i],
+		       (unsigned long long) stats.requests[i],
+		       (unsigned long long) stats.accepted[i]);
+	sim_latency_print("kick checks:", &stats.kick);
+
+	printf("kicks:         %llu, disassoc imminent %llu, scans %llu\n",
+	       (unsigned long long) stats.kicks,
+	       (unsigned long long) stats.disassoc,
+	       (unsigned long long) stats.scans);
+	printf("connects:      %llu, roams %llu, drops %llu\n",
+	       (unsigned long long) stats.connects,
+	       (unsigned long long) stats.roams,
+	       (unsigned long long) stats.drops);
+	if (stats.reconnects)
+		printf("reconnect:     %llu, avg %llu ms, max %llu ms\n",
+		       (unsigned long long) stats.reconnects,
+		       (unsigned long long) (stats.reconnect_time / stats.reconnects),
+		       (unsigned long long) stats.reconnect_max);
+
+	for (i = 0; i < n_nodes; i++)
+		printf("node %-10s freq %d, %d associated\n",
+		       usteer_node_name(&nodes[i]->node), nodes[i]->node.freq,
+		       nodes[i]->node.n_assoc);
+}
+
+static int usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <scenario>\n"
+		"Options:\n"
+		" -v:           Increase debug level (repeat for more messages)\n"
+		" -s <seed>:    Override the scenario seed\n"
+		" -d <seconds>: Override the scenario duration\n"
+		"\n", prog);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t duration = 0;
+	uint64_t seed = 0;
+	uint64_t wall;
+	int debug = 0;
+	int ch, i;
+
+	while ((ch = getopt(argc, argv, "d:s:v")) != -1) {
+		switch(ch) {
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'v':
+			debug++;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (optind + 1 != argc)
+		return usage(argv[0]);
+
+	usteer_init_defaults();
+	current_time = sim_start = SIM_TIME_BASE;
+
+	if (sim_load(argv[optind]))
+		return 1;
+
+	if (seed)
+		sim_state = seed;
+	if (duration)
+		sim_duration = duration;
+	seed = sim_state;
+	config.debug_level += debug;
+
+	for (i = 0; i < n_nodes; i++)
+		uloop_timeout_set(&nodes[i]->update, config.local_sta_update);
+
+	for (i = 0; i < n_stas; i++) {
+		stas[i].probe.cb = sim_sta_probe;
+		uloop_timeout_set(&stas[i].probe, rand_u32(&sim_state) % stas[i].group->probe_interval);
+	}
+
+	wall = sim_wall_ns();
+	sim_run(sim_start + (uint64_t) sim_duration * 1000);
+	wall = sim_wall_ns() - wall;
+
+	sim_report(argv[optind], seed, wall);
+
+	return 0;
+}
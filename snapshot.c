@@ -0,0 +1,619 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "usteer.h"
+#include "node.h"
+
+/*
+ * Station, node and measurement state is periodically written to tmpfs as
+ * fixed size records, so a restarted daemon can map the file and pick up
+ * where the previous instance left off. Timestamps are stored as age
+ * relative to the time of the snapshot and rebased on restore.
+ *
+ * Records are grouped by node. They are applied when a node with the same
+ * name shows up again, until the snapshot expires after local_sta_timeout.
+ *
+ * The restored state is trusted, so the file is kept in a directory that
+ * only the daemon can write to.
+ */
+
+#define SNAPSHOT_DIR		"/var/run/usteer"
+#define SNAPSHOT_PATH		SNAPSHOT_DIR "/snapshot"
+#define SNAPSHOT_MAGIC		0x75737473 /* usts */
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_NEVER		((uint64_t) -1)
+
+struct snapshot_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t time;
+
+	uint32_t n_nodes;
+	uint32_t n_sta;
+	uint32_t n_sta_info;
+	uint32_t n_measurements;
+};
+
+struct snapshot_node {
+	char name[128];
+
+	int32_t roam_source;
+	int32_t roam_target;
+
+	uint32_t sta_info;
+	uint32_t n_sta_info;
+	uint32_t measurements;
+	uint32_t n_measurements;
+};
+
+struct snapshot_sta {
+	uint8_t addr[6];
+	uint8_t rrm;
+	uint8_t seen_2ghz : 1;
+	uint8_t seen_5ghz : 1;
+};
+
+struct snapshot_sta_info {
+	uint8_t addr[6];
+	uint8_t connected;
+	uint8_t pad;
+	int32_t signal;
+	int32_t kick_count;
+
+	uint64_t created;
+	uint64_t seen;
+	uint64_t last_connected;
+
+	struct sta_info_stats stats[__EVENT_TYPE_MAX];
+};
+
+struct snapshot_measurement {
+	uint8_t addr[6];
+	uint8_t rcpi;
+	uint8_t rsni;
+
+	uint64_t timestamp;
+};
+
+static struct {
+	void *data;
+	size_t len;
+
+	struct snapshot_header *hdr;
+	struct snapshot_node *nodes;
+	struct snapshot_sta *sta;
+	struct snapshot_sta_info *sta_info;
+	struct snapshot_measurement *measurements;
+
+	/* time elapsed between writing and loading the snapshot */
+	uint64_t offline;
+	bool *applied;
+} snapshot;
+
+static struct uloop_timeout snapshot_timer;
+static struct uloop_timeout snapshot_expire;
+
+static uint64_t
+snapshot_realtime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t
+snapshot_age(uint64_t time)
+{
+	if (!time)
+		return SNAPSHOT_NEVER;
+
+	if (time > current_time)
+		return 0;
+
+	return current_time - time;
+}
+
+static uint64_t
+snapshot_rebase(uint64_t age)
+{
+	if (age == SNAPSHOT_NEVER)
+		return 0;
+
+	age += snapshot.offline;
+	if (age >= current_time)
+		return 1;
+
+	return current_time - age;
+}
+
+static void
+snapshot_write_node(FILE *f, struct usteer_node *node, uint32_t *n_sta_info,
+		    uint32_t *n_measurements)
+{
+	struct snapshot_node rec = {};
+	struct sta_info *si;
+
+	snprintf(rec.name, sizeof(rec.name), "%s", usteer_node_name(node));
+	rec.roam_source = node->roam_events.source;
+	rec.roam_target = node->roam_events.target;
+
+	rec.sta_info = *n_sta_info;
+	list_for_each_entry(si, &node->sta_info, node_list)
+		rec.n_sta_info++;
+	*n_sta_info += rec.n_sta_info;
+
+	rec.measurements = *n_measurements;
+	rec.n_measurements = node->n_measurements;
+	*n_measurements += rec.n_measurements;
+
+	fwrite(&rec, sizeof(rec), 1, f);
+}
+
+static void
+snapshot_write_sta_info(FILE *f, struct usteer_node *node)
+{
+	struct snapshot_sta_info rec;
+	struct sta_info *si;
+	int i;
+
+	list_for_each_entry(si, &node->sta_info, node_list) {
+		memset(&rec, 0, sizeof(rec));
+		memcpy(rec.addr, si->sta->addr, sizeof(rec.addr));
+		rec.connected = si->connected;
+		rec.signal = si->signal;
+		rec.kick_count = si->kick_count;
+		rec.created = snapshot_age(si->created);
+		rec.seen = snapshot_age(si->seen);
+		rec.last_connected = snapshot_age(si->last_connected);
+
+		memcpy(rec.stats, si->stats, sizeof(rec.stats));
+		for (i = 0; i < __EVENT_TYPE_MAX; i++)
+			rec.stats[i].blocked_last_time =
+				(uint32_t) current_time - si->stats[i].blocked_last_time;
+
+		fwrite(&rec, sizeof(rec), 1, f);
+	}
+}
+
+static void
+snapshot_write_measurements(FILE *f, struct usteer_node *node)
+{
+	struct usteer_measurement_report *mr;
+	struct snapshot_measurement rec;
+
+	/* oldest first, restoring them rebuilds the same LRU order */
+	list_for_each_entry_reverse(mr, &node->measurements, node_list) {
+		memset(&rec, 0, sizeof(rec));
+		memcpy(rec.addr, mr->sta->addr, sizeof(rec.addr));
+		rec.rcpi = mr->beacon_report.rcpi;
+		rec.rsni = mr->beacon_report.rsni;
+		rec.timestamp = snapshot_age(mr->timestamp);
+
+		fwrite(&rec, sizeof(rec), 1, f);
+	}
+}
+
+static int
+snapshot_get_nodes(struct usteer_node ***list)
+{
+	struct usteer_remote_node *rn;
+	struct usteer_node *node;
+	int n = 0;
+
+	avl_for_each_element(&local_nodes, node, avl)
+		n++;
+	for_each_remote_node(rn)
+		n++;
+
+	*list = calloc(n + 1, sizeof(**list));
+	n = 0;
+
+	avl_for_each_element(&local_nodes, node, avl)
+		(*list)[n++] = node;
+	for_each_remote_node(rn)
+		(*list)[n++] = &rn->node;
+
+	return n;
+}
+
+static bool
+snapshot_dir_init(void)
+{
+	struct stat st;
+
+	if (mkdir(SNAPSHOT_DIR, 0700) < 0 && errno != EEXIST) {
+		MSG(INFO, "Failed to create %s: %s\n", SNAPSHOT_DIR, strerror(errno));
+		return false;
+	}
+
+	if (lstat(SNAPSHOT_DIR, &st) < 0 || !S_ISDIR(st.st_mode) ||
+	    st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		MSG(INFO, "Not using %s, it is writable by other users\n", SNAPSHOT_DIR);
+		return false;
+	}
+
+	return true;
+}
+
+void usteer_snapshot_write(void)
+{
+	struct snapshot_header hdr = {
+		.magic = SNAPSHOT_MAGIC,
+		.version = SNAPSHOT_VERSION,
+	};
+	struct usteer_node **nodes;
+	struct snapshot_sta rec;
+	char tmp[] = SNAPSHOT_PATH ".XXXXXX";
+	struct sta *sta;
+	FILE *f;
+	int i, n_nodes, fd;
+
+	/* Don't overwrite state that has not been restored yet */
+	if (snapshot.data)
+		return;
+
+	if (!snapshot_dir_init())
+		return;
+
+	/* readers must never see a partially written snapshot */
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		MSG(INFO, "Failed to write state snapshot %s\n", SNAPSHOT_PATH);
+		return;
+	}
+
+	f = fdopen(fd, "w");
+	if (!f) {
+		MSG(INFO, "Failed to write state snapshot %s\n", SNAPSHOT_PATH);
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+
+	usteer_update_time();
+	hdr.time = snapshot_realtime();
+
+	n_nodes = snapshot_get_nodes(&nodes);
+	hdr.n_nodes = n_nodes;
+	avl_for_each_element(&stations, sta, avl)
+		hdr.n_sta++;
+
+	fwrite(&hdr, sizeof(hdr), 1, f);
+
+	for (i = 0; i < n_nodes; i++)
+		snapshot_write_node(f, nodes[i], &hdr.n_sta_info, &hdr.n_measurements);
+
+	/* stations are sorted by address, which allows a binary search on restore */
+	avl_for_each_element(&stations, sta, avl) {
+		memset(&rec, 0, sizeof(rec));
+		memcpy(rec.addr, sta->addr, sizeof(rec.addr));
+		rec.rrm = sta->rrm;
+		rec.seen_2ghz = sta->seen_2ghz;
+		rec.seen_5ghz = sta->seen_5ghz;
+		fwrite(&rec, sizeof(rec), 1, f);
+	}
+
+	for (i = 0; i < n_nodes; i++)
+		snapshot_write_sta_info(f, nodes[i]);
+
+	for (i = 0; i < n_nodes; i++)
+		snapshot_write_measurements(f, nodes[i]);
+
+	free(nodes);
+
+	fseek(f, 0, SEEK_SET);
+	fwrite(&hdr, sizeof(hdr), 1, f);
+
+	if ((ferror(f) | fclose(f)) || rename(tmp, SNAPSHOT_PATH) < 0) {
+		MSG(INFO, "Failed to write state snapshot %s\n", SNAPSHOT_PATH);
+		unlink(tmp);
+	}
+}
+
+static int
+snapshot_sta_cmp(const void *k1, const void *k2)
+{
+	const struct snapshot_sta *s1 = k1, *s2 = k2;
+
+	return memcmp(s1->addr, s2->addr, sizeof(s1->addr));
+}
+
+static struct sta *
+snapshot_sta_get(const uint8_t *addr)
+{
+	struct snapshot_sta key, *rec;
+	struct sta *sta;
+
+	sta = usteer_sta_get(addr, false);
+	if (sta)
+		return sta;
+
+	sta = usteer_sta_get(addr, true);
+	memcpy(key.addr, addr, sizeof(key.addr));
+	rec = bsearch(&key, snapshot.sta, snapshot.hdr->n_sta,
+		      sizeof(*rec), snapshot_sta_cmp);
+	if (rec) {
+		sta->rrm = rec->rrm;
+		sta->seen_2ghz = rec->seen_2ghz;
+		sta->seen_5ghz = rec->seen_5ghz;
+	}
+
+	return sta;
+}
+
+static void
+snapshot_restore_sta_info(struct usteer_node *node, struct snapshot_sta_info *rec)
+{
+	struct sta_info *si;
+	struct sta *sta;
+	uint64_t seen_age;
+	bool create;
+	int i;
+
+	seen_age = rec->seen + snapshot.offline;
+	if (rec->seen == SNAPSHOT_NEVER || seen_age >= config.local_sta_timeout)
+		return;
+
+	sta = snapshot_sta_get(rec->addr);
+	si = usteer_sta_info_get(sta, node, &create);
+	if (!create)
+		return;
+
+	si->signal = rec->signal;
+	si->kick_count = rec->kick_count;
+	si->created = snapshot_rebase(rec->created);
+	si->seen = snapshot_rebase(rec->seen);
+	usteer_sta_info_update_estimate(si, si->signal, si->seen);
+	si->last_connected = snapshot_rebase(rec->last_connected);
+
+	memcpy(si->stats, rec->stats, sizeof(si->stats));
+	for (i = 0; i < __EVENT_TYPE_MAX; i++)
+		si->stats[i].blocked_last_time =
+			(uint32_t) current_time - rec->stats[i].blocked_last_time;
+
+	/*
+	 * Local connections are confirmed by the next hostapd client list,
+	 * remote ones by the next update from the peer.
+	 */
+	if (node->type == NODE_TYPE_LOCAL && rec->connected == STA_CONNECTED)
+		si->connected = STA_CONNECTED;
+
+	usteer_sta_info_update_timeout(si, config.local_sta_timeout - seen_age);
+}
+
+static void
+snapshot_restore_measurement(struct usteer_node *node, struct snapshot_measurement *rec)
+{
+	struct usteer_beacon_report br = {
+		.rcpi = rec->rcpi,
+		.rsni = rec->rsni,
+	};
+	struct sta *sta;
+
+	if (rec->timestamp + snapshot.offline >= config.measurement_report_timeout)
+		return;
+
+	sta = usteer_sta_get(rec->addr, false);
+	if (!sta || usteer_measurement_report_get(sta, node, false))
+		return;
+
+	usteer_measurement_report_add_beacon_report(sta, node, &br,
+						    snapshot_rebase(rec->timestamp));
+}
+
+static void
+snapshot_restore_node(struct usteer_node *node, struct snapshot_node *rec)
+{
+	struct snapshot_header *hdr = snapshot.hdr;
+	uint32_t i;
+
+	if ((uint64_t) rec->sta_info + rec->n_sta_info > hdr->n_sta_info ||
+	    (uint64_t) rec->measurements + rec->n_measurements > hdr->n_measurements)
+		return;
+
+	node->roam_events.source = rec->roam_source;
+	node->roam_events.target = rec->roam_target;
+
+	for (i = 0; i < rec->n_sta_info; i++)
+		snapshot_restore_sta_info(node, &snapshot.sta_info[rec->sta_info + i]);
+
+	for (i = 0; i < rec->n_measurements; i++)
+		snapshot_restore_measurement(node, &snapshot.measurements[rec->measurements + i]);
+
+	MSG(VERBOSE, "Restored %d station entries for node %s\n",
+	    rec->n_sta_info, usteer_node_name(node));
+}
+
+void usteer_snapshot_node_added(struct usteer_node *node)
+{
+	struct snapshot_node *rec;
+	uint32_t i;
+
+	if (!snapshot.data)
+		return;
+
+	for (i = 0; i < snapshot.hdr->n_nodes; i++) {
+		rec = &snapshot.nodes[i];
+		if (snapshot.applied[i] ||
+		    strncmp(rec->name, usteer_node_name(node), sizeof(rec->name)) != 0)
+			continue;
+
+		snapshot.applied[i] = true;
+		usteer_update_time();
+		snapshot_restore_node(node, rec);
+		break;
+	}
+}
+
+static void
+snapshot_unload(void)
+{
+	if (!snapshot.data)
+		return;
+
+	uloop_timeout_cancel(&snapshot_expire);
+	munmap(snapshot.data, snapshot.len);
+	free(snapshot.applied);
+	memset(&snapshot, 0, sizeof(snapshot));
+}
+
+static void
+snapshot_expire_cb(struct uloop_timeout *t)
+{
+	MSG(VERBOSE, "Discarding remaining state snapshot entries\n");
+	snapshot_unload();
+}
+
+static bool
+snapshot_map(int fd)
+{
+	struct snapshot_header *hdr;
+	struct stat st;
+	uint64_t len;
+	char *cur;
+
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr))
+		return false;
+
+	snapshot.len = st.st_size;
+	snapshot.data = mmap(NULL, snapshot.len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (snapshot.data == MAP_FAILED) {
+		snapshot.data = NULL;
+		return false;
+	}
+
+	hdr = snapshot.hdr = snapshot.data;
+	if (hdr->magic != SNAPSHOT_MAGIC || hdr->version != SNAPSHOT_VERSION)
+		return false;
+
+	len = sizeof(*hdr) +
+	      (uint64_t) hdr->n_nodes * sizeof(*snapshot.nodes) +
+	      (uint64_t) hdr->n_sta * sizeof(*snapshot.sta) +
+	      (uint64_t) hdr->n_sta_info * sizeof(*snapshot.sta_info) +
+	      (uint64_t) hdr->n_measurements * sizeof(*snapshot.measurements);
+	if (len != snapshot.len)
+		return false;
+
+	cur = (char *) (hdr + 1);
+	snapshot.nodes = (void *) cur;
+	cur += hdr->n_nodes * sizeof(*snapshot.nodes);
+	snapshot.sta = (void *) cur;
+	cur += hdr->n_sta * sizeof(*snapshot.sta);
+	snapshot.sta_info = (void *) cur;
+	cur += hdr->n_sta_info * sizeof(*snapshot.sta_info);
+	snapshot.measurements = (void *) cur;
+
+	return true;
+}
+
+/* Map the snapshot of a previous instance and apply it to the known nodes */
+static void
+snapshot_load(void)
+{
+	struct usteer_remote_node *rn;
+	struct usteer_node *node;
+	struct stat st;
+	uint64_t now;
+	int fd;
+
+	snapshot_expire.cb = snapshot_expire_cb;
+
+	if (!snapshot_dir_init())
+		return;
+
+	fd = open(SNAPSHOT_PATH, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd < 0)
+		return;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		MSG(INFO, "Ignoring state snapshot %s not owned by usteerd\n",
+		    SNAPSHOT_PATH);
+		close(fd);
+		return;
+	}
+
+	if (!snapshot_map(fd)) {
+		MSG(INFO, "Ignoring invalid state snapshot %s\n", SNAPSHOT_PATH);
+		snapshot_unload();
+		close(fd);
+		return;
+	}
+	close(fd);
+
+	now = snapshot_realtime();
+	if (now > snapshot.hdr->time)
+		snapshot.offline = now - snapshot.hdr->time;
+
+	snapshot.applied = calloc(snapshot.hdr->n_nodes, sizeof(*snapshot.applied));
+	uloop_timeout_set(&snapshot_expire, config.local_sta_timeout);
+
+	MSG(INFO, "Loaded state snapshot (%d nodes, %d stations, %lu ms old)\n",
+	    snapshot.hdr->n_nodes, snapshot.hdr->n_sta,
+	    (unsigned long) snapshot.offline);
+
+	/* nodes are usually known before the configuration arrives */
+	for_each_local_node(node)
+		usteer_snapshot_node_added(node);
+
+	for_each_remote_node(rn)
+		usteer_snapshot_node_added(&rn->node);
+}
+
+static void
+snapshot_timer_cb(struct uloop_timeout *t)
+{
+	if (!config.snapshot_interval)
+		return;
+
+	usteer_snapshot_write();
+	uloop_timeout_set(t, config.snapshot_interval);
+}
+
+void usteer_snapshot_update_config(void)
+{
+	static bool loaded;
+
+	snapshot_timer.cb = snapshot_timer_cb;
+
+	if (!config.snapshot_interval) {
+		uloop_timeout_cancel(&snapshot_timer);
+		return;
+	}
+
+	/* only restore once, and only when snapshots are enabled */
+	if (!loaded) {
+		loaded = true;
+		snapshot_load();
+	}
+
+	if (!snapshot_timer.pending ||
+	    uloop_timeout_remaining(&snapshot_timer) > config.snapshot_interval)
+		uloop_timeout_set(&snapshot_timer, config.snapshot_interval);
+}
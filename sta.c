@@ -17,8 +17,13 @@
  *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
  */
 
+#include <stdlib.h>
+
 #include "usteer.h"
 
+/* Signal change (dB) on a local node that triggers an early remote update */
+#define STA_SIGNAL_UPDATE_DELTA	3
+
 static int
 avl_macaddr_cmp(const void *k1, const void *k2, void *ptr)
 {
@@ -47,7 +52,11 @@ usteer_sta_info_del(struct sta_info *si)
 	MSG(DEBUG, "Delete station " MAC_ADDR_FMT " entry for node %s\n",
 	    MAC_ADDR_DATA(sta->addr), usteer_node_name(si->node));
 
+	if (si->node->type == NODE_TYPE_LOCAL)
+		usteer_remote_interest_changed();
+
 	usteer_timeout_cancel(&tq, &si->timeout);
+	usteer_scan_cancel(si);
 	list_del(&si->list);
 	list_del(&si->node_list);
 	free(si);
@@ -80,6 +89,7 @@ usteer_sta_info_timeout(struct usteer_timeout_queue *q, struct usteer_timeout *t
 struct sta_info *
 usteer_sta_info_get(struct sta *sta, struct usteer_node *node, bool *create)
 {
+	struct usteer_measurement_report *mr;
 	struct sta_info *si;
 
 	list_for_each_entry(si, &sta->nodes, list) {
@@ -103,12 +113,22 @@ usteer_sta_info_get(struct sta *sta, struct usteer_node *node, bool *create)
 	si->sta = sta;
 	list_add(&si->list, &sta->nodes);
 	list_add(&si->node_list, &node->sta_info);
+	INIT_LIST_HEAD(&si->scan.list);
 	si->created = current_time;
 	*create = true;
 
+	if (node->type == NODE_TYPE_LOCAL)
+		usteer_remote_interest_changed();
+
 	/* Node is by default not connected. */
 	usteer_sta_disconnected(si);
 
+	/* The station may have reported this node before probing on it */
+	mr = usteer_measurement_report_get(sta, node, false);
+	if (mr)
+		usteer_sta_info_update_estimate(si,
+			usteer_rcpi_to_signal(mr->beacon_report.rcpi), mr->timestamp);
+
 	return si;
 }
 
@@ -153,6 +173,90 @@ void usteer_sta_disconnected(struct sta_info *si)
 	usteer_sta_info_update_timeout(si, config.local_sta_timeout);
 }
 
+/*
+ * Samples go into a small ring per sta_info. The average and the sums
+ * for the least squares slope are updated as samples enter and leave the
+ * ring, so neither needs a pass over the history.
+ */
+static void
+sta_signal_history_add(struct sta_signal_history *h, uint64_t time, int signal)
+{
+	int64_t d, t;
+	int n = h->count;
+
+	if (!n) {
+		h->ewma = signal * 16;
+	} else {
+		h->ewma += (signal * 16 - h->ewma) / 4;
+
+		/* move the time origin to the new sample */
+		d = time - h->samples[(h->next + STA_SIGNAL_HISTORY - 1) % STA_SIGNAL_HISTORY].time;
+		h->sum_tt += -2 * d * h->sum_t + n * d * d;
+		h->sum_ts -= d * h->sum_s;
+		h->sum_t -= n * d;
+	}
+
+	if (n == STA_SIGNAL_HISTORY) {
+		t = h->samples[h->next].time - time;
+		h->sum_t -= t;
+		h->sum_s -= h->samples[h->next].signal;
+		h->sum_tt -= t * t;
+		h->sum_ts -= t * h->samples[h->next].signal;
+	} else {
+		h->count++;
+	}
+
+	h->samples[h->next].time = time;
+	h->samples[h->next].signal = signal;
+	h->next = (h->next + 1) % STA_SIGNAL_HISTORY;
+	h->sum_s += signal;
+}
+
+int usteer_sta_info_signal_avg(struct sta_info *si)
+{
+	if (!si->history.count)
+		return si->signal;
+
+	return si->history.ewma / 16;
+}
+
+/* Signal trend in dB per second over the history ring */
+double usteer_sta_info_signal_slope(struct sta_info *si)
+{
+	struct sta_signal_history *h = &si->history;
+	int64_t den;
+
+	if (h->count < 2)
+		return 0;
+
+	den = h->count * h->sum_tt - h->sum_t * h->sum_t;
+	if (!den)
+		return 0;
+
+	return 1000.0 * (h->count * h->sum_ts - h->sum_t * h->sum_s) / den;
+}
+
+int usteer_sta_info_signal_predict(struct sta_info *si, uint32_t ms)
+{
+	double slope;
+	int signal;
+
+	if (!ms || si->history.count < 2)
+		return si->signal;
+
+	/*
+	 * Extrapolate from the latest sample, the average lags behind it. Only
+	 * a falling signal is extrapolated, so recovery is not anticipated.
+	 */
+	slope = usteer_sta_info_signal_slope(si);
+	signal = si->signal + (int) (slope * ms / 1000);
+
+	if (signal > si->signal)
+		return si->signal;
+
+	return signal;
+}
+
 void
 usteer_sta_info_update(struct sta_info *si, int signal, bool avg)
 {
@@ -160,8 +264,15 @@ usteer_sta_info_update(struct sta_info *si, int signal, bool avg)
 	if (si->connected == STA_CONNECTED && si->signal != NO_SIGNAL && !avg)
 		signal = NO_SIGNAL;
 
-	if (signal != NO_SIGNAL)
+	if (signal != NO_SIGNAL) {
+		if (si->node->type == NODE_TYPE_LOCAL &&
+		    abs(signal - si->signal) >= STA_SIGNAL_UPDATE_DELTA)
+			usteer_send_update_soon();
+
 		si->signal = signal;
+		sta_signal_history_add(&si->history, current_time, signal);
+		usteer_sta_info_update_estimate(si, signal, current_time);
+	}
 
 	si->seen = current_time;
 
@@ -173,10 +284,43 @@ usteer_sta_info_update(struct sta_info *si, int signal, bool avg)
 	usteer_sta_info_update_timeout(si, config.local_sta_timeout);
 }
 
+/* RCPI is encoded in 0.5 dB steps starting at -110 dBm, 255 means unknown */
+int usteer_rcpi_to_signal(uint8_t rcpi)
+{
+	if (rcpi > 220)
+		return NO_SIGNAL;
+
+	return rcpi / 2 - 110;
+}
+
+/*
+ * Merge a new signal sample into the estimate. Probes and beacon reports
+ * are kept apart from si->signal, the most recent sample from either
+ * source wins.
+ */
+void
+usteer_sta_info_update_estimate(struct sta_info *si, int signal, uint64_t time)
+{
+	if (signal == NO_SIGNAL || time < si->est.time)
+		return;
+
+	si->est.signal = signal;
+	si->est.time = time;
+}
+
+int usteer_sta_info_signal(struct sta_info *si)
+{
+	if (!si->est.time)
+		return si->signal;
+
+	return si->est.signal;
+}
+
 bool
 usteer_handle_sta_event(struct usteer_node *node, const uint8_t *addr,
 		       enum usteer_event_type type, int freq, int signal)
 {
+	uint64_t start = usteer_metrics_time();
 	struct sta *sta;
 	struct sta_info *si;
 	uint32_t diff;
@@ -207,6 +351,8 @@ usteer_handle_sta_event(struct usteer_node *node, const uint8_t *addr,
 	if (create)
 		usteer_send_sta_update(si);
 
+	usteer_metrics_decision(type, start);
+
 	return ret;
 }
 
@@ -230,4 +376,5 @@ static void __usteer_init usteer_sta_init(void)
 {
 	usteer_timeout_init(&tq);
 	tq.cb = usteer_sta_info_timeout;
+	tq.name = "sta_info";
 }
@@ -0,0 +1,144 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+
+#include <stdio.h>
+
+#include "../usteer.h"
+#include "../remote.h"
+
+/*
+ * Fill summary messages with nodes until the next one no longer fits, the
+ * way usteer_summary_put_node() does, and check that the result can still
+ * be sent as a single datagram and parsed by the receiver.
+ */
+
+#define TEST_MAX_STATIONS	16
+
+static struct blob_buf buf;
+
+static void
+put_node(int idx, int n_sta)
+{
+	uint8_t addr[6] = { 0x02, 0, 0, 0, idx >> 8, idx };
+	char name[32];
+	void *c, *s, *st;
+	int i;
+
+	c = blob_nest_start(&buf, 0);
+	snprintf(name, sizeof(name), "phy0-ap%d", idx);
+	blob_put_string(&buf, APMSG_NODE_NAME, name);
+	blob_put_string(&buf, APMSG_NODE_SSID, "usteer");
+	blob_put(&buf, APMSG_NODE_BSSID, addr, sizeof(addr));
+	blob_put_int32(&buf, APMSG_NODE_FREQ, 5180);
+	blob_put_int32(&buf, APMSG_NODE_N_ASSOC, n_sta);
+	blob_put_int32(&buf, APMSG_NODE_ORIGIN, idx);
+
+	s = blob_nest_start(&buf, APMSG_NODE_STATIONS);
+	for (i = 0; i < n_sta; i++) {
+		addr[0] = i;
+		st = blob_nest_start(&buf, 0);
+		blob_put(&buf, APMSG_STA_ADDR, addr, sizeof(addr));
+		blob_put_int32(&buf, APMSG_STA_SIGNAL, -60);
+		blob_put_int8(&buf, APMSG_STA_CONNECTED, 1);
+		blob_put_int32(&buf, APMSG_STA_SEEN, 0);
+		blob_put_int32(&buf, APMSG_STA_LAST_CONNECTED, 0);
+		blob_put_int32(&buf, APMSG_STA_TIMEOUT, 120000);
+		blob_nest_end(&buf, st);
+	}
+	blob_nest_end(&buf, s);
+
+	blob_nest_end(&buf, c);
+}
+
+static int
+fill_summary(int n_sta)
+{
+	struct apmsg_node node;
+	struct blob_attr *cur;
+	unsigned int len, node_len;
+	struct apmsg msg;
+	int n_nodes = 0, n_parsed = 0;
+	void *c;
+	int rem;
+
+	blob_buf_init(&buf, 0);
+	blob_put_int32(&buf, APMSG_ID, 1);
+	blob_put_int32(&buf, APMSG_SEQ, 1);
+	blob_put_int32(&buf, APMSG_INTERVAL, 1000);
+	blob_put_int8(&buf, APMSG_SUMMARY, 1);
+	c = blob_nest_start(&buf, APMSG_NODES);
+
+	while (1) {
+		len = blob_raw_len(buf.head);
+		node_len = apmsg_len(&buf);
+		put_node(n_nodes, n_sta);
+		node_len = apmsg_len(&buf) - node_len;
+		if (apmsg_len(&buf) > APMSG_MAX_DATAGRAM) {
+			blob_set_raw_len(buf.head, len);
+			break;
+		}
+
+		n_nodes++;
+	}
+	blob_nest_end(&buf, c);
+
+	len = blob_pad_len(buf.head);
+	if (len > APMSG_MAX_DATAGRAM) {
+		fprintf(stderr, "Summary with %d nodes has %u bytes, limit is %d\n",
+			n_nodes, len, APMSG_MAX_DATAGRAM);
+		return 1;
+	}
+
+	if (len + node_len <= APMSG_MAX_DATAGRAM) {
+		fprintf(stderr, "Summary with %d nodes (%u bytes) was not filled\n",
+			n_nodes, len);
+		return 1;
+	}
+
+	if (!parse_apmsg(&msg, buf.head) || !msg.summary) {
+		fprintf(stderr, "Failed to parse the summary\n");
+		return 1;
+	}
+
+	blob_for_each_attr(cur, msg.nodes, rem)
+		if (parse_apmsg_node(&node, cur))
+			n_parsed++;
+
+	if (n_parsed != n_nodes) {
+		fprintf(stderr, "Parsed %d of %d nodes\n", n_parsed, n_nodes);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 0;
+	int i;
+
+	/* different node sizes end the message at different distances to the limit */
+	for (i = 0; i <= TEST_MAX_STATIONS; i++)
+		ret |= fill_summary(i);
+
+	blob_buf_free(&buf);
+
+	return ret;
+}
@@ -23,6 +23,8 @@
 
 #include "timeout.h"
 
+LIST_HEAD(usteer_timeout_queues);
+
 static int usteer_timeout_cmp(const void *k1, const void *k2, void *ptr)
 {
 	uint32_t ref = (uint32_t) (intptr_t) ptr;
@@ -62,6 +64,15 @@ static void usteer_timeout_recalc(struct usteer_timeout_queue *q, uint32_t time)
 	uloop_timeout_set(&q->timeout, delta);
 }
 
+#ifdef USTEER_SIM
+/* the simulator drives current_time from its virtual clock */
+extern uint64_t current_time;
+
+static uint32_t ampgr_timeout_current_time(void)
+{
+	return (uint32_t) current_time;
+}
+#else
 static uint32_t ampgr_timeout_current_time(void)
 {
 	struct timespec ts;
@@ -73,6 +84,7 @@ static uint32_t ampgr_timeout_current_time(void)
 
 	return val;
 }
+#endif
 
 static void usteer_timeout_cb(struct uloop_timeout *timeout)
 {
@@ -105,6 +117,7 @@ void usteer_timeout_init(struct usteer_timeout_queue *q)
 {
 	avl_init(&q->tree, usteer_timeout_cmp, true, NULL);
 	q->timeout.cb = usteer_timeout_cb;
+	list_add_tail(&q->list, &usteer_timeout_queues);
 }
 
 static void __usteer_timeout_cancel(struct usteer_timeout_queue *q,
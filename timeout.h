@@ -21,6 +21,7 @@
 #define __APMGR_TIMEOUT_H
 
 #include <libubox/avl.h>
+#include <libubox/list.h>
 #include <libubox/uloop.h>
 
 struct usteer_timeout {
@@ -31,8 +32,14 @@ struct usteer_timeout_queue {
 	struct avl_tree tree;
 	struct uloop_timeout timeout;
 	void (*cb)(struct usteer_timeout_queue *q, struct usteer_timeout *t);
+
+	/* all initialized queues, for metrics */
+	struct list_head list;
+	const char *name;
 };
 
+extern struct list_head usteer_timeout_queues;
+
 static inline bool
 usteer_timeout_isset(struct usteer_timeout *t)
 {
@@ -0,0 +1,224 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "usteer.h"
+#include "node.h"
+#include "trace.h"
+
+#define TRACE_FLUSH_INTERVAL	1000
+#define TRACE_MAX_SIZE		(16 * 1024 * 1024)
+
+static struct {
+	char *path;
+	FILE *f;
+	uint64_t start;
+	size_t size;
+
+	struct {
+		const struct usteer_local_node *ln;
+		char *name;
+	} nodes[USTEER_TRACE_MAX_ID];
+	int n_nodes;
+
+	char *methods[USTEER_TRACE_MAX_ID];
+	int n_methods;
+
+	struct uloop_timeout flush;
+} trace;
+
+static void
+usteer_trace_flush(struct uloop_timeout *t)
+{
+	if (trace.f)
+		fflush(trace.f);
+}
+
+static void
+usteer_trace_close(void)
+{
+	int i;
+
+	if (!trace.f)
+		return;
+
+	uloop_timeout_cancel(&trace.flush);
+	fclose(trace.f);
+	trace.f = NULL;
+
+	for (i = 0; i < trace.n_nodes; i++)
+		free(trace.nodes[i].name);
+	for (i = 0; i < trace.n_methods; i++)
+		free(trace.methods[i]);
+	trace.n_nodes = 0;
+	trace.n_methods = 0;
+}
+
+static void
+usteer_trace_open(void)
+{
+	struct usteer_trace_header hdr = {
+		.magic = cpu_to_be32(USTEER_TRACE_MAGIC),
+		.version = cpu_to_be16(USTEER_TRACE_VERSION),
+	};
+	struct timeval tv;
+
+	trace.f = fopen(trace.path, "w");
+	if (!trace.f) {
+		MSG(FATAL, "Failed to open event trace %s: %s\n",
+		    trace.path, strerror(errno));
+		return;
+	}
+
+	gettimeofday(&tv, NULL);
+	hdr.start = cpu_to_be64((uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000);
+	fwrite(&hdr, sizeof(hdr), 1, trace.f);
+
+	usteer_update_time();
+	trace.start = current_time;
+	trace.size = sizeof(hdr);
+	trace.flush.cb = usteer_trace_flush;
+
+	MSG(INFO, "Recording event trace to %s\n", trace.path);
+}
+
+static bool
+usteer_trace_write(enum usteer_trace_type type, int id, int method,
+		   const void *data, size_t len)
+{
+	struct usteer_trace_rec rec = {
+		.time = cpu_to_be32(current_time - trace.start),
+		.len = cpu_to_be16(len),
+		.type = type,
+		.id = id,
+		.method = method,
+	};
+
+	if (len > UINT16_MAX)
+		return false;
+
+	if (trace.size + sizeof(rec) + len > TRACE_MAX_SIZE) {
+		MSG(INFO, "Event trace %s reached %d bytes, stopping\n",
+		    trace.path, TRACE_MAX_SIZE);
+		usteer_trace_close();
+		return false;
+	}
+
+	fwrite(&rec, sizeof(rec), 1, trace.f);
+	fwrite(data, len, 1, trace.f);
+	trace.size += sizeof(rec) + len;
+
+	if (!trace.flush.pending)
+		uloop_timeout_set(&trace.flush, TRACE_FLUSH_INTERVAL);
+
+	return true;
+}
+
+static int
+usteer_trace_node_id(struct usteer_local_node *ln)
+{
+	const char *name = usteer_node_name(&ln->node);
+	int i;
+
+	for (i = 0; i < trace.n_nodes; i++)
+		if (trace.nodes[i].ln == ln && !strcmp(trace.nodes[i].name, name))
+			return i;
+
+	if (trace.n_nodes == USTEER_TRACE_MAX_ID ||
+	    !usteer_trace_write(USTEER_TRACE_NODE, i, 0, name, strlen(name)))
+		return -1;
+
+	trace.nodes[i].ln = ln;
+	trace.nodes[i].name = strdup(name);
+	trace.n_nodes++;
+
+	return i;
+}
+
+static int
+usteer_trace_method_id(const char *method)
+{
+	int i;
+
+	for (i = 0; i < trace.n_methods; i++)
+		if (!strcmp(trace.methods[i], method))
+			return i;
+
+	if (trace.n_methods == USTEER_TRACE_MAX_ID ||
+	    !usteer_trace_write(USTEER_TRACE_METHOD, i, 0, method, strlen(method)))
+		return -1;
+
+	trace.methods[i] = strdup(method);
+	trace.n_methods++;
+
+	return i;
+}
+
+void usteer_trace_event(struct usteer_local_node *ln, const char *method,
+			struct blob_attr *msg)
+{
+	int node, id;
+
+	if (!trace.f)
+		return;
+
+	node = usteer_trace_node_id(ln);
+	if (node < 0)
+		return;
+
+	id = usteer_trace_method_id(method);
+	if (id < 0)
+		return;
+
+	usteer_trace_write(USTEER_TRACE_EVENT, node, id, msg, blob_raw_len(msg));
+}
+
+void config_set_event_trace(struct blob_attr *data)
+{
+	const char *val;
+
+	if (!data)
+		return;
+
+	val = blobmsg_get_string(data);
+	if (trace.path && !strcmp(val, trace.path))
+		return;
+
+	usteer_trace_close();
+	free(trace.path);
+	trace.path = NULL;
+
+	if (!strlen(val))
+		return;
+
+	trace.path = strdup(val);
+	usteer_trace_open();
+}
+
+void config_get_event_trace(struct blob_buf *buf)
+{
+	if (!trace.path)
+		return;
+
+	blobmsg_add_string(buf, "event_trace", trace.path);
+}
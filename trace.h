@@ -0,0 +1,63 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+#ifndef __USTEER_TRACE_H
+#define __USTEER_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Binary trace of the hostapd notifications handled by usteer.
+ *
+ * The file starts with a header, followed by records. All integers are
+ * big-endian. Node and method names are defined once by a record of the
+ * respective type and referenced by index from event records, whose data
+ * is the notification message as a raw blob_attr.
+ */
+
+#define USTEER_TRACE_MAGIC	0x75737472 /* "ustr" */
+#define USTEER_TRACE_VERSION	1
+#define USTEER_TRACE_MAX_ID	256
+
+enum usteer_trace_type {
+	USTEER_TRACE_NODE,	/* data: node name, id: node index */
+	USTEER_TRACE_METHOD,	/* data: method name, id: method index */
+	USTEER_TRACE_EVENT,	/* data: message, id: node index */
+};
+
+struct usteer_trace_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+
+	/* wall clock time in ms at the start of the trace */
+	uint64_t start;
+} __attribute__((packed));
+
+struct usteer_trace_rec {
+	/* ms since the start of the trace */
+	uint32_t time;
+	uint16_t len;
+	uint8_t type;
+	uint8_t id;
+	uint8_t method;
+	uint8_t reserved;
+} __attribute__((packed));
+
+#endif
@@ -19,6 +19,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <net/ethernet.h>
 #ifdef linux
 #include <netinet/ether.h>
@@ -79,6 +80,29 @@ usteer_ubus_add_stats(struct sta_info_stats *stats, const char *name)
 	blobmsg_close_table(&b, s);
 }
 
+static void
+usteer_ubus_add_signal_history(struct sta_info *si)
+{
+	struct sta_signal_history *h = &si->history;
+	void *s, *a, *t;
+	int i, idx;
+
+	s = blobmsg_open_table(&b, "signal_history");
+	blobmsg_add_u32(&b, "average", usteer_sta_info_signal_avg(si));
+	blobmsg_add_double(&b, "slope", usteer_sta_info_signal_slope(si));
+
+	a = blobmsg_open_array(&b, "samples");
+	for (i = 0; i < h->count; i++) {
+		idx = (h->next + STA_SIGNAL_HISTORY - h->count + i) % STA_SIGNAL_HISTORY;
+		t = blobmsg_open_table(&b, NULL);
+		blobmsg_add_u64(&b, "age", current_time - h->samples[idx].time);
+		blobmsg_add_u32(&b, "signal", h->samples[idx].signal);
+		blobmsg_close_table(&b, t);
+	}
+	blobmsg_close_array(&b, a);
+	blobmsg_close_table(&b, s);
+}
+
 static int
 usteer_ubus_get_client_info(struct ubus_context *ctx, struct ubus_object *obj,
 			   struct ubus_request_data *req, const char *method,
@@ -111,6 +135,8 @@ usteer_ubus_get_client_info(struct ubus_context *ctx, struct ubus_object *obj,
 		_cur_n = blobmsg_open_table(&b, usteer_node_name(si->node));
 		blobmsg_add_u8(&b, "connected", si->connected);
 		blobmsg_add_u32(&b, "signal", si->signal);
+		blobmsg_add_u32(&b, "signal_estimate", usteer_sta_info_signal(si));
+		usteer_ubus_add_signal_history(si);
 		_s = blobmsg_open_table(&b, "stats");
 		for (i = 0; i < __EVENT_TYPE_MAX; i++)
 			usteer_ubus_add_stats(&si->stats[EVENT_TYPE_PROBE], event_types[i]);
@@ -209,7 +235,7 @@ usteer_ubus_beacon_measure(struct ubus_context *ctx, struct ubus_object *obj,
 	for_each_local_node(node)
 		list_for_each_entry(si, &node->sta_info, node_list)
 			if (si->connected == STA_CONNECTED)
-				usteer_ubus_trigger_client_scan(si);
+				usteer_scan_request(si, 0);
 	return 0;
 }
 
@@ -238,6 +264,10 @@ struct cfg_item {
 	_cfg(BOOL, syslog), \
 	_cfg(U32, debug_level), \
 	_cfg(BOOL, ipv6), \
+	_cfg(BOOL, peer_stream), \
+	_cfg(BOOL, remote_ingest_thread), \
+	_cfg(BOOL, aggregator), \
+	_cfg(BOOL, summary_only), \
 	_cfg(U32, sta_block_timeout), \
 	_cfg(U32, local_sta_timeout), \
 	_cfg(U32, local_sta_update), \
@@ -245,10 +275,15 @@ struct cfg_item {
 	_cfg(U32, max_retry_band), \
 	_cfg(U32, seen_policy_timeout), \
 	_cfg(U32, measurement_report_timeout), \
+	_cfg(U32, measurement_report_limit), \
 	_cfg(U32, load_balancing_threshold), \
 	_cfg(U32, band_steering_threshold), \
 	_cfg(U32, remote_update_interval), \
+	_cfg(U32, remote_update_interval_min), \
+	_cfg(U32, remote_update_interval_max), \
 	_cfg(U32, remote_node_timeout), \
+	_cfg(U32, remote_sta_filter), \
+	_cfg(U32, snapshot_interval), \
 	_cfg(BOOL, assoc_steering), \
 	_cfg(I32, min_connect_snr), \
 	_cfg(I32, min_snr), \
@@ -260,6 +295,9 @@ struct cfg_item {
 	_cfg(U32, roam_scan_interval), \
 	_cfg(I32, roam_trigger_snr), \
 	_cfg(U32, roam_trigger_interval), \
+	_cfg(U32, roam_predict_time), \
+	_cfg(U32, beacon_req_max_active), \
+	_cfg(U32, beacon_req_airtime), \
 	_cfg(U32, roam_kick_delay), \
 	_cfg(U32, signal_diff_threshold), \
 	_cfg(U32, initial_connect_delay), \
@@ -268,9 +306,16 @@ struct cfg_item {
 	_cfg(U32, load_kick_delay), \
 	_cfg(U32, load_kick_min_clients), \
 	_cfg(U32, load_kick_reason_code), \
+	_cfg(U32, event_ring_size), \
+	_cfg(U32, metrics_port), \
 	_cfg(ARRAY_CB, interfaces), \
+	_cfg(ARRAY_CB, peers), \
 	_cfg(STRING_CB, node_up_script), \
+	_cfg(STRING_CB, event_trace), \
+	_cfg(STRING_CB, event_ring), \
+	_cfg(STRING_CB, metrics_socket), \
 	_cfg(ARRAY_CB, event_log_types), \
+	_cfg(ARRAY_CB, event_limits), \
 	_cfg(ARRAY_CB, ssid_list)
 
 enum cfg_items {
@@ -367,10 +412,41 @@ usteer_ubus_set_config(struct ubus_context *ctx, struct ubus_object *obj,
 	}
 
 	usteer_interface_init();
+	usteer_snapshot_update_config();
+	usteer_metrics_update_config();
+	usteer_evring_update_config();
 
 	return 0;
 }
 
+static void
+usteer_dump_node_script(struct blob_buf *buf, struct usteer_local_node *ln)
+{
+	int status = ln->script.status;
+	void *c;
+
+	if (!ln->script.start && list_empty(&ln->script.list))
+		return;
+
+	c = blobmsg_open_table(buf, "node_up_script");
+	if (ln->script.proc.pending)
+		blobmsg_add_string(buf, "state", "running");
+	else if (!list_empty(&ln->script.list))
+		blobmsg_add_string(buf, "state", "queued");
+	else
+		blobmsg_add_string(buf, "state", "done");
+
+	if (ln->script.end) {
+		blobmsg_add_u32(buf, "duration", ln->script.end - ln->script.start);
+		blobmsg_add_u8(buf, "timeout", ln->script.timed_out);
+		if (WIFEXITED(status))
+			blobmsg_add_u32(buf, "exit_code", WEXITSTATUS(status));
+		else if (WIFSIGNALED(status))
+			blobmsg_add_u32(buf, "signal", WTERMSIG(status));
+	}
+	blobmsg_close_table(buf, c);
+}
+
 void usteer_dump_node(struct blob_buf *buf, struct usteer_node *node)
 {
 	void *c, *roam_events;
@@ -382,6 +458,12 @@ void usteer_dump_node(struct blob_buf *buf, struct usteer_node *node)
 	blobmsg_add_u32(buf, "noise", node->noise);
 	blobmsg_add_u32(buf, "load", node->load);
 	blobmsg_add_u32(buf, "max_assoc", node->max_assoc);
+	if (node->type == NODE_TYPE_LOCAL) {
+		struct usteer_local_node *ln = container_of(node, struct usteer_local_node, node);
+
+		blobmsg_add_u8(buf, "ready", ln->setup.ready);
+		usteer_dump_node_script(buf, ln);
+	}
 
 	roam_events = blobmsg_open_table(buf, "roam_events");
 	blobmsg_add_u32(buf, "source", node->roam_events.source);
@@ -402,7 +484,7 @@ void usteer_dump_node(struct blob_buf *buf, struct usteer_node *node)
 
 void usteer_dump_host(struct blob_buf *buf, struct usteer_remote_host *host)
 {
-	void *c;
+	void *c, *updates;
 
 	c = blobmsg_open_table(buf, host->addr);
 	blobmsg_add_u32(buf, "id", (uint32_t)(uintptr_t)host->avl.key);
@@ -410,6 +492,12 @@ void usteer_dump_host(struct blob_buf *buf, struct usteer_remote_host *host)
 		blobmsg_add_field(buf, BLOBMSG_TYPE_TABLE, "host_info",
 				  blobmsg_data(host->host_info),
 				  blobmsg_len(host->host_info));
+
+	updates = blobmsg_open_table(buf, "updates");
+	blobmsg_add_u32(buf, "applied", host->updates.applied);
+	blobmsg_add_u32(buf, "skipped", host->updates.skipped);
+	blobmsg_close_table(buf, updates);
+
 	blobmsg_close_table(buf, c);
 }
 
@@ -464,6 +552,42 @@ usteer_ubus_remote_info(struct ubus_context *ctx, struct ubus_object *obj,
 	return 0;
 }
 
+static void
+usteer_ubus_add_node_metrics(struct blob_buf *buf, struct usteer_node *node)
+{
+	void *c, *t;
+	int i;
+
+	c = blobmsg_open_table(buf, usteer_node_name(node));
+	usteer_event_dump_counters(buf, node);
+
+	t = blobmsg_open_table(buf, "roam_sm");
+	for (i = 0; i < __ROAM_TRIGGER_MAX; i++)
+		if (node->roam_sm_count[i])
+			blobmsg_add_u32(buf, roam_trigger_states[i], node->roam_sm_count[i]);
+	blobmsg_close_table(buf, t);
+
+	blobmsg_close_table(buf, c);
+}
+
+static int
+usteer_ubus_metrics(struct ubus_context *ctx, struct ubus_object *obj,
+		    struct ubus_request_data *req, const char *method,
+		    struct blob_attr *msg)
+{
+	struct usteer_node *node;
+
+	blob_buf_init(&b, 0);
+
+	/* counters are only kept for local nodes */
+	for_each_local_node(node)
+		usteer_ubus_add_node_metrics(&b, node);
+
+	ubus_send_reply(ctx, req, b.head);
+
+	return 0;
+}
+
 static int
 usteer_ubus_get_connected_clients(struct ubus_context *ctx, struct ubus_object *obj,
 				  struct ubus_request_data *req, const char *method,
@@ -628,6 +752,7 @@ static const struct ubus_method usteer_methods[] = {
 	UBUS_METHOD_NOARG("remote_hosts", usteer_ubus_remote_hosts),
 	UBUS_METHOD_NOARG("remote_info", usteer_ubus_remote_info),
 	UBUS_METHOD_NOARG("connected_clients", usteer_ubus_get_connected_clients),
+	UBUS_METHOD_NOARG("metrics", usteer_ubus_metrics),
 	UBUS_METHOD_NOARG("get_clients", usteer_ubus_get_clients),
 	UBUS_METHOD("get_client_info", usteer_ubus_get_client_info, client_arg),
 	UBUS_METHOD("kick_client", usteer_ubus_client_kick, client_arg),
@@ -741,25 +866,21 @@ int usteer_ubus_notify_client_disassoc(struct sta_info *si)
 	return ubus_invoke(ubus_ctx, ln->obj_id, "wnm_disassoc_imminent", b.head, NULL, 0, 100);
 }
 
-int usteer_ubus_trigger_client_scan(struct sta_info *si)
+int usteer_ubus_trigger_client_scan(struct sta_info *si, int op_class,
+				    int channel, uint32_t duration)
 {
 	struct usteer_local_node *ln = container_of(si->node, struct usteer_local_node, node);
 
-	if (!usteer_sta_supports_beacon_measurement_mode(si->sta, BEACON_MEASUREMENT_ACTIVE)) {
-		MSG(DEBUG, "STA does not support beacon measurement sta=" MAC_ADDR_FMT "\n", MAC_ADDR_DATA(si->sta->addr));
-		return 0;
-	}
-	MSG(DEBUG, "Trigger beacon measurement on sta=" MAC_ADDR_FMT "\n", MAC_ADDR_DATA(si->sta->addr));
-
-	si->scan_band = !si->scan_band;
+	MSG(DEBUG, "Trigger beacon measurement on sta=" MAC_ADDR_FMT " op_class=%d channel=%d\n",
+	    MAC_ADDR_DATA(si->sta->addr), op_class, channel);
 
 	blob_buf_init(&b, 0);
 	blobmsg_printf(&b, "addr", MAC_ADDR_FMT, MAC_ADDR_DATA(si->sta->addr));
 	blobmsg_add_string(&b, "ssid", si->node->ssid);
 	blobmsg_add_u32(&b, "mode", BEACON_MEASUREMENT_ACTIVE);
-	blobmsg_add_u32(&b, "duration", config.roam_scan_interval / 100);
-	blobmsg_add_u32(&b, "channel", 0);
-	blobmsg_add_u32(&b, "op_class", si->scan_band ? 1 : 12);
+	blobmsg_add_u32(&b, "duration", duration);
+	blobmsg_add_u32(&b, "channel", channel);
+	blobmsg_add_u32(&b, "op_class", op_class);
 	return ubus_invoke(ubus_ctx, ln->obj_id, "rrm_beacon_req", b.head, NULL, 0, 100);
 }
 
@@ -28,6 +28,7 @@
 #include <libubus.h>
 #include "utils.h"
 #include "timeout.h"
+#include "event.h"
 
 #define NO_SIGNAL 0xff
 
@@ -60,6 +61,12 @@ enum usteer_sta_connection_state {
 	STA_DISCONNECTED = 2,
 };
 
+enum usteer_remote_sta_filter {
+	REMOTE_STA_FILTER_NONE = 0,
+	REMOTE_STA_FILTER_SEEN = 1,
+	REMOTE_STA_FILTER_INTEREST = 2,
+};
+
 enum usteer_beacon_measurement_mode {
 	BEACON_MEASUREMENT_PASSIVE = 0,
 	BEACON_MEASUREMENT_ACTIVE = 1,
@@ -67,13 +74,26 @@ enum usteer_beacon_measurement_mode {
 };
 
 struct sta_info;
+struct usteer_scan_radio;
 struct usteer_local_node;
 struct usteer_remote_host;
 
+enum roam_trigger_state {
+	ROAM_TRIGGER_IDLE,
+	ROAM_TRIGGER_SCAN,
+	ROAM_TRIGGER_SCAN_DONE,
+	ROAM_TRIGGER_WAIT_KICK,
+	ROAM_TRIGGER_NOTIFY_KICK,
+	ROAM_TRIGGER_KICK,
+};
+
+#define __ROAM_TRIGGER_MAX	(ROAM_TRIGGER_KICK + 1)
+
 struct usteer_node {
 	struct avl_node avl;
 	struct list_head sta_info;
 	struct list_head measurements;
+	int n_measurements;
 
 	enum usteer_node_type type;
 
@@ -96,6 +116,10 @@ struct usteer_node {
 		int target;
 	} roam_events;
 
+	/* policy decisions for this node, see the metrics ubus method */
+	uint32_t event_count[__UEV_TYPE_MAX][__UEV_REASON_MAX];
+	uint32_t roam_sm_count[__ROAM_TRIGGER_MAX];
+
 	uint64_t created;
 };
 
@@ -149,6 +173,10 @@ struct usteer_config {
 	uint32_t debug_level;
 
 	bool ipv6;
+	bool peer_stream;
+	bool remote_ingest_thread;
+	bool aggregator;
+	bool summary_only;
 
 	uint32_t sta_block_timeout;
 	uint32_t local_sta_timeout;
@@ -157,6 +185,7 @@ struct usteer_config {
 	uint32_t max_retry_band;
 	uint32_t seen_policy_timeout;
 	uint32_t measurement_report_timeout;
+	uint32_t measurement_report_limit;
 
 	bool assoc_steering;
 
@@ -166,7 +195,10 @@ struct usteer_config {
 	uint32_t load_balancing_threshold;
 
 	uint32_t remote_update_interval;
+	uint32_t remote_update_interval_min;
+	uint32_t remote_update_interval_max;
 	uint32_t remote_node_timeout;
+	uint32_t remote_sta_filter;
 
 	int32_t min_snr;
 	uint32_t min_snr_kick_delay;
@@ -182,6 +214,10 @@ struct usteer_config {
 
 	int32_t roam_trigger_snr;
 	uint32_t roam_trigger_interval;
+	uint32_t roam_predict_time;
+
+	uint32_t beacon_req_max_active;
+	uint32_t beacon_req_airtime;
 
 	uint32_t roam_kick_delay;
 
@@ -193,8 +229,12 @@ struct usteer_config {
 	uint32_t load_kick_min_clients;
 	uint32_t load_kick_reason_code;
 
+	uint32_t snapshot_interval;
+
 	const char *node_up_script;
 	uint32_t event_log_mask;
+	uint32_t event_ring_size;
+	uint32_t metrics_port;
 
 	struct blob_attr *ssid_list;
 };
@@ -214,13 +254,24 @@ struct sta_info_stats {
 	uint32_t blocked_last_time;
 };
 
-enum roam_trigger_state {
-	ROAM_TRIGGER_IDLE,
-	ROAM_TRIGGER_SCAN,
-	ROAM_TRIGGER_SCAN_DONE,
-	ROAM_TRIGGER_WAIT_KICK,
-	ROAM_TRIGGER_NOTIFY_KICK,
-	ROAM_TRIGGER_KICK,
+#define STA_SIGNAL_HISTORY	8
+
+struct sta_signal_history {
+	struct {
+		uint64_t time;
+		int signal;
+	} samples[STA_SIGNAL_HISTORY];
+	uint8_t next;
+	uint8_t count;
+
+	/* Exponentially weighted average, in 1/16 dB */
+	int ewma;
+
+	/* Linear regression sums, times relative to the newest sample */
+	int64_t sum_t;
+	int64_t sum_s;
+	int64_t sum_tt;
+	int64_t sum_ts;
 };
 
 struct sta_info {
@@ -238,6 +289,24 @@ struct sta_info {
 	uint64_t last_connected;
 	int signal;
 
+	/* Latest signal from either probes or beacon reports, used by policy */
+	struct {
+		int signal;
+		uint64_t time;
+	} est;
+
+	struct sta_signal_history history;
+
+	/* Beacon measurement scheduling, see scan.c */
+	struct {
+		struct list_head list;
+		struct usteer_scan_radio *radio;
+		uint64_t end;
+		int prio;
+		uint8_t idx;
+		bool queued;
+	} scan;
+
 	enum roam_trigger_state roam_state;
 	uint8_t roam_tries;
 	uint64_t roam_event;
@@ -269,6 +338,9 @@ struct sta {
 	uint8_t addr[6];
 
 	uint8_t rrm;
+
+	/* Last time a remote host reported tracking this station */
+	uint64_t remote_interest;
 };
 
 struct usteer_beacon_report {
@@ -279,7 +351,7 @@ struct usteer_beacon_report {
 struct usteer_measurement_report {
 	struct usteer_timeout timeout;
 
-	struct list_head list;
+	struct list_head hash_list;
 
 	struct usteer_node *node;
 	struct list_head node_list;
@@ -299,6 +371,7 @@ extern struct avl_tree stations;
 extern struct ubus_object usteer_obj;
 extern uint64_t current_time;
 extern const char * const event_types[__EVENT_TYPE_MAX];
+extern const char * const roam_trigger_states[__ROAM_TRIGGER_MAX];
 extern struct blob_attr *host_info_blob;
 
 void usteer_update_time(void);
@@ -313,7 +386,10 @@ void usteer_local_node_kick(struct usteer_local_node *ln);
 
 void usteer_ubus_init(struct ubus_context *ctx);
 void usteer_ubus_kick_client(struct sta_info *si);
-int usteer_ubus_trigger_client_scan(struct sta_info *si);
+int usteer_ubus_trigger_client_scan(struct sta_info *si, int op_class,
+				    int channel, uint32_t duration);
+void usteer_scan_request(struct sta_info *si, int prio);
+void usteer_scan_cancel(struct sta_info *si);
 int usteer_ubus_notify_client_disassoc(struct sta_info *si);
 int usteer_ubus_bss_transition_request(struct sta_info *si,
 				       uint8_t dialog_token,
@@ -329,6 +405,12 @@ bool usteer_sta_supports_beacon_measurement_mode(struct sta *sta, enum usteer_be
 void usteer_sta_disconnected(struct sta_info *si);
 void usteer_sta_info_update_timeout(struct sta_info *si, int timeout);
 void usteer_sta_info_update(struct sta_info *si, int signal, bool avg);
+void usteer_sta_info_update_estimate(struct sta_info *si, int signal, uint64_t time);
+int usteer_sta_info_signal(struct sta_info *si);
+int usteer_sta_info_signal_avg(struct sta_info *si);
+double usteer_sta_info_signal_slope(struct sta_info *si);
+int usteer_sta_info_signal_predict(struct sta_info *si, uint32_t ms);
+int usteer_rcpi_to_signal(uint8_t rcpi);
 
 static inline const char *usteer_node_name(struct usteer_node *node)
 {
@@ -346,19 +428,44 @@ bool usteer_check_request(struct sta_info *si, enum usteer_event_type type);
 void config_set_interfaces(struct blob_attr *data);
 void config_get_interfaces(struct blob_buf *buf);
 
+void config_set_peers(struct blob_attr *data);
+void config_get_peers(struct blob_buf *buf);
+
 void config_set_node_up_script(struct blob_attr *data);
 void config_get_node_up_script(struct blob_buf *buf);
 
 void config_set_ssid_list(struct blob_attr *data);
 void config_get_ssid_list(struct blob_buf *buf);
 
+void config_set_event_trace(struct blob_attr *data);
+void config_get_event_trace(struct blob_buf *buf);
+
+void usteer_evring_update_config(void);
+void config_set_event_ring(struct blob_attr *data);
+void config_get_event_ring(struct blob_buf *buf);
+
 int usteer_interface_init(void);
 void usteer_interface_add(const char *name);
 void usteer_sta_node_cleanup(struct usteer_node *node);
 void usteer_send_sta_update(struct sta_info *si);
+void usteer_send_update_soon(void);
+void usteer_remote_interest_changed(void);
 
 void usteer_run_hook(const char *name, const char *arg);
 
+void usteer_snapshot_write(void);
+void usteer_snapshot_update_config(void);
+
+uint64_t usteer_metrics_time(void);
+void usteer_metrics_decision(enum usteer_event_type type, uint64_t start);
+void usteer_metrics_update_config(void);
+void config_set_metrics_socket(struct blob_attr *data);
+void config_get_metrics_socket(struct blob_buf *buf);
+void usteer_snapshot_node_added(struct usteer_node *node);
+
+void usteer_trace_event(struct usteer_local_node *ln, const char *method,
+			struct blob_attr *msg);
+
 void usteer_dump_node(struct blob_buf *buf, struct usteer_node *node);
 void usteer_dump_host(struct blob_buf *buf, struct usteer_remote_host *host);
 